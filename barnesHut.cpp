@@ -0,0 +1,220 @@
+#include "barnesHut.h"
+#include "forceKernels.h"
+#include <algorithm>
+#include <cmath>
+
+static std::uint64_t spreadBits(std::uint32_t v) {
+    // Insert a zero bit between each bit of v, so two spread values can be interleaved into a Morton key.
+    std::uint64_t s = v;
+    s = (s | (s << 16)) & 0x0000FFFF0000FFFFULL;
+    s = (s | (s << 8))  & 0x00FF00FF00FF00FFULL;
+    s = (s | (s << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+    s = (s | (s << 2))  & 0x3333333333333333ULL;
+    s = (s | (s << 1))  & 0x5555555555555555ULL;
+    return s;
+}
+
+static std::uint32_t quantize(double v, double lo, double side) {
+    double q = (v - lo)/side*4294967296.0;
+    if (q <= 0) return 0;
+    if (q >= 4294967295.0) return 0xFFFFFFFFu;
+    return (std::uint32_t)q;
+}
+
+void QuadTree::build(const double* x, const double* y, const double* m, unsigned int n) {
+    // Abstract: Rebuild the tree for the current positions. The arena and scratch vectors keep their capacity
+    //      between steps, so after the first step a rebuild does no allocation.
+    // Postcondition: nodes[0] is the root covering every body, and sx/sy/sm hold the bodies in Morton order.
+    nodes.clear();
+    keyed.resize(n);
+    sx.resize(n);
+    sy.resize(n);
+    sm.resize(n);
+    if (n == 0) return;
+
+    // State 1 (bounding square): The root cell is the smallest square containing every body.
+    double minX = x[0], maxX = x[0], minY = y[0], maxY = y[0];
+    for (unsigned int i = 1; i < n; i++) {
+        minX = std::min(minX, x[i]); maxX = std::max(maxX, x[i]);
+        minY = std::min(minY, y[i]); maxY = std::max(maxY, y[i]);
+    }
+    double side = std::max(maxX - minX, maxY - minY);
+    if (side == 0) side = 1;
+
+    // State 2 (sorted): Bodies are ordered by Morton key. The x bit of each level is the more significant one, so
+    // at tree level L the quadrant of a key is (key >> 2*(31-L)) & 3.
+    for (unsigned int i = 0; i < n; i++) {
+        std::uint64_t key = (spreadBits(quantize(x[i], minX, side)) << 1) | spreadBits(quantize(y[i], minY, side));
+        keyed[i] = std::make_pair(key, i);
+    }
+    std::sort(keyed.begin(), keyed.end());
+    for (unsigned int p = 0; p < n; p++) {
+        sx[p] = x[keyed[p].second];
+        sy[p] = y[keyed[p].second];
+        sm[p] = m[keyed[p].second];
+    }
+
+    // State 3 (tree built): Every node has its children, mass and centre of mass filled in.
+    QuadNode root;
+    root.cx = minX + side/2;
+    root.cy = minY + side/2;
+    root.halfSize = side/2;
+    root.begin = 0;
+    root.end = n;
+    nodes.push_back(root);
+    this->buildNode(0, 0);
+}
+
+void QuadTree::buildNode(unsigned int k, unsigned int level) {
+    // Split node k into its non-empty quadrants, unless it is small enough (or deep enough) to be a leaf.
+    // Note that nodes may reallocate while children are added, so we only ever hold indices into it.
+    unsigned int begin = nodes[k].begin;
+    unsigned int end = nodes[k].end;
+    nodes[k].numChildren = 0;
+    nodes[k].firstChild = 0;
+
+    if (end - begin > leafSize && level < 32) {
+        unsigned int shift = 2*(31 - level);
+        unsigned int bounds[5];
+        bounds[0] = begin;
+        for (unsigned int q = 0; q < 4; q++) {
+            bounds[q + 1] = std::partition_point(keyed.begin() + bounds[q], keyed.begin() + end,
+                [shift, q](const std::pair<std::uint64_t, unsigned int>& e) { return ((e.first >> shift) & 3) <= q; })
+                - keyed.begin();
+        }
+
+        unsigned int firstChild = nodes.size();
+        double h = nodes[k].halfSize/2;
+        for (unsigned int q = 0; q < 4; q++) {
+            if (bounds[q] == bounds[q + 1]) continue;
+            QuadNode child;
+            child.cx = nodes[k].cx + ((q & 2) ? h : -h);
+            child.cy = nodes[k].cy + ((q & 1) ? h : -h);
+            child.halfSize = h;
+            child.begin = bounds[q];
+            child.end = bounds[q + 1];
+            nodes.push_back(child);
+        }
+        unsigned int numChildren = nodes.size() - firstChild;
+        nodes[k].firstChild = firstChild;
+        nodes[k].numChildren = numChildren;
+        for (unsigned int c = 0; c < numChildren; c++) {
+            this->buildNode(firstChild + c, level + 1);
+        }
+    }
+
+    // Mass and centre of mass, from the children or (for a leaf) straight from the bodies.
+    double M = 0, Mx = 0, My = 0;
+    if (nodes[k].numChildren == 0) {
+        for (unsigned int p = begin; p < end; p++) {
+            M += sm[p];
+            Mx += sm[p]*sx[p];
+            My += sm[p]*sy[p];
+        }
+    } else {
+        for (unsigned int c = 0; c < nodes[k].numChildren; c++) {
+            const QuadNode& child = nodes[nodes[k].firstChild + c];
+            M += child.mass;
+            Mx += child.mass*child.comX;
+            My += child.mass*child.comY;
+        }
+    }
+    nodes[k].mass = M;
+    nodes[k].comX = (M > 0) ? Mx/M : nodes[k].cx;
+    nodes[k].comY = (M > 0) ? My/M : nodes[k].cy;
+}
+
+void QuadTree::forceOnBody(unsigned int p, double theta, double eps2, double& Fx, double& Fy, double& U,
+                           unsigned long& count) const {
+    // Abstract: Walk the tree for the body at Morton position p. A node containing p itself is always opened, so a
+    //      body never interacts with a centre of mass it contributes to.
+    // Postcondition: (Fx, Fy) is the approximate net gravitational force on body p, U its approximate potential
+    //      energy in the field of all the other bodies, and count has been increased by the interactions evaluated.
+    //      Every interaction is softened by eps2 (see accumulateRowForces); the opening test uses the true distance.
+    const double xp = sx[p];
+    const double yp = sy[p];
+    const double theta2 = theta*theta;
+    double ax = 0, ay = 0; // sum of G*M*d/|d|^3, multiplied by the body's own mass at the end
+    double phi = 0;        // sum of -G*M/|d|, likewise
+    unsigned long evaluated = 0;
+    unsigned int stack[4*33 + 1];
+    unsigned int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const QuadNode& node = nodes[stack[--top]];
+        bool containsP = (p >= node.begin && p < node.end);
+        if (node.numChildren == 0) {
+            for (unsigned int q = node.begin; q < node.end; q++) {
+                if (q == p) continue;
+                double dx = sx[q] - xp;
+                double dy = sy[q] - yp;
+                double r2 = dx*dx + dy*dy + eps2;
+                double s = G*sm[q]/(r2*std::sqrt(r2));
+                ax += s*dx;
+                ay += s*dy;
+                phi -= s*r2;
+            }
+            evaluated += node.end - node.begin - (containsP ? 1 : 0);
+            continue;
+        }
+        double dx = node.comX - xp;
+        double dy = node.comY - yp;
+        double r2 = dx*dx + dy*dy;
+        double size = 2*node.halfSize;
+        if (!containsP && size*size < theta2*r2) {
+            double r2s = r2 + eps2;
+            double s = G*node.mass/(r2s*std::sqrt(r2s));
+            ax += s*dx;
+            ay += s*dy;
+            phi -= s*r2s;
+            evaluated++;
+        } else {
+            for (unsigned int c = 0; c < node.numChildren; c++) {
+                stack[top++] = node.firstChild + c;
+            }
+        }
+    }
+    Fx = sm[p]*ax;
+    Fy = sm[p]*ay;
+    U = sm[p]*phi;
+    count += evaluated;
+}
+
+void QuadTree::accumulateForces(double* fx, double* fy, double theta, double eps2, ThreadPool* pool,
+                                double& potential, unsigned long& interactions, const unsigned char* active) const {
+    // Abstract: Add the tree force on every body to fx/fy (indexed by Frame slot). Each body's walk only writes its
+    //      own entry, so workers take contiguous runs of the Morton order without any reduction step, and the forces
+    //      do not depend on the number of workers. With an active mask (indexed by slot), only the bodies whose
+    //      entry is nonzero are walked, and potential covers only their share of the pairs.
+    // Postcondition: potential is the approximate total potential energy (every pair is seen from both ends, hence
+    //      the factor 1/2) and interactions the number of body-body and body-node interactions evaluated. Both are
+    //      summed per worker and then in worker order.
+    const unsigned int n = keyed.size();
+    const unsigned int workers = pool ? pool->size() : 1;
+    std::vector<double> workerPotential(workers, 0);
+    std::vector<unsigned long> workerInteractions(workers, 0);
+    auto walk = [&](unsigned int w) {
+        unsigned int pBegin = (unsigned long)n*w/workers;
+        unsigned int pEnd = (unsigned long)n*(w + 1)/workers;
+        double U = 0;
+        unsigned long count = 0;
+        for (unsigned int p = pBegin; p < pEnd; p++) {
+            if (active && !active[keyed[p].second]) continue;
+            double Fx, Fy, Up;
+            this->forceOnBody(p, theta, eps2, Fx, Fy, Up, count);
+            fx[keyed[p].second] += Fx;
+            fy[keyed[p].second] += Fy;
+            U += Up;
+        }
+        workerPotential[w] = U;
+        workerInteractions[w] = count;
+    };
+    if (pool) pool->runOnAll(walk);
+    else walk(0);
+    potential = 0;
+    interactions = 0;
+    for (unsigned int w = 0; w < workers; w++) {
+        potential += workerPotential[w]/2;
+        interactions += workerInteractions[w];
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include "threadPool.h"
+
+// ==========================================================================================
+// Node of a Barnes-Hut quadtree. Nodes live in one arena vector; the children of a node are stored next to each
+// other, so a node only needs the index of its first child and how many (non-empty) children it has. Every node
+// also owns a contiguous range of bodies in the tree's Morton-sorted order.
+struct QuadNode {
+    double cx, cy, halfSize;    // square cell this node covers, in meters
+    double mass, comX, comY;    // total mass and centre of mass of the bodies inside
+    unsigned int begin, end;    // bodies [begin, end) in Morton order
+    unsigned int firstChild;    // arena index of the first child; unused for leaves
+    unsigned int numChildren;   // 0 for a leaf
+};
+
+// ==========================================================================================
+// Barnes-Hut force solver on a 2D quadtree, rebuilt from scratch each step. Bodies are sorted along a Morton
+// (Z-order) curve so that every node covers a contiguous run of bodies and nearby bodies sit next to each other in
+// memory. Forces are then found per body by walking the tree: a cell whose size s and distance d satisfy
+// s/d < theta is replaced by its centre of mass, anything closer is opened. theta = 0 reduces to direct summation.
+class QuadTree {
+public:
+    // Constructor
+    QuadTree() : leafSize(8) {}
+
+    // Getters
+    unsigned int numNodes() const { return nodes.size(); }
+
+    // Member functions
+    void build(const double* x, const double* y, const double* m, unsigned int n);
+    void accumulateForces(double* fx, double* fy, double theta, double eps2, ThreadPool* pool, double& potential,
+                          unsigned long& interactions, const unsigned char* active = NULL) const;
+
+private:
+    void buildNode(unsigned int k, unsigned int level);
+    void forceOnBody(unsigned int p, double theta, double eps2, double& Fx, double& Fy, double& U,
+                     unsigned long& count) const;
+
+    unsigned int leafSize;                                  // nodes with at most this many bodies are not split
+    std::vector<QuadNode> nodes;                            // arena; node 0 is the root
+    std::vector<std::pair<std::uint64_t, unsigned int>> keyed; // (Morton key, Frame slot), sorted by key
+    std::vector<double> sx, sy, sm;                         // positions and masses copied into Morton order
+};
@@ -0,0 +1,189 @@
+#include "modelClasses.h"
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <sys/resource.h>
+
+// ==========================================================================================
+// Benchmark driver for the force kernel and the step loop. Build it alongside the model sources, e.g.
+//      g++ -O2 -std=c++17 -pthread -o benchmark.out benchmark.cpp modelClasses.cpp forceKernels.cpp ...
+// and run
+//      ./benchmark.out [-json results.json] [-max_n N] [-threads T] [-min_time seconds]
+// Every case is repeated until it has run for at least min_time seconds. Results are printed as a table and, with
+// -json, also written as one JSON object per case so that two runs can be diffed or plotted.
+
+struct BenchResult {
+    std::string name;           // e.g. "step/direct/random"
+    std::string kernel;         // force kernel ISA in use
+    unsigned int n;             // bodies
+    unsigned int threads;
+    double seconds;             // total measured time
+    unsigned long iterations;   // calls of the timed operation
+    double interactionsPerSec;  // pair interactions evaluated per second (0 where not meaningful)
+    double stepsPerSec;         // Frame steps per second (0 for kernel-only cases)
+    long peakRssKb;             // peak resident set size of the process so far
+};
+
+static long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+static void fillFrame(Frame& F, unsigned int n, bool clustered, unsigned int seed) {
+    // Random: uniform in a 10 AU square. Clustered: 8 Gaussian clumps of 0.1 AU scattered over the same square,
+    // which is the harder case for a tree code. Bodies get small random velocities and planet-like masses.
+    const double AU = 1.496*pow(10,11);
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(-5*AU, 5*AU);
+    std::normal_distribution<double> clump(0, 0.1*AU);
+    std::uniform_real_distribution<double> speed(-1000, 1000);
+    std::uniform_real_distribution<double> mass(1*pow(10,22), 1*pow(10,25));
+    std::vector<std::pair<double, double>> centres;
+    for (int c = 0; c < 8; c++) {
+        centres.push_back(std::make_pair(uniform(rng), uniform(rng)));
+    }
+    for (unsigned int i = 0; i < n; i++) {
+        std::pair<double, double> pos;
+        if (clustered) {
+            const std::pair<double, double>& centre = centres[i % centres.size()];
+            pos = std::make_pair(centre.first + clump(rng), centre.second + clump(rng));
+        } else {
+            pos = std::make_pair(uniform(rng), uniform(rng));
+        }
+        F.addParticle(Particle("b" + std::to_string(i), mass(rng), pos, std::make_pair(speed(rng), speed(rng))));
+    }
+}
+
+template <typename Op>
+static void timeRepeated(double minTime, Op op, double& seconds, unsigned long& iterations) {
+    // Run op once to warm caches and allocations, then repeatedly until minTime has elapsed.
+    op();
+    iterations = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    do {
+        op();
+        iterations++;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (seconds < minTime);
+}
+
+static void report(std::vector<BenchResult>& results, const BenchResult& r) {
+    results.push_back(r);
+    std::printf("%-28s %-7s n=%-7u threads=%-3u %12.4g interactions/s %12.4g steps/s  peak RSS %ld kB\n",
+                r.name.c_str(), r.kernel.c_str(), r.n, r.threads, r.interactionsPerSec, r.stepsPerSec, r.peakRssKb);
+    std::fflush(stdout);
+}
+
+static std::string toJson(const std::vector<BenchResult>& results) {
+    std::ostringstream out;
+    out.precision(10);
+    out << "[\n";
+    for (unsigned int k = 0; k < results.size(); k++) {
+        const BenchResult& r = results[k];
+        out << "  {\"name\": \"" << r.name << "\", \"kernel\": \"" << r.kernel << "\", \"n\": " << r.n
+            << ", \"threads\": " << r.threads << ", \"seconds\": " << r.seconds << ", \"iterations\": " << r.iterations
+            << ", \"interactions_per_sec\": " << r.interactionsPerSec << ", \"steps_per_sec\": " << r.stepsPerSec
+            << ", \"peak_rss_kb\": " << r.peakRssKb << "}" << (k + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+    return out.str();
+}
+
+int main(int argc, char* argv[]) {
+    std::string jsonFile;
+    unsigned int maxN = 100000;
+    unsigned int threads = 1;
+    double minTime = 0.2;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "-json") && a + 1 < argc) {
+            jsonFile = argv[++a];
+        } else if (!strcmp(argv[a], "-max_n") && a + 1 < argc) {
+            maxN = std::stoul(argv[++a]);
+        } else if (!strcmp(argv[a], "-threads") && a + 1 < argc) {
+            threads = std::stoul(argv[++a]);
+        } else if (!strcmp(argv[a], "-min_time") && a + 1 < argc) {
+            minTime = std::stod(argv[++a]);
+        } else {
+            std::cout << "Usage: " << argv[0] << " [-json file] [-max_n N] [-threads T] [-min_time seconds]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    const KernelIsa bestIsa = activeForceKernel();
+
+    // ========================================================================
+    // Microbenchmarks: the pair force and one full force evaluation, for every kernel the CPU supports
+    // ========================================================================
+
+    {
+        Frame F;
+        Particle p1("p1", 5.972*pow(10,24), std::make_pair(1.496*pow(10,11), 0), std::make_pair(0, 0));
+        Particle p2("p2", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, 0));
+        volatile double sink = 0;
+        BenchResult r = {"pair/getGravitationalForceBetween", "scalar", 2, 1, 0, 0, 0, 0, 0};
+        timeRepeated(minTime, [&] {
+            for (int k = 0; k < 1000; k++) sink = sink + F.getGravitationalForceBetween(p1, p2).first;
+        }, r.seconds, r.iterations);
+        r.iterations *= 1000;
+        r.interactionsPerSec = r.iterations/r.seconds;
+        r.peakRssKb = peakRssKb();
+        report(results, r);
+    }
+
+    const unsigned int forceSizes[] = {2, 16, 128, 1024, 4096};
+    for (int isa = KERNEL_SCALAR; isa <= bestIsa; isa++) {
+        selectForceKernel((KernelIsa)isa);
+        for (unsigned int n : forceSizes) {
+            if (n > maxN) continue;
+            Frame F;
+            fillFrame(F, n, false, 1);
+            F.setNumThreads(threads);
+            BenchResult r = {"force/updateAllForces", kernelIsaName((KernelIsa)isa), n, threads, 0, 0, 0, 0, 0};
+            timeRepeated(minTime, [&] { F.updateAllForces(); }, r.seconds, r.iterations);
+            r.interactionsPerSec = r.iterations*(n*(n - 1)/2.0)/r.seconds;
+            r.peakRssKb = peakRssKb();
+            report(results, r);
+        }
+    }
+    selectForceKernel(bestIsa);
+
+    // ========================================================================
+    // Macrobenchmarks: advanceSingleTimeStep throughput over N, for both distributions
+    // ========================================================================
+
+    // Direct summation stops where a single step would take far longer than min_time; Barnes-Hut and the particle
+    // mesh (at its default 256 cells) cover the rest.
+    const unsigned int stepSizes[] = {2, 8, 32, 128, 512, 2048, 8192, 32768, 100000};
+    const unsigned int maxDirectN = 8192;
+    const ForceBackend backends[] = {DIRECT_SUMMATION, BARNES_HUT, PARTICLE_MESH};
+    const char* backendNames[] = {"direct/", "barnes_hut/", "particle_mesh/"};
+    for (int clustered = 0; clustered < 2; clustered++) {
+        const char* distribution = clustered ? "clustered" : "random";
+        for (int b = 0; b < 3; b++) {
+            for (unsigned int n : stepSizes) {
+                if (n > maxN || (backends[b] == DIRECT_SUMMATION && n > maxDirectN)) continue;
+                Frame F(60, HistoryPolicy::currentOnly());
+                F.setIntegrator(VELOCITY_VERLET);
+                F.setNumThreads(threads);
+                F.setForceBackend(backends[b]);
+                fillFrame(F, n, clustered, 2);
+                BenchResult r = {std::string("step/") + backendNames[b] + distribution,
+                                 kernelIsaName(bestIsa), n, threads, 0, 0, 0, 0, 0};
+                timeRepeated(minTime, [&] { F.advanceSingleTimeStep(); }, r.seconds, r.iterations);
+                r.stepsPerSec = r.iterations/r.seconds;
+                r.interactionsPerSec = (backends[b] == DIRECT_SUMMATION) ? r.stepsPerSec*(n*(n - 1)/2.0) : 0;
+                r.peakRssKb = peakRssKb();
+                report(results, r);
+            }
+        }
+    }
+
+    if (!jsonFile.empty()) {
+        std::ofstream out(jsonFile);
+        out << toJson(results);
+        std::cout << "Results written to " << jsonFile << std::endl;
+    }
+    return 0;
+}
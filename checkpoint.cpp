@@ -0,0 +1,76 @@
+#include "checkpoint.h"
+#include <cstdio>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool writeFileAtomically(const std::string& filename, const std::vector<char>& image) {
+    std::string tmpName = filename + ".tmp";
+    int fd = ::open(tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    std::size_t done = 0;
+    while (done < image.size()) {
+        ssize_t n = ::write(fd, image.data() + done, image.size() - done);
+        if (n <= 0) {
+            ::close(fd);
+            return false;
+        }
+        done += n;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ok = (::close(fd) == 0) && ok;
+    return ok && std::rename(tmpName.c_str(), filename.c_str()) == 0;
+}
+
+MappedFile::MappedFile(const std::string& filename) : data(NULL), length(0) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat info;
+    if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* mapped = ::mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            data = static_cast<const char*>(mapped);
+            length = info.st_size;
+        }
+    }
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data) ::munmap(const_cast<char*>(data), length);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    this->wait();
+}
+
+bool CheckpointWriter::readyForNext() {
+    // Returns whether a new image can be submitted now. Callers check this before building an image, so a busy
+    // writer costs the step loop nothing; the missed checkpoint is counted as skipped.
+    if (busy.load(std::memory_order_acquire)) {
+        skipped++;
+        return false;
+    }
+    return true;
+}
+
+void CheckpointWriter::submit(std::vector<char>& image) {
+    // Abstract: Start writing image in the background, taking ownership of its contents. image is left holding the
+    //      previous buffer, so the caller recycles its capacity for the next checkpoint.
+    // Precondition: readyForNext() has just returned true.
+    assert (!busy.load(std::memory_order_acquire));
+    if (worker.joinable()) worker.join();
+    pending.swap(image);
+    busy.store(true, std::memory_order_release);
+    worker = std::thread([this] {
+        if (!writeFileAtomically(filename, pending)) failed++;
+        busy.store(false, std::memory_order_release);
+    });
+}
+
+void CheckpointWriter::wait() {
+    // Postcondition: No write is in flight.
+    if (worker.joinable()) worker.join();
+}
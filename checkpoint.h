@@ -0,0 +1,105 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// ==========================================================================================
+// File plumbing for Frame checkpoints (see Frame::saveCheckpoint and Frame::restoreCheckpoint). The snapshot layout
+// itself is owned by Frame; this file only knows how to get a byte image onto disk safely and back into memory fast.
+
+const std::uint32_t CHECKPOINT_FORMAT_VERSION = 6;
+
+// Fixed-size header at the start of every checkpoint (host byte order). It is followed by eight arrays of numBodies
+// doubles -- x, y, vx, vy, m, fx, fy, radius -- then four arrays of numTracers doubles -- the tracers' x, y, vx, vy --
+// then, if timescalesCurrent is set, two more arrays of numBodies doubles -- each body's timescale and block level --
+// and finally numBodies Particle IDs followed by numTracers tracer IDs, each stored as a uint32 length and its bytes.
+// The header is a multiple of 8 bytes long, so the arrays are naturally aligned in a mapped file.
+struct CheckpointHeader {
+    char magic[8];                  // "ADCHKPT\0"
+    std::uint32_t version;          // CHECKPOINT_FORMAT_VERSION
+    std::uint32_t numBodies;
+    double time;
+    double dt;
+    std::uint64_t stepCount;
+    std::uint32_t integrator;       // Integrator enum value
+    std::uint32_t backend;          // ForceBackend enum value
+    double theta;
+    std::uint32_t forcesCurrent;    // nonzero if fx/fy match the stored positions (lets leapfrog resume without a
+                                    // fresh force evaluation, so a restored run is bitwise identical)
+    std::uint32_t historyStride;
+    std::uint32_t historyCapacity;
+    std::uint32_t collisionResponse;    // CollisionResponse enum value (added in version 2)
+    double softening;                   // Plummer softening length, in meters (added in version 2)
+    std::uint32_t numTracers;           // massless tracers (added in version 3)
+    std::uint32_t timeStepMode;         // TimeStepMode enum value (this and the next three added in version 4)
+    double eta;                         // TimeStepPolicy parameters
+    double minDt;
+    std::uint32_t maxLevel;
+    std::uint32_t meshCells;            // particle-mesh resolution (added in version 5)
+    double lastStep;                    // size of the step that led to the snapshot (added in version 4, moved
+                                        // behind meshCells in version 5)
+    std::uint32_t meshShortRange;       // nonzero if the particle mesh applies the short-range correction (added in
+                                        // version 5)
+    std::uint32_t timescalesCurrent;    // nonzero if the variable-step timescales and levels are stored (added in
+                                        // version 6; zero before, where it kept the header a multiple of 8 bytes)
+};
+static_assert(sizeof(CheckpointHeader) == 128, "checkpoint header layout must not depend on padding");
+
+const char CHECKPOINT_MAGIC[8] = {'A', 'D', 'C', 'H', 'K', 'P', 'T', 0};
+
+// Abstract: Write image to filename via a temporary file that is flushed to disk and then renamed over the target,
+//      so a machine dying mid-write leaves the previous checkpoint intact.
+// Postcondition: Returns whether filename now holds image.
+bool writeFileAtomically(const std::string& filename, const std::vector<char>& image);
+
+// ==========================================================================================
+// Read-only memory mapping of a whole file. Restoring from a mapping avoids any parsing or buffered reads: the state
+// arrays are copied straight out of the page cache.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator= (const MappedFile&) = delete;
+
+    bool isOpen() const { return data != NULL; }
+    const char* bytes() const { return data; }
+    std::size_t size() const { return length; }
+
+private:
+    const char* data;
+    std::size_t length;
+};
+
+// ==========================================================================================
+// Writes checkpoint images on a background thread so the step loop never waits on the disk. Only one write is in
+// flight at a time; a checkpoint that comes due while the previous one is still being written is skipped rather than
+// queued, since the next one will supersede it anyway.
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(const std::string& _filename) : filename(_filename), busy(false), skipped(0), failed(0) {}
+    ~CheckpointWriter();
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator= (const CheckpointWriter&) = delete;
+
+    // Getters
+    const std::string& getFilename() const { return filename; }
+    unsigned long checkpointsSkipped() const { return skipped; }
+    unsigned long checkpointsFailed() const { return failed.load(); }
+
+    // Member functions
+    bool readyForNext();
+    void submit(std::vector<char>& image);
+    void wait();
+
+private:
+    std::string filename;
+    std::vector<char> pending;      // image owned by the background write
+    std::thread worker;
+    std::atomic<bool> busy;
+    unsigned long skipped;
+    std::atomic<unsigned long> failed;
+};
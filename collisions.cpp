@@ -0,0 +1,142 @@
+#include "collisions.h"
+#include <algorithm>
+#include <cmath>
+
+// Bodies whose swept box covers more cells than this in either direction are not binned.
+static const std::int64_t MAX_CELLS_PER_AXIS = 4;
+
+unsigned int CollisionDetector::bucketOf(std::int64_t cx, std::int64_t cy) const {
+    // Spatial hash of an integer cell coordinate (Teschner et al. 2003).
+    std::uint64_t h = ((std::uint64_t)cx*73856093ULL) ^ ((std::uint64_t)cy*19349663ULL);
+    return (unsigned int)(h ^ (h >> 29)) & bucketMask;
+}
+
+void CollisionDetector::testPair(unsigned int i, unsigned int j, std::vector<CollisionEvent>& events) const {
+    // Narrow phase. With d(t) = d0 + t*(d1 - d0) the separation of the centres over the step, the spheres touch when
+    // |d(t)| = r_i + r_j. Solve that quadratic for its first root in [0, 1]; pairs already overlapping at the start
+    // of the step are reported at t = 0.
+    if (maxX[i] < minX[j] || maxX[j] < minX[i] || maxY[i] < minY[j] || maxY[j] < minY[i]) return;
+    const double d0x = sx0[j] - sx0[i], d0y = sy0[j] - sy0[i];
+    const double ddx = (sx1[j] - sx1[i]) - d0x, ddy = (sy1[j] - sy1[i]) - d0y;
+    const double R = sr[i] + sr[j];
+    const double a = ddx*ddx + ddy*ddy;
+    const double b = 2*(d0x*ddx + d0y*ddy);
+    const double c = d0x*d0x + d0y*d0y - R*R;
+    double t;
+    if (c <= 0) {
+        t = 0;
+    } else {
+        double disc = b*b - 4*a*c;
+        if (a == 0 || b >= 0 || disc < 0) return;   // not approaching, or the closest approach misses
+        t = (-b - std::sqrt(disc))/(2*a);
+        if (t > 1) return;
+    }
+    CollisionEvent e;
+    e.i = std::min(i, j);
+    e.j = std::max(i, j);
+    e.t = t;
+    events.push_back(e);
+}
+
+void CollisionDetector::detect(const double* x0, const double* y0, const double* x1, const double* y1,
+                               const double* radius, unsigned int n, std::vector<CollisionEvent>& events) {
+    // Abstract: Find every pair of bodies whose spheres touch while moving from (x0, y0) to (x1, y1).
+    // Postcondition: events holds each touching pair once, ordered by time of first contact (then by slots).
+    events.clear();
+    sx0 = x0; sy0 = y0; sx1 = x1; sy1 = y1; sr = radius;
+    minX.resize(n); minY.resize(n); maxX.resize(n); maxY.resize(n);
+    oversized.clear();
+    if (n < 2) return;
+
+    // State 1 (boxes): Every body's swept bounding box is known, and the cell size is twice the mean box extent.
+    double extent = 0;
+    originX = HUGE_VAL;
+    originY = HUGE_VAL;
+    for (unsigned int i = 0; i < n; i++) {
+        minX[i] = std::min(x0[i], x1[i]) - radius[i];
+        maxX[i] = std::max(x0[i], x1[i]) + radius[i];
+        minY[i] = std::min(y0[i], y1[i]) - radius[i];
+        maxY[i] = std::max(y0[i], y1[i]) + radius[i];
+        extent += std::max(maxX[i] - minX[i], maxY[i] - minY[i]);
+        originX = std::min(originX, minX[i]);
+        originY = std::min(originY, minY[i]);
+    }
+    cellSize = 2*extent/n;
+    if (!(cellSize > 0)) return;    // point particles never touch
+    unsigned int numBuckets = 1;
+    while (numBuckets < 2*n) numBuckets <<= 1;
+    bucketMask = numBuckets - 1;
+
+    // State 2 (binned): bucketEntries lists, bucket by bucket, every body whose box overlaps a cell hashed to that
+    // bucket. Built with a counting sort: count, prefix sum, then fill.
+    auto forEachCell = [&](unsigned int i, auto visit) {
+        std::int64_t cx0 = (std::int64_t)((minX[i] - originX)/cellSize);
+        std::int64_t cx1 = (std::int64_t)((maxX[i] - originX)/cellSize);
+        std::int64_t cy0 = (std::int64_t)((minY[i] - originY)/cellSize);
+        std::int64_t cy1 = (std::int64_t)((maxY[i] - originY)/cellSize);
+        for (std::int64_t cx = cx0; cx <= cx1; cx++) {
+            for (std::int64_t cy = cy0; cy <= cy1; cy++) {
+                visit(this->bucketOf(cx, cy));
+            }
+        }
+    };
+    auto tooLarge = [&](unsigned int i) {
+        return (maxX[i] - minX[i])/cellSize >= MAX_CELLS_PER_AXIS || (maxY[i] - minY[i])/cellSize >= MAX_CELLS_PER_AXIS;
+    };
+    bucketStart.assign(numBuckets + 1, 0);
+    for (unsigned int i = 0; i < n; i++) {
+        if (tooLarge(i)) {
+            oversized.push_back(i);
+            continue;
+        }
+        forEachCell(i, [&](unsigned int b) { bucketStart[b + 1]++; });
+    }
+    for (unsigned int b = 0; b < numBuckets; b++) {
+        bucketStart[b + 1] += bucketStart[b];
+    }
+    bucketEntries.resize(bucketStart[numBuckets]);
+    bucketFill.assign(bucketStart.begin(), bucketStart.end() - 1);
+    for (unsigned int i = 0, o = 0; i < n; i++) {
+        if (o < oversized.size() && oversized[o] == i) {
+            o++;
+            continue;
+        }
+        forEachCell(i, [&](unsigned int b) { bucketEntries[bucketFill[b]++] = i; });
+    }
+
+    // State 3 (tested): Every pair sharing a bucket, and every pair involving an oversized body, has been through the
+    // narrow phase. A pair whose boxes share several cells is only tested in the bucket of the cell holding the
+    // lower-left corner of their overlap.
+    for (unsigned int b = 0; b < numBuckets; b++) {
+        for (unsigned int p = bucketStart[b]; p < bucketStart[b + 1]; p++) {
+            for (unsigned int q = p + 1; q < bucketStart[b + 1]; q++) {
+                unsigned int i = bucketEntries[p];
+                unsigned int j = bucketEntries[q];
+                if (i == j) continue;
+                std::int64_t cx = (std::int64_t)((std::max(minX[i], minX[j]) - originX)/cellSize);
+                std::int64_t cy = (std::int64_t)((std::max(minY[i], minY[j]) - originY)/cellSize);
+                if (this->bucketOf(cx, cy) != b) continue;
+                this->testPair(i, j, events);
+            }
+        }
+    }
+    for (unsigned int o = 0; o < oversized.size(); o++) {
+        unsigned int i = oversized[o];
+        for (unsigned int j = 0; j < n; j++) {
+            if (j == i || (tooLarge(j) && j < i)) continue;
+            this->testPair(i, j, events);
+        }
+    }
+
+    // State 4 (ordered): Pairs reported twice (two of their cells hashed to one bucket) are dropped, and the rest
+    // are sorted by time of contact.
+    std::sort(events.begin(), events.end(), [](const CollisionEvent& a, const CollisionEvent& b) {
+        return (a.i != b.i) ? a.i < b.i : a.j < b.j;
+    });
+    events.erase(std::unique(events.begin(), events.end(), [](const CollisionEvent& a, const CollisionEvent& b) {
+        return a.i == b.i && a.j == b.j;
+    }), events.end());
+    std::stable_sort(events.begin(), events.end(), [](const CollisionEvent& a, const CollisionEvent& b) {
+        return a.t < b.t;
+    });
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+// ==========================================================================================
+// Collision handling for Frame (see Frame::setCollisionResponse). Bodies are treated as spheres of their Particle's
+// radius. Within one step each body is assumed to move in a straight line from its position at the start of the
+// step to its position at the end, so fast bodies cannot tunnel through each other between samples.
+
+// What happens when two bodies touch.
+enum CollisionResponse {
+    COLLISIONS_IGNORED, // bodies pass through each other (no detection, pure Newtonian forces)
+    COLLISION_MERGE,    // perfectly inelastic: the pair becomes one body with the summed mass and momentum, at the
+                        // centre of mass, with the combined volume. The lighter body's ID is removed from the Frame.
+    COLLISION_BOUNCE,   // elastic bounce of hard spheres at the moment of contact, conserving momentum and energy
+    COLLISION_SOFTEN    // no detection; forces use a Plummer softening length so close encounters stay finite
+};
+
+// One pair of touching bodies, as found by CollisionDetector::detect().
+struct CollisionEvent {
+    unsigned int i, j;  // slots of the two bodies, i < j
+    double t;           // fraction of the step at which the spheres first touch, in [0, 1]
+};
+
+// ==========================================================================================
+// O(N) collision detection. The broad phase bins each body's swept bounding box (start and end position, grown by
+// its radius) into a uniform grid whose cells are hashed into a table with about two buckets per body, so the grid
+// needs no bounds and its size does not depend on how spread out the bodies are. Only bodies sharing a bucket are
+// paired up, and each candidate pair goes through an exact swept-sphere test. Cells are sized from the mean swept
+// extent, so most bodies land in a single cell; the rare body much larger than that (a star among debris) is kept
+// out of the grid and tested against everything instead. All storage is reused from step to step.
+class CollisionDetector {
+public:
+    // Constructor
+    CollisionDetector() : cellSize(1), originX(0), originY(0), bucketMask(0) {}
+
+    // Member functions
+    void detect(const double* x0, const double* y0, const double* x1, const double* y1, const double* radius,
+                unsigned int n, std::vector<CollisionEvent>& events);
+
+private:
+    unsigned int bucketOf(std::int64_t cx, std::int64_t cy) const;
+    void testPair(unsigned int i, unsigned int j, std::vector<CollisionEvent>& events) const;
+
+    double cellSize, originX, originY;
+    unsigned int bucketMask;                    // number of buckets - 1 (a power of two minus one)
+    std::vector<double> minX, minY, maxX, maxY; // swept bounding box of each body
+    std::vector<unsigned int> bucketStart;      // entries of bucket b are bucketEntries[bucketStart[b]..bucketStart[b+1])
+    std::vector<unsigned int> bucketEntries;    // body indices, grouped by bucket
+    std::vector<unsigned int> bucketFill;       // next free entry of each bucket while filling
+    std::vector<unsigned int> oversized;        // bodies too large to bin, tested against every other body
+    const double *sx0, *sy0, *sx1, *sy1, *sr;   // the arrays of the detect() call in progress
+};
@@ -0,0 +1,191 @@
+#include "ensemble.h"
+#include <map>
+#include <atomic>
+
+Ensemble::Ensemble(double _dt, unsigned long _numSteps) : dt(_dt), numSteps(_numSteps), ejectionRadius(HUGE_VAL),
+                                                          ejectionCheckStride(10), numThreads(1) {
+    assert (dt > 0);
+}
+
+void Ensemble::setNumThreads(unsigned int n) {
+    // Postcondition: run() spreads blocks of systems over n workers (the calling thread included).
+    assert (n > 0);
+    numThreads = n;
+    if (n == 1) pool.reset();
+    else pool.reset(new ThreadPool(n));
+}
+
+void Ensemble::setEjectionRadius(double r, unsigned int everyNSteps) {
+    // Postcondition: Every everyNSteps steps, each system is checked for a body that has moved further than r from its
+    //      centre of mass while unbound. The check costs about as much as the forces of a three-body system, so by
+    //      default it is done every 10 steps, and ejection times are then only resolved to that many steps.
+    assert (r > 0 && everyNSteps > 0);
+    ejectionRadius = r;
+    ejectionCheckStride = everyNSteps;
+}
+
+unsigned int Ensemble::addSystem(const std::vector<Particle>& bodies) {
+    // Postcondition: bodies are queued as an independent system, whose summary will be at the returned index.
+    assert (!bodies.empty());
+    systems.push_back(bodies);
+    return systems.size() - 1;
+}
+
+void Ensemble::run() {
+    // Abstract: Integrate every system for numSteps steps. Systems are grouped by body count into batches, each batch
+    //      is cut into blocks of ENSEMBLE_BLOCK_LANES systems, and workers repeatedly claim the next unclaimed block.
+    // Postcondition: getSummary(i) describes system i at the end of its run.
+    summaries.assign(systems.size(), RunSummary());
+
+    // State 1 (batched): batches[k] lists the systems sharing one body count, and work lists every block.
+    std::map<unsigned int, std::vector<unsigned int>> byBodyCount;
+    for (unsigned int i = 0; i < systems.size(); i++) {
+        byBodyCount[systems[i].size()].push_back(i);
+    }
+    std::vector<std::vector<unsigned int>> batches;
+    for (auto& entry : byBodyCount) {
+        batches.push_back(entry.second);
+    }
+    std::vector<std::pair<unsigned int, unsigned int>> work; // (batch, first system of the block within it)
+    for (unsigned int k = 0; k < batches.size(); k++) {
+        for (unsigned int b = 0; b < batches[k].size(); b += ENSEMBLE_BLOCK_LANES) {
+            work.push_back(std::make_pair(k, b));
+        }
+    }
+
+    // State 2 (integrated): Every block has been run to completion by some worker.
+    std::atomic<unsigned int> next(0);
+    auto job = [&](unsigned int) {
+        for (unsigned int w = next++; w < work.size(); w = next++) {
+            const std::vector<unsigned int>& batch = batches[work[w].first];
+            unsigned int begin = work[w].second;
+            unsigned int end = std::min<unsigned int>(batch.size(), begin + ENSEMBLE_BLOCK_LANES);
+            this->runBlock(batch, begin, end);
+        }
+    };
+    if (pool) pool->runOnAll(job);
+    else job(0);
+}
+
+void Ensemble::runBlock(const std::vector<unsigned int>& batch, unsigned int begin, unsigned int end) {
+    // Abstract: Run systems batch[begin..end), which all have nb bodies, in lockstep. Body b of lane l lives at index
+    //      b*L + l of the block arrays, so every loop over lanes is unit stride and each body pair is handed to the
+    //      SIMD lane kernel (see forceKernels.h) for all lanes at once.
+    // Postcondition: summaries[batch[begin..end)] are filled in.
+    const unsigned int nb = systems[batch[begin]].size();
+    const unsigned int L = end - begin;
+
+    // State 1 (gathered): The block arrays hold the initial conditions of every lane.
+    aligned_vector x(nb*L), y(nb*L), vx(nb*L), vy(nb*L), m(nb*L), ax(nb*L), ay(nb*L);
+    for (unsigned int l = 0; l < L; l++) {
+        const std::vector<Particle>& bodies = systems[batch[begin + l]];
+        for (unsigned int b = 0; b < nb; b++) {
+            x[b*L + l] = bodies[b].getCurrentPos().first;
+            y[b*L + l] = bodies[b].getCurrentPos().second;
+            vx[b*L + l] = bodies[b].getCurrentVel().first;
+            vy[b*L + l] = bodies[b].getCurrentVel().second;
+            m[b*L + l] = bodies[b].getMass();
+        }
+    }
+    std::vector<double> minR2(L, HUGE_VAL), minTime(L, 0), ejectTime(L, -1);
+    std::vector<int> ejectBody(L, -1);
+
+    auto accelerations = [&](double t) {
+        // a_i = sum_j G*m_j*(r_j - r_i)/|r_j - r_i|^3, each pair visited once for all lanes by the SIMD lane kernel,
+        // which also tracks the closest approach.
+        std::fill(ax.begin(), ax.end(), 0.0);
+        std::fill(ay.begin(), ay.end(), 0.0);
+        for (unsigned int a = 0; a < nb; a++) {
+            for (unsigned int b = a + 1; b < nb; b++) {
+                LanePair pair = {x.data() + a*L, y.data() + a*L, m.data() + a*L,
+                                 x.data() + b*L, y.data() + b*L, m.data() + b*L,
+                                 ax.data() + a*L, ay.data() + a*L, ax.data() + b*L, ay.data() + b*L,
+                                 minR2.data(), minTime.data()};
+                accumulateLanePairAccelerations(pair, L, t);
+            }
+        }
+    };
+
+    std::vector<double> totalMass(L, 0), cmX(L), cmY(L), cmVx(L), cmVy(L);
+    for (unsigned int b = 0; b < nb; b++) {
+        for (unsigned int l = 0; l < L; l++) {
+            totalMass[l] += m[b*L + l];
+        }
+    }
+    auto checkEjections = [&](double t) {
+        // A body counts as ejected once it is beyond ejectionRadius from the centre of mass and its kinetic energy
+        // relative to the centre of mass exceeds its potential energy in the field of the rest of the system. The
+        // loops run over lanes innermost, and the energy test is only reached by bodies outside the radius.
+        const double R2 = ejectionRadius*ejectionRadius;
+        std::fill(cmX.begin(), cmX.end(), 0.0);
+        std::fill(cmY.begin(), cmY.end(), 0.0);
+        std::fill(cmVx.begin(), cmVx.end(), 0.0);
+        std::fill(cmVy.begin(), cmVy.end(), 0.0);
+        for (unsigned int b = 0; b < nb; b++) {
+            for (unsigned int l = 0; l < L; l++) {
+                unsigned int k = b*L + l;
+                cmX[l] += m[k]*x[k];
+                cmY[l] += m[k]*y[k];
+                cmVx[l] += m[k]*vx[k];
+                cmVy[l] += m[k]*vy[k];
+            }
+        }
+        for (unsigned int l = 0; l < L; l++) {
+            cmX[l] /= totalMass[l];
+            cmY[l] /= totalMass[l];
+            cmVx[l] /= totalMass[l];
+            cmVy[l] /= totalMass[l];
+        }
+        for (unsigned int b = 0; b < nb; b++) {
+            for (unsigned int l = 0; l < L; l++) {
+                unsigned int k = b*L + l;
+                double dx = x[k] - cmX[l];
+                double dy = y[k] - cmY[l];
+                double r2 = dx*dx + dy*dy;
+                if (r2 <= R2 || ejectBody[l] >= 0) continue;
+                double dvx = vx[k] - cmVx[l];
+                double dvy = vy[k] - cmVy[l];
+                if (0.5*(dvx*dvx + dvy*dvy)*std::sqrt(r2) > G*(totalMass[l] - m[k])) {
+                    ejectBody[l] = b;
+                    ejectTime[l] = t;
+                }
+            }
+        }
+    };
+
+    // State 2 (integrated): Every lane has taken numSteps kick-drift-kick steps.
+    const unsigned int n = nb*L;
+    const double h = dt;
+    const bool watchEjections = std::isfinite(ejectionRadius);
+    accelerations(0);
+    for (unsigned long step = 1; step <= numSteps; step++) {
+        for (unsigned int k = 0; k < n; k++) {
+            vx[k] += h/2*ax[k];
+            vy[k] += h/2*ay[k];
+            x[k] += h*vx[k];
+            y[k] += h*vy[k];
+        }
+        accelerations(step*h);
+        for (unsigned int k = 0; k < n; k++) {
+            vx[k] += h/2*ax[k];
+            vy[k] += h/2*ay[k];
+        }
+        if (watchEjections && step % ejectionCheckStride == 0) checkEjections(step*h);
+    }
+
+    // State 3 (reduced): Each lane's final state and diagnostics are stored in its summary.
+    for (unsigned int l = 0; l < L; l++) {
+        const std::vector<Particle>& bodies = systems[batch[begin + l]];
+        RunSummary& summary = summaries[batch[begin + l]];
+        summary.finalState.clear();
+        for (unsigned int b = 0; b < nb; b++) {
+            unsigned int k = b*L + l;
+            summary.finalState.push_back(Particle(bodies[b].getID(), m[k], std::make_pair(x[k], y[k]),
+                                                  std::make_pair(vx[k], vy[k]), bodies[b].getRadius()));
+        }
+        summary.ejectionTime = ejectTime[l];
+        summary.ejectedBody = ejectBody[l];
+        summary.minSeparation = (nb > 1) ? std::sqrt(minR2[l]) : HUGE_VAL;
+        summary.minSeparationTime = minTime[l];
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "modelClasses.h"
+
+// ==========================================================================================
+// Batched runner for many small, independent systems (e.g. a sweep over initial conditions of a three-body setup).
+// A Frame with a handful of bodies has too little work to spread over threads or SIMD lanes, so instead the Ensemble
+// integrates many systems side by side: systems with the same number of bodies are grouped, and each block of
+// ENSEMBLE_BLOCK_LANES systems is laid out structure-of-arrays across systems, i.e. x[body*lanes + system]. Every
+// arithmetic loop then runs over systems with unit stride, one system per SIMD lane, and blocks are handed out to the
+// thread pool. Systems never interact and the blocks depend only on the order systems were added in, so for a given
+// force kernel ISA each system's result is bitwise independent of the thread count.
+//
+// All systems share dt and the number of steps, and use velocity Verlet. Instead of full trajectories, each run is
+// reduced to a RunSummary.
+
+const unsigned int ENSEMBLE_BLOCK_LANES = 64;
+
+struct RunSummary {
+    std::vector<Particle> finalState;   // bodies in the order given to addSystem(), at time numSteps*dt
+    double ejectionTime;                // first time a body was found escaping (see setEjectionRadius), or -1
+    int ejectedBody;                    // index of that body within the system, or -1
+    double minSeparation;               // smallest distance between any two bodies at any step, in meters
+    double minSeparationTime;           // time at which minSeparation occurred
+};
+
+class Ensemble {
+public:
+    // Constructor
+    Ensemble(double _dt, unsigned long _numSteps);
+
+    // Getters
+    double getDt() const { return dt; }
+    unsigned long getNumSteps() const { return numSteps; }
+    unsigned int size() const { return systems.size(); }
+    unsigned int getNumThreads() const { return numThreads; }
+    double getEjectionRadius() const { return ejectionRadius; }
+    unsigned int getEjectionCheckStride() const { return ejectionCheckStride; }
+    const RunSummary& getSummary(unsigned int system) const { assert (system < summaries.size()); return summaries[system]; }
+
+    // Setters
+    void setNumThreads(unsigned int n);
+    void setEjectionRadius(double r, unsigned int everyNSteps = 10);
+
+    // Member functions
+    unsigned int addSystem(const std::vector<Particle>& bodies);
+    void run();
+
+private:
+    void runBlock(const std::vector<unsigned int>& batch, unsigned int begin, unsigned int end);
+
+    double dt;
+    unsigned long numSteps;
+    double ejectionRadius;          // a body is ejected once it is this far from the system's centre of mass and
+                                    // unbound from the rest of the system; infinite (never) by default
+    unsigned int ejectionCheckStride;   // ejections are looked for every this many steps
+    std::vector<std::vector<Particle>> systems;
+    std::vector<RunSummary> summaries;
+    unsigned int numThreads;
+    std::unique_ptr<ThreadPool> pool;
+};
@@ -0,0 +1,304 @@
+#include "forceKernels.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+// GCC 12's AVX-512 intrinsics trip -Wuninitialized on their own _mm512_undefined_pd() placeholders (GCC bug 105593)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#define FORCE_KERNELS_X86 1
+#endif
+
+static double scalarRowKernel(const double* x, const double* y, const double* m, double* fx, double* fy,
+                              unsigned int i, unsigned int jBegin, unsigned int jEnd, double eps2) {
+    // Reference kernel. F = G*m_i*m_j/r^2 along the unit vector (dx, dy)/r, i.e. G*m_i*m_j*(dx, dy)/r^3.
+    const double xi = x[i];
+    const double yi = y[i];
+    const double Gmi = G*m[i];
+    double Fx_i = 0;
+    double Fy_i = 0;
+    double U = 0;
+    for (unsigned int j = jBegin; j < jEnd; j++) {
+        double dx = x[j] - xi;
+        double dy = y[j] - yi;
+        double r2 = dx*dx + dy*dy + eps2;
+        double s = Gmi*m[j]/(r2*std::sqrt(r2));
+        Fx_i += s*dx;
+        Fy_i += s*dy;
+        fx[j] -= s*dx;
+        fy[j] -= s*dy;
+        U -= s*r2;
+    }
+    fx[i] += Fx_i;
+    fy[i] += Fy_i;
+    return U;
+}
+
+#ifdef FORCE_KERNELS_X86
+__attribute__((target("avx2")))
+static double avx2RowKernel(const double* x, const double* y, const double* m, double* fx, double* fy,
+                            unsigned int i, unsigned int jBegin, unsigned int jEnd, double eps2) {
+    // Same arithmetic as scalarRowKernel, four values of j per instruction. The tail is finished by the scalar kernel.
+    const __m256d xi = _mm256_set1_pd(x[i]);
+    const __m256d yi = _mm256_set1_pd(y[i]);
+    const __m256d Gmi = _mm256_set1_pd(G*m[i]);
+    const __m256d soft = _mm256_set1_pd(eps2);
+    __m256d Fx_i = _mm256_setzero_pd();
+    __m256d Fy_i = _mm256_setzero_pd();
+    __m256d U = _mm256_setzero_pd();
+    unsigned int j = jBegin;
+    for (; j + 4 <= jEnd; j += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), xi);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), yi);
+        __m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), soft);
+        __m256d s = _mm256_div_pd(_mm256_mul_pd(Gmi, _mm256_loadu_pd(m + j)), _mm256_mul_pd(r2, _mm256_sqrt_pd(r2)));
+        __m256d Fx = _mm256_mul_pd(s, dx);
+        __m256d Fy = _mm256_mul_pd(s, dy);
+        Fx_i = _mm256_add_pd(Fx_i, Fx);
+        Fy_i = _mm256_add_pd(Fy_i, Fy);
+        U = _mm256_sub_pd(U, _mm256_mul_pd(s, r2));
+        _mm256_storeu_pd(fx + j, _mm256_sub_pd(_mm256_loadu_pd(fx + j), Fx));
+        _mm256_storeu_pd(fy + j, _mm256_sub_pd(_mm256_loadu_pd(fy + j), Fy));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, Fx_i);
+    fx[i] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, Fy_i);
+    fy[i] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, U);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + scalarRowKernel(x, y, m, fx, fy, i, j, jEnd, eps2);
+}
+
+__attribute__((target("avx512f")))
+static double avx512RowKernel(const double* x, const double* y, const double* m, double* fx, double* fy,
+                              unsigned int i, unsigned int jBegin, unsigned int jEnd, double eps2) {
+    // Same arithmetic as scalarRowKernel, eight values of j per instruction. The tail is finished by the scalar kernel.
+    const __m512d xi = _mm512_set1_pd(x[i]);
+    const __m512d yi = _mm512_set1_pd(y[i]);
+    const __m512d Gmi = _mm512_set1_pd(G*m[i]);
+    const __m512d soft = _mm512_set1_pd(eps2);
+    __m512d Fx_i = _mm512_setzero_pd();
+    __m512d Fy_i = _mm512_setzero_pd();
+    __m512d U = _mm512_setzero_pd();
+    unsigned int j = jBegin;
+    for (; j + 8 <= jEnd; j += 8) {
+        __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x + j), xi);
+        __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y + j), yi);
+        __m512d r2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), soft);
+        __m512d s = _mm512_div_pd(_mm512_mul_pd(Gmi, _mm512_loadu_pd(m + j)), _mm512_mul_pd(r2, _mm512_sqrt_pd(r2)));
+        __m512d Fx = _mm512_mul_pd(s, dx);
+        __m512d Fy = _mm512_mul_pd(s, dy);
+        Fx_i = _mm512_add_pd(Fx_i, Fx);
+        Fy_i = _mm512_add_pd(Fy_i, Fy);
+        U = _mm512_sub_pd(U, _mm512_mul_pd(s, r2));
+        _mm512_storeu_pd(fx + j, _mm512_sub_pd(_mm512_loadu_pd(fx + j), Fx));
+        _mm512_storeu_pd(fy + j, _mm512_sub_pd(_mm512_loadu_pd(fy + j), Fy));
+    }
+    fx[i] += _mm512_reduce_add_pd(Fx_i);
+    fy[i] += _mm512_reduce_add_pd(Fy_i);
+    return _mm512_reduce_add_pd(U) + scalarRowKernel(x, y, m, fx, fy, i, j, jEnd, eps2);
+}
+#endif
+
+static void scalarLaneKernel(const LanePair& p, unsigned int lBegin, unsigned int lEnd, double t) {
+    for (unsigned int l = lBegin; l < lEnd; l++) {
+        double dx = p.xb[l] - p.xa[l];
+        double dy = p.yb[l] - p.ya[l];
+        double r2 = dx*dx + dy*dy;
+        double s = G/(r2*std::sqrt(r2));
+        p.axa[l] += s*p.mb[l]*dx;
+        p.aya[l] += s*p.mb[l]*dy;
+        p.axb[l] -= s*p.ma[l]*dx;
+        p.ayb[l] -= s*p.ma[l]*dy;
+        if (r2 < p.minR2[l]) {
+            p.minR2[l] = r2;
+            p.minTime[l] = t;
+        }
+    }
+}
+
+#ifdef FORCE_KERNELS_X86
+__attribute__((target("avx2")))
+static void avx2LaneKernel(const LanePair& p, unsigned int L, double t) {
+    const __m256d Gv = _mm256_set1_pd(G);
+    const __m256d tv = _mm256_set1_pd(t);
+    unsigned int l = 0;
+    for (; l + 4 <= L; l += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(p.xb + l), _mm256_loadu_pd(p.xa + l));
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(p.yb + l), _mm256_loadu_pd(p.ya + l));
+        __m256d r2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+        __m256d s = _mm256_div_pd(Gv, _mm256_mul_pd(r2, _mm256_sqrt_pd(r2)));
+        __m256d sb = _mm256_mul_pd(s, _mm256_loadu_pd(p.mb + l));
+        __m256d sa = _mm256_mul_pd(s, _mm256_loadu_pd(p.ma + l));
+        _mm256_storeu_pd(p.axa + l, _mm256_add_pd(_mm256_loadu_pd(p.axa + l), _mm256_mul_pd(sb, dx)));
+        _mm256_storeu_pd(p.aya + l, _mm256_add_pd(_mm256_loadu_pd(p.aya + l), _mm256_mul_pd(sb, dy)));
+        _mm256_storeu_pd(p.axb + l, _mm256_sub_pd(_mm256_loadu_pd(p.axb + l), _mm256_mul_pd(sa, dx)));
+        _mm256_storeu_pd(p.ayb + l, _mm256_sub_pd(_mm256_loadu_pd(p.ayb + l), _mm256_mul_pd(sa, dy)));
+        __m256d closest = _mm256_loadu_pd(p.minR2 + l);
+        __m256d closer = _mm256_cmp_pd(r2, closest, _CMP_LT_OQ);
+        _mm256_storeu_pd(p.minR2 + l, _mm256_blendv_pd(closest, r2, closer));
+        _mm256_storeu_pd(p.minTime + l, _mm256_blendv_pd(_mm256_loadu_pd(p.minTime + l), tv, closer));
+    }
+    scalarLaneKernel(p, l, L, t);
+}
+
+__attribute__((target("avx512f")))
+static void avx512LaneKernel(const LanePair& p, unsigned int L, double t) {
+    const __m512d Gv = _mm512_set1_pd(G);
+    const __m512d tv = _mm512_set1_pd(t);
+    unsigned int l = 0;
+    for (; l + 8 <= L; l += 8) {
+        __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(p.xb + l), _mm512_loadu_pd(p.xa + l));
+        __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(p.yb + l), _mm512_loadu_pd(p.ya + l));
+        __m512d r2 = _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+        __m512d s = _mm512_div_pd(Gv, _mm512_mul_pd(r2, _mm512_sqrt_pd(r2)));
+        __m512d sb = _mm512_mul_pd(s, _mm512_loadu_pd(p.mb + l));
+        __m512d sa = _mm512_mul_pd(s, _mm512_loadu_pd(p.ma + l));
+        _mm512_storeu_pd(p.axa + l, _mm512_add_pd(_mm512_loadu_pd(p.axa + l), _mm512_mul_pd(sb, dx)));
+        _mm512_storeu_pd(p.aya + l, _mm512_add_pd(_mm512_loadu_pd(p.aya + l), _mm512_mul_pd(sb, dy)));
+        _mm512_storeu_pd(p.axb + l, _mm512_sub_pd(_mm512_loadu_pd(p.axb + l), _mm512_mul_pd(sa, dx)));
+        _mm512_storeu_pd(p.ayb + l, _mm512_sub_pd(_mm512_loadu_pd(p.ayb + l), _mm512_mul_pd(sa, dy)));
+        __m512d closest = _mm512_loadu_pd(p.minR2 + l);
+        __mmask8 closer = _mm512_cmp_pd_mask(r2, closest, _CMP_LT_OQ);
+        _mm512_mask_storeu_pd(p.minR2 + l, closer, r2);
+        _mm512_mask_storeu_pd(p.minTime + l, closer, tv);
+    }
+    scalarLaneKernel(p, l, L, t);
+}
+#endif
+
+static void scalarTracerKernel(const double* x, const double* y, const double* m, unsigned int n,
+                               const double* tx, const double* ty, double* ax, double* ay,
+                               unsigned int kBegin, unsigned int kEnd, double eps2) {
+    for (unsigned int k = kBegin; k < kEnd; k++) {
+        double ax_k = 0;
+        double ay_k = 0;
+        for (unsigned int j = 0; j < n; j++) {
+            double dx = x[j] - tx[k];
+            double dy = y[j] - ty[k];
+            double r2 = dx*dx + dy*dy + eps2;
+            double s = G*m[j]/(r2*std::sqrt(r2));
+            ax_k += s*dx;
+            ay_k += s*dy;
+        }
+        ax[k] = ax_k;
+        ay[k] = ay_k;
+    }
+}
+
+#ifdef FORCE_KERNELS_X86
+__attribute__((target("avx2")))
+static void avx2TracerKernel(const double* x, const double* y, const double* m, unsigned int n,
+                             const double* tx, const double* ty, double* ax, double* ay,
+                             unsigned int kBegin, unsigned int kEnd, double eps2) {
+    // Four tracers per vector; each body's position and G*m are broadcast. The tail is finished by the scalar kernel.
+    const __m256d soft = _mm256_set1_pd(eps2);
+    unsigned int k = kBegin;
+    for (; k + 4 <= kEnd; k += 4) {
+        const __m256d xk = _mm256_loadu_pd(tx + k);
+        const __m256d yk = _mm256_loadu_pd(ty + k);
+        __m256d ax_k = _mm256_setzero_pd();
+        __m256d ay_k = _mm256_setzero_pd();
+        for (unsigned int j = 0; j < n; j++) {
+            __m256d dx = _mm256_sub_pd(_mm256_set1_pd(x[j]), xk);
+            __m256d dy = _mm256_sub_pd(_mm256_set1_pd(y[j]), yk);
+            __m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), soft);
+            __m256d s = _mm256_div_pd(_mm256_set1_pd(G*m[j]), _mm256_mul_pd(r2, _mm256_sqrt_pd(r2)));
+            ax_k = _mm256_add_pd(ax_k, _mm256_mul_pd(s, dx));
+            ay_k = _mm256_add_pd(ay_k, _mm256_mul_pd(s, dy));
+        }
+        _mm256_storeu_pd(ax + k, ax_k);
+        _mm256_storeu_pd(ay + k, ay_k);
+    }
+    scalarTracerKernel(x, y, m, n, tx, ty, ax, ay, k, kEnd, eps2);
+}
+
+__attribute__((target("avx512f")))
+static void avx512TracerKernel(const double* x, const double* y, const double* m, unsigned int n,
+                               const double* tx, const double* ty, double* ax, double* ay,
+                               unsigned int kBegin, unsigned int kEnd, double eps2) {
+    // Eight tracers per vector; each body's position and G*m are broadcast. The tail is finished by the scalar kernel.
+    const __m512d soft = _mm512_set1_pd(eps2);
+    unsigned int k = kBegin;
+    for (; k + 8 <= kEnd; k += 8) {
+        const __m512d xk = _mm512_loadu_pd(tx + k);
+        const __m512d yk = _mm512_loadu_pd(ty + k);
+        __m512d ax_k = _mm512_setzero_pd();
+        __m512d ay_k = _mm512_setzero_pd();
+        for (unsigned int j = 0; j < n; j++) {
+            __m512d dx = _mm512_sub_pd(_mm512_set1_pd(x[j]), xk);
+            __m512d dy = _mm512_sub_pd(_mm512_set1_pd(y[j]), yk);
+            __m512d r2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), soft);
+            __m512d s = _mm512_div_pd(_mm512_set1_pd(G*m[j]), _mm512_mul_pd(r2, _mm512_sqrt_pd(r2)));
+            ax_k = _mm512_add_pd(ax_k, _mm512_mul_pd(s, dx));
+            ay_k = _mm512_add_pd(ay_k, _mm512_mul_pd(s, dy));
+        }
+        _mm512_storeu_pd(ax + k, ax_k);
+        _mm512_storeu_pd(ay + k, ay_k);
+    }
+    scalarTracerKernel(x, y, m, n, tx, ty, ax, ay, k, kEnd, eps2);
+}
+#endif
+
+KernelIsa bestSupportedKernelIsa() {
+#ifdef FORCE_KERNELS_X86
+    if (__builtin_cpu_supports("avx512f")) return KERNEL_AVX512;
+    if (__builtin_cpu_supports("avx2")) return KERNEL_AVX2;
+#endif
+    return KERNEL_SCALAR;
+}
+
+static row_kernel kernelFor(KernelIsa isa) {
+#ifdef FORCE_KERNELS_X86
+    if (isa == KERNEL_AVX512) return avx512RowKernel;
+    if (isa == KERNEL_AVX2) return avx2RowKernel;
+#endif
+    return scalarRowKernel;
+}
+
+static KernelIsa activeIsa = bestSupportedKernelIsa();
+static row_kernel activeKernel = kernelFor(activeIsa);
+
+KernelIsa selectForceKernel(KernelIsa requested) {
+    KernelIsa best = bestSupportedKernelIsa();
+    activeIsa = (requested > best) ? best : requested;
+    activeKernel = kernelFor(activeIsa);
+    return activeIsa;
+}
+
+KernelIsa activeForceKernel() {
+    return activeIsa;
+}
+
+const char* kernelIsaName(KernelIsa isa) {
+    if (isa == KERNEL_AVX512) return "avx512";
+    if (isa == KERNEL_AVX2) return "avx2";
+    return "scalar";
+}
+
+double accumulateRowForces(const double* x, const double* y, const double* m, double* fx, double* fy,
+                           unsigned int i, unsigned int jBegin, unsigned int jEnd, double eps2) {
+    return activeKernel(x, y, m, fx, fy, i, jBegin, jEnd, eps2);
+}
+
+void accumulateLanePairAccelerations(const LanePair& p, unsigned int L, double t) {
+    // Lanes never mix. Which lanes go through the vector loop and which through the scalar tail depends only on L,
+    // so for a given ISA and block layout the results repeat exactly.
+#ifdef FORCE_KERNELS_X86
+    if (activeIsa == KERNEL_AVX512) return avx512LaneKernel(p, L, t);
+    if (activeIsa == KERNEL_AVX2) return avx2LaneKernel(p, L, t);
+#endif
+    scalarLaneKernel(p, 0, L, t);
+}
+
+void computeTracerAccelerations(const double* x, const double* y, const double* m, unsigned int n,
+                                const double* tx, const double* ty, double* ax, double* ay,
+                                unsigned int kBegin, unsigned int kEnd, double eps2) {
+#ifdef FORCE_KERNELS_X86
+    if (activeIsa == KERNEL_AVX512) return avx512TracerKernel(x, y, m, n, tx, ty, ax, ay, kBegin, kEnd, eps2);
+    if (activeIsa == KERNEL_AVX2) return avx2TracerKernel(x, y, m, n, tx, ty, ax, ay, kBegin, kEnd, eps2);
+#endif
+    scalarTracerKernel(x, y, m, n, tx, ty, ax, ay, kBegin, kEnd, eps2);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+// ==========================================================================================
+// Pairwise gravitational force kernels operating directly on a Frame's structure-of-arrays state.
+// Every kernel evaluates F_ij = G*m_i*m_j*(r_j - r_i)/|r_j - r_i|^3 using only multiplies, one square root and one
+// divide per pair, and applies it symmetrically: F_ij is added to body i and subtracted from body j. The pair's
+// potential energy -G*m_i*m_j/r equals -(G*m_i*m_j/r^3)*r^2, so it costs one extra multiply and is returned as well.
+// The scalar kernel runs everywhere; AVX2 and AVX-512 variants process 4 or 8 values of j at once and are chosen at
+// runtime based on what the CPU supports.
+
+const double G = 6.67259e-11; // Constant of Gravitation, in N*m^2/kg^2
+
+enum KernelIsa {
+    KERNEL_SCALAR,
+    KERNEL_AVX2,
+    KERNEL_AVX512
+};
+
+// Signature shared by every row kernel: interact body i with bodies [jBegin, jEnd), returning their potential energy.
+// eps2 is the square of the Plummer softening length (0 for pure Newtonian gravity).
+typedef double (*row_kernel)(const double* x, const double* y, const double* m, double* fx, double* fy,
+                             unsigned int i, unsigned int jBegin, unsigned int jEnd, double eps2);
+
+// Widest kernel the running CPU can execute.
+KernelIsa bestSupportedKernelIsa();
+
+// Use the requested kernel for all subsequent calls, falling back to the widest supported one if the CPU cannot
+// run it. Returns the kernel actually selected.
+KernelIsa selectForceKernel(KernelIsa requested);
+KernelIsa activeForceKernel();
+const char* kernelIsaName(KernelIsa isa);
+
+// Abstract: Accumulate the force between body i and every body in [jBegin, jEnd) into fx/fy, using the
+//      selected kernel. Body i must not lie within [jBegin, jEnd). With a softening length eps, r^2 is replaced by
+//      r^2 + eps^2 throughout, which caps the force of close encounters; eps2 = 0 leaves the result unchanged.
+// Postcondition: Returns the total potential energy of those pairs, in J.
+double accumulateRowForces(const double* x, const double* y, const double* m, double* fx, double* fy,
+                           unsigned int i, unsigned int jBegin, unsigned int jEnd, double eps2);
+
+// Lane-wise view of one pair of bodies (a, b) across L independent small systems, laid out so that lane l of every
+// array belongs to system l (see Ensemble). Used by the ensemble runner, where the SIMD width spans systems rather
+// than bodies.
+struct LanePair {
+    const double *xa, *ya, *ma;
+    const double *xb, *yb, *mb;
+    double *axa, *aya, *axb, *ayb;  // accelerations, accumulated in place
+    double *minR2, *minTime;        // closest approach seen so far in each lane, and the time it happened
+};
+
+// Abstract: For every lane l < L, add the gravitational accelerations between bodies a and b to both of them, using
+//      the selected kernel ISA. Where the pair is closer than minR2[l], record the new squared distance and time t.
+void accumulateLanePairAccelerations(const LanePair& p, unsigned int L, double t);
+
+// Abstract: For every tracer k in [kBegin, kEnd), set (ax[k], ay[k]) to the acceleration the n bodies (x, y, m) give it,
+//      sum_j G*m_j*(r_j - r_k)/(|r_j - r_k|^2 + eps2)^1.5, using the selected kernel ISA. Tracers are massless: they
+//      feel the bodies but do not act on them or on each other, so every tracer is independent and the SIMD width
+//      spans tracers, with the bodies broadcast one at a time.
+void computeTracerAccelerations(const double* x, const double* y, const double* m, unsigned int n,
+                                const double* tx, const double* ty, double* ax, double* ay,
+                                unsigned int kBegin, unsigned int kEnd, double eps2);
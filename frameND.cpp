@@ -0,0 +1,212 @@
+#include "frameND.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+// See forceKernels.cpp for why these warnings are silenced around the intrinsics header.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#define FRAME_ND_X86 1
+#endif
+
+// Every kernel evaluates, per pair, r^2 = eps^2 + |r_j - r_i|^2 and 1/r with one square root and one divide, then
+// a_i += G*m_j*(r_j - r_i)/r^3 and a_j -= G*m_i*(r_j - r_i)/r^3. The scale factor is formed as (G*m/r)*(1/r^2) so its
+// intermediate values stay well inside float range for bodies of stellar mass at astronomical distances.
+
+template <unsigned int D, typename Real>
+static void scalarAccelerationRow(const Real* const* pos, const Real* Gm, Real* const* acc,
+                                  unsigned int i, unsigned int jBegin, unsigned int jEnd, Real eps2) {
+    Real pi[D];
+    Real ai[D];
+    for (unsigned int d = 0; d < D; d++) {
+        pi[d] = pos[d][i];
+        ai[d] = 0;
+    }
+    const Real Gmi = Gm[i];
+    for (unsigned int j = jBegin; j < jEnd; j++) {
+        Real dd[D];
+        Real r2 = eps2;
+        for (unsigned int d = 0; d < D; d++) {
+            dd[d] = pos[d][j] - pi[d];
+            r2 += dd[d]*dd[d];
+        }
+        Real rinv = Real(1)/std::sqrt(r2);
+        Real rinv2 = rinv*rinv;
+        Real sj = Gm[j]*rinv*rinv2;
+        Real si = Gmi*rinv*rinv2;
+        for (unsigned int d = 0; d < D; d++) {
+            ai[d] += sj*dd[d];
+            acc[d][j] -= si*dd[d];
+        }
+    }
+    for (unsigned int d = 0; d < D; d++) {
+        acc[d][i] += ai[d];
+    }
+}
+
+#ifdef FRAME_ND_X86
+// Thin wrappers giving the float and double intrinsics of one ISA the same names, so each SIMD kernel below is
+// written once for both precisions. width is the number of Real values per register.
+#define AVX2_OP __attribute__((target("avx2"), always_inline)) static inline
+#define AVX512_OP __attribute__((target("avx512f"), always_inline)) static inline
+
+template <typename Real> struct Avx2Ops;
+template <> struct Avx2Ops<double> {
+    typedef __m256d reg;
+    static const unsigned int width = 4;
+    AVX2_OP reg set1(double a) { return _mm256_set1_pd(a); }
+    AVX2_OP reg load(const double* p) { return _mm256_loadu_pd(p); }
+    AVX2_OP void store(double* p, reg a) { _mm256_storeu_pd(p, a); }
+    AVX2_OP reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+    AVX2_OP reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+    AVX2_OP reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+    AVX2_OP reg div(reg a, reg b) { return _mm256_div_pd(a, b); }
+    AVX2_OP reg sqrt(reg a) { return _mm256_sqrt_pd(a); }
+    AVX2_OP double reduce(reg a) {
+        double lanes[4];
+        _mm256_storeu_pd(lanes, a);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+};
+template <> struct Avx2Ops<float> {
+    typedef __m256 reg;
+    static const unsigned int width = 8;
+    AVX2_OP reg set1(float a) { return _mm256_set1_ps(a); }
+    AVX2_OP reg load(const float* p) { return _mm256_loadu_ps(p); }
+    AVX2_OP void store(float* p, reg a) { _mm256_storeu_ps(p, a); }
+    AVX2_OP reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+    AVX2_OP reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+    AVX2_OP reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+    AVX2_OP reg div(reg a, reg b) { return _mm256_div_ps(a, b); }
+    AVX2_OP reg sqrt(reg a) { return _mm256_sqrt_ps(a); }
+    AVX2_OP float reduce(reg a) {
+        float lanes[8];
+        _mm256_storeu_ps(lanes, a);
+        return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+};
+
+template <typename Real> struct Avx512Ops;
+template <> struct Avx512Ops<double> {
+    typedef __m512d reg;
+    static const unsigned int width = 8;
+    AVX512_OP reg set1(double a) { return _mm512_set1_pd(a); }
+    AVX512_OP reg load(const double* p) { return _mm512_loadu_pd(p); }
+    AVX512_OP void store(double* p, reg a) { _mm512_storeu_pd(p, a); }
+    AVX512_OP reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+    AVX512_OP reg sub(reg a, reg b) { return _mm512_sub_pd(a, b); }
+    AVX512_OP reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+    AVX512_OP reg div(reg a, reg b) { return _mm512_div_pd(a, b); }
+    AVX512_OP reg sqrt(reg a) { return _mm512_sqrt_pd(a); }
+    AVX512_OP double reduce(reg a) { return _mm512_reduce_add_pd(a); }
+};
+template <> struct Avx512Ops<float> {
+    typedef __m512 reg;
+    static const unsigned int width = 16;
+    AVX512_OP reg set1(float a) { return _mm512_set1_ps(a); }
+    AVX512_OP reg load(const float* p) { return _mm512_loadu_ps(p); }
+    AVX512_OP void store(float* p, reg a) { _mm512_storeu_ps(p, a); }
+    AVX512_OP reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+    AVX512_OP reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+    AVX512_OP reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+    AVX512_OP reg div(reg a, reg b) { return _mm512_div_ps(a, b); }
+    AVX512_OP reg sqrt(reg a) { return _mm512_sqrt_ps(a); }
+    AVX512_OP float reduce(reg a) { return _mm512_reduce_add_ps(a); }
+};
+
+template <unsigned int D, typename Real>
+__attribute__((target("avx2")))
+static void avx2AccelerationRow(const Real* const* pos, const Real* Gm, Real* const* acc,
+                                unsigned int i, unsigned int jBegin, unsigned int jEnd, Real eps2) {
+    // Same arithmetic as scalarAccelerationRow, a register of j at a time. The tail is finished by the scalar kernel.
+    typedef Avx2Ops<Real> V;
+    typename V::reg pi[D], ai[D];
+    for (unsigned int d = 0; d < D; d++) {
+        pi[d] = V::set1(pos[d][i]);
+        ai[d] = V::set1(0);
+    }
+    const typename V::reg Gmi = V::set1(Gm[i]);
+    const typename V::reg soft = V::set1(eps2);
+    const typename V::reg one = V::set1(1);
+    unsigned int j = jBegin;
+    for (; j + V::width <= jEnd; j += V::width) {
+        typename V::reg dd[D];
+        typename V::reg r2 = soft;
+        for (unsigned int d = 0; d < D; d++) {
+            dd[d] = V::sub(V::load(pos[d] + j), pi[d]);
+            r2 = V::add(r2, V::mul(dd[d], dd[d]));
+        }
+        typename V::reg rinv = V::div(one, V::sqrt(r2));
+        typename V::reg rinv2 = V::mul(rinv, rinv);
+        typename V::reg sj = V::mul(V::mul(V::load(Gm + j), rinv), rinv2);
+        typename V::reg si = V::mul(V::mul(Gmi, rinv), rinv2);
+        for (unsigned int d = 0; d < D; d++) {
+            ai[d] = V::add(ai[d], V::mul(sj, dd[d]));
+            V::store(acc[d] + j, V::sub(V::load(acc[d] + j), V::mul(si, dd[d])));
+        }
+    }
+    for (unsigned int d = 0; d < D; d++) {
+        acc[d][i] += V::reduce(ai[d]);
+    }
+    scalarAccelerationRow<D, Real>(pos, Gm, acc, i, j, jEnd, eps2);
+}
+
+template <unsigned int D, typename Real>
+__attribute__((target("avx512f")))
+static void avx512AccelerationRow(const Real* const* pos, const Real* Gm, Real* const* acc,
+                                  unsigned int i, unsigned int jBegin, unsigned int jEnd, Real eps2) {
+    // Same arithmetic as scalarAccelerationRow, a register of j at a time. The tail is finished by the scalar kernel.
+    typedef Avx512Ops<Real> V;
+    typename V::reg pi[D], ai[D];
+    for (unsigned int d = 0; d < D; d++) {
+        pi[d] = V::set1(pos[d][i]);
+        ai[d] = V::set1(0);
+    }
+    const typename V::reg Gmi = V::set1(Gm[i]);
+    const typename V::reg soft = V::set1(eps2);
+    const typename V::reg one = V::set1(1);
+    unsigned int j = jBegin;
+    for (; j + V::width <= jEnd; j += V::width) {
+        typename V::reg dd[D];
+        typename V::reg r2 = soft;
+        for (unsigned int d = 0; d < D; d++) {
+            dd[d] = V::sub(V::load(pos[d] + j), pi[d]);
+            r2 = V::add(r2, V::mul(dd[d], dd[d]));
+        }
+        typename V::reg rinv = V::div(one, V::sqrt(r2));
+        typename V::reg rinv2 = V::mul(rinv, rinv);
+        typename V::reg sj = V::mul(V::mul(V::load(Gm + j), rinv), rinv2);
+        typename V::reg si = V::mul(V::mul(Gmi, rinv), rinv2);
+        for (unsigned int d = 0; d < D; d++) {
+            ai[d] = V::add(ai[d], V::mul(sj, dd[d]));
+            V::store(acc[d] + j, V::sub(V::load(acc[d] + j), V::mul(si, dd[d])));
+        }
+    }
+    for (unsigned int d = 0; d < D; d++) {
+        acc[d][i] += V::reduce(ai[d]);
+    }
+    scalarAccelerationRow<D, Real>(pos, Gm, acc, i, j, jEnd, eps2);
+}
+#endif
+
+template <unsigned int D, typename Real>
+void accumulateAccelerationRow(const Real* const* pos, const Real* Gm, Real* const* acc,
+                               unsigned int i, unsigned int jBegin, unsigned int jEnd, Real eps2) {
+    // Follows the ISA chosen for Frame's kernels (selectForceKernel), so both models can be pinned to one ISA.
+#ifdef FRAME_ND_X86
+    const KernelIsa isa = activeForceKernel();
+    if (isa == KERNEL_AVX512) return avx512AccelerationRow<D, Real>(pos, Gm, acc, i, jBegin, jEnd, eps2);
+    if (isa == KERNEL_AVX2) return avx2AccelerationRow<D, Real>(pos, Gm, acc, i, jBegin, jEnd, eps2);
+#endif
+    scalarAccelerationRow<D, Real>(pos, Gm, acc, i, jBegin, jEnd, eps2);
+}
+
+template void accumulateAccelerationRow<2, float>(const float* const*, const float*, float* const*,
+                                                  unsigned int, unsigned int, unsigned int, float);
+template void accumulateAccelerationRow<3, float>(const float* const*, const float*, float* const*,
+                                                  unsigned int, unsigned int, unsigned int, float);
+template void accumulateAccelerationRow<2, double>(const double* const*, const double*, double* const*,
+                                                   unsigned int, unsigned int, unsigned int, double);
+template void accumulateAccelerationRow<3, double>(const double* const*, const double*, double* const*,
+                                                   unsigned int, unsigned int, unsigned int, double);
@@ -0,0 +1,306 @@
+#pragma once
+#include "modelClasses.h"
+#include <array>
+#include <type_traits>
+
+// ==========================================================================================
+// Direct-summation N-body core templated on the number of dimensions D (2 or 3) and the scalar type Real (float or
+// double). Frame is the full-featured 2D double model (histories, Barnes-Hut, Wisdom-Holman, collisions, tracers,
+// checkpoints); FrameND trades those for a choice of dimension and precision: 3D runs such as an inclined solar system,
+// and single precision for large-N approximate runs, where a SIMD register holds twice as many floats as doubles and
+// the state takes half the memory bandwidth. It integrates with velocity Verlet only.
+//
+// Single precision keeps about 7 significant digits. With SI units a float position near 1 AU resolves ~10 km, so
+// float runs are meant for approximate, large-N work rather than precise orbits.
+//
+// The state is kept as accelerations rather than forces: G*m_i*m_j overflows a float for planetary masses, while
+// G*m_j does not.
+
+// Abstract: Accumulate the mutual accelerations of body i and every body in [jBegin, jEnd) using the selected kernel
+//      ISA (see selectForceKernel). pos[d] and acc[d] are the d-th coordinate arrays, Gm holds G*m per body, and eps2 is
+//      the square of the softening length. Body i must not lie within [jBegin, jEnd).
+template <unsigned int D, typename Real>
+void accumulateAccelerationRow(const Real* const* pos, const Real* Gm, Real* const* acc,
+                               unsigned int i, unsigned int jBegin, unsigned int jEnd, Real eps2);
+
+extern template void accumulateAccelerationRow<2, float>(const float* const*, const float*, float* const*,
+                                                         unsigned int, unsigned int, unsigned int, float);
+extern template void accumulateAccelerationRow<3, float>(const float* const*, const float*, float* const*,
+                                                         unsigned int, unsigned int, unsigned int, float);
+extern template void accumulateAccelerationRow<2, double>(const double* const*, const double*, double* const*,
+                                                          unsigned int, unsigned int, unsigned int, double);
+extern template void accumulateAccelerationRow<3, double>(const double* const*, const double*, double* const*,
+                                                          unsigned int, unsigned int, unsigned int, double);
+
+template <unsigned int D, typename Real>
+class FrameND {
+    static_assert(D == 2 || D == 3, "FrameND supports 2 or 3 dimensions");
+    static_assert(std::is_same<Real, float>::value || std::is_same<Real, double>::value, "Real must be float or double");
+
+public:
+    typedef std::array<Real, D> vec;
+    typedef std::vector<Real, AlignedAllocator<Real> > column;
+
+    // Constructor
+    explicit FrameND(double _dt) : time(0), dt(_dt), softening(0), numThreads(1), stepCount(0),
+                                   accelerationsCurrent(false) { assert (dt > 0); }
+
+    // Getters
+    double getTime() const { return time; }
+    double getDt() const { return dt; }
+    unsigned long getStepCount() const { return stepCount; }
+    unsigned int size() const { return IDs.size(); }
+    unsigned int getNumThreads() const { return numThreads; }
+    double getSoftening() const { return softening; }
+    const std::string& getID(unsigned int slot) const { assert (slot < size()); return IDs[slot]; }
+    double getMass(unsigned int slot) const { assert (slot < size()); return masses[slot]; }
+    vec getPos(unsigned int slot) const { return this->gather(x, slot); }
+    vec getVel(unsigned int slot) const { return this->gather(v, slot); }
+    vec getAcc(unsigned int slot) const { return this->gather(a, slot); }
+
+    // Setters
+    void setNumThreads(unsigned int n);
+    void setSoftening(double eps) { assert (eps >= 0); softening = eps; accelerationsCurrent = false; }
+
+    // Member functions
+    bool addParticle(const std::string& ID, double mass, const vec& pos, const vec& vel);
+    const unsigned int* find(const std::string& ID) const;
+    void updateAllAccelerations();
+    void advanceSingleTimeStep();
+    double kineticEnergy() const;
+    double potentialEnergy() const;
+    void writeState(std::ostream& ostr) const;
+
+private:
+    vec gather(const column (&c)[D], unsigned int slot) const;
+    void accumulateAccelerationsParallel();
+    void kick(double h);
+    void drift(double h);
+
+    double time;
+    double dt;
+    double softening;
+    std::vector<std::string> IDs;   // ID of each slot
+    particle_index index;           // hashtable between an ID and its slot
+    std::vector<double> masses;     // in kg, kept in double for the energy sums
+    column Gm;                      // G*m per slot, in m^3/s^2
+    column x[D], v[D], a[D];        // position, velocity and acceleration, one array per coordinate
+    unsigned int numThreads;
+    std::unique_ptr<ThreadPool> pool;
+    std::vector<column> workerA;    // per-worker acceleration partials, D arrays per worker
+    unsigned long stepCount;
+    bool accelerationsCurrent;      // whether a[] matches the current positions (cf. Frame::forcesCurrent)
+};
+
+typedef FrameND<3, double> Frame3D;
+typedef FrameND<3, float> Frame3F;
+typedef FrameND<2, float> Frame2F;
+
+template <unsigned int D, typename Real>
+typename FrameND<D, Real>::vec FrameND<D, Real>::gather(const column (&c)[D], unsigned int slot) const {
+    assert (slot < size());
+    vec out;
+    for (unsigned int d = 0; d < D; d++) {
+        out[d] = c[d][slot];
+    }
+    return out;
+}
+
+template <unsigned int D, typename Real>
+void FrameND<D, Real>::setNumThreads(unsigned int n) {
+    // Postcondition: Accelerations are evaluated by n workers (the calling thread included) once there are at least
+    //      PARALLEL_FORCE_MIN_BODIES bodies. n == 1 disables the pool.
+    assert (n > 0);
+    numThreads = n;
+    if (n == 1) pool.reset();
+    else pool.reset(new ThreadPool(n));
+    workerA.assign(n*D, column());
+}
+
+template <unsigned int D, typename Real>
+bool FrameND<D, Real>::addParticle(const std::string& ID, double mass, const vec& pos, const vec& vel) {
+    // Postcondition: Returns false, leaving the Frame unchanged, if ID is already present. Otherwise the body occupies
+    //      the next slot.
+    if (!index.insert(std::make_pair(ID, (unsigned int)IDs.size())).second) return false;
+    IDs.push_back(ID);
+    masses.push_back(mass);
+    Gm.push_back(G*mass);
+    for (unsigned int d = 0; d < D; d++) {
+        x[d].push_back(pos[d]);
+        v[d].push_back(vel[d]);
+        a[d].push_back(0);
+    }
+    accelerationsCurrent = false;
+    return true;
+}
+
+template <unsigned int D, typename Real>
+const unsigned int* FrameND<D, Real>::find(const std::string& ID) const {
+    // Postcondition: Returns a pointer to the slot of ID, or NULL if it is not present.
+    const_particle_itr itr = index.find(ID);
+    return (itr == index.end()) ? NULL : &itr->second;
+}
+
+template <unsigned int D, typename Real>
+void FrameND<D, Real>::updateAllAccelerations() {
+    // Abstract: Same structure as Frame::updateAllForces(): each unique pair is visited once by the row kernel, or,
+    //      for large Frames with a thread pool, the pairs are tiled over the workers.
+    // Postcondition: a[] holds every body's acceleration at the current positions.
+    const unsigned int n = size();
+    for (unsigned int d = 0; d < D; d++) {
+        std::fill(a[d].begin(), a[d].end(), Real(0));
+    }
+    if (pool && n >= PARALLEL_FORCE_MIN_BODIES) {
+        this->accumulateAccelerationsParallel();
+    } else {
+        const Real* pos[D];
+        Real* acc[D];
+        for (unsigned int d = 0; d < D; d++) {
+            pos[d] = x[d].data();
+            acc[d] = a[d].data();
+        }
+        const Real eps2 = softening*softening;
+        for (unsigned int i = 0; i < n; i++) {
+            accumulateAccelerationRow<D, Real>(pos, Gm.data(), acc, i, i + 1, n, eps2);
+        }
+    }
+    accelerationsCurrent = true;
+}
+
+template <unsigned int D, typename Real>
+void FrameND<D, Real>::accumulateAccelerationsParallel() {
+    // Abstract: The tiling of Frame::accumulateForcesParallel(): tiles (I, J) with I <= J are dealt to workers
+    //      round-robin, each worker accumulates into its own arrays, and the partials are summed in worker order, so
+    //      the result is bitwise reproducible for a fixed thread count.
+    // Postcondition: a[] holds every body's acceleration.
+    const unsigned int n = size();
+    const unsigned int workers = pool->size();
+    unsigned int targetBlocks = (unsigned int)std::ceil(4*std::sqrt((double)workers)) + 1;
+    unsigned int tile = (n + targetBlocks - 1)/targetBlocks;
+    tile = (tile + 15)/16*16;   // whole vectors of floats as well as doubles
+    const unsigned int blocks = (n + tile - 1)/tile;
+    const Real eps2 = softening*softening;
+    const Real* pos[D];
+    for (unsigned int d = 0; d < D; d++) {
+        pos[d] = x[d].data();
+    }
+
+    // State 1 (partial accelerations): Worker w has accumulated its tiles into workerA[w*D .. w*D + D).
+    pool->runOnAll([&](unsigned int w) {
+        Real* acc[D];
+        for (unsigned int d = 0; d < D; d++) {
+            workerA[w*D + d].assign(n, Real(0));
+            acc[d] = workerA[w*D + d].data();
+        }
+        unsigned int t = 0;
+        for (unsigned int I = 0; I < blocks; I++) {
+            for (unsigned int J = I; J < blocks; J++, t++) {
+                if (t % workers != w) continue;
+                unsigned int iEnd = std::min(n, (I + 1)*tile);
+                unsigned int jEnd = std::min(n, (J + 1)*tile);
+                for (unsigned int i = I*tile; i < iEnd; i++) {
+                    accumulateAccelerationRow<D, Real>(pos, Gm.data(), acc, i, (I == J) ? i + 1 : J*tile, jEnd, eps2);
+                }
+            }
+        }
+    });
+
+    // State 2 (reduced): Every body's acceleration is the sum of the per-worker partials, added in worker order.
+    pool->runOnAll([&](unsigned int w) {
+        unsigned int iBegin = (unsigned long)n*w/workers;
+        unsigned int iEnd = (unsigned long)n*(w + 1)/workers;
+        for (unsigned int d = 0; d < D; d++) {
+            for (unsigned int i = iBegin; i < iEnd; i++) {
+                Real sum = 0;
+                for (unsigned int u = 0; u < workers; u++) {
+                    sum += workerA[u*D + d][i];
+                }
+                a[d][i] = sum;
+            }
+        }
+    });
+}
+
+template <unsigned int D, typename Real>
+void FrameND<D, Real>::kick(double h) {
+    const Real hr = h;
+    for (unsigned int d = 0; d < D; d++) {
+        Real* vd = v[d].data();
+        const Real* ad = a[d].data();
+        for (unsigned int i = 0; i < size(); i++) {
+            vd[i] = vd[i] + hr*ad[i];
+        }
+    }
+}
+
+template <unsigned int D, typename Real>
+void FrameND<D, Real>::drift(double h) {
+    const Real hr = h;
+    for (unsigned int d = 0; d < D; d++) {
+        Real* xd = x[d].data();
+        const Real* vd = v[d].data();
+        for (unsigned int i = 0; i < size(); i++) {
+            xd[i] = xd[i] + hr*vd[i];
+        }
+    }
+    accelerationsCurrent = false;
+}
+
+template <unsigned int D, typename Real>
+void FrameND<D, Real>::advanceSingleTimeStep() {
+    // Abstract: One kick-drift-kick velocity Verlet step, reusing the closing accelerations of the previous step
+    //      (see Frame::stepVelocityVerlet).
+    // Postcondition: time has been incremented by dt.
+    if (!accelerationsCurrent) this->updateAllAccelerations();
+    this->kick(dt/2);
+    this->drift(dt);
+    this->updateAllAccelerations();
+    this->kick(dt/2);
+    time = time + dt;
+    stepCount++;
+}
+
+template <unsigned int D, typename Real>
+double FrameND<D, Real>::kineticEnergy() const {
+    double K = 0;
+    for (unsigned int i = 0; i < size(); i++) {
+        double v2 = 0;
+        for (unsigned int d = 0; d < D; d++) {
+            v2 += (double)v[d][i]*v[d][i];
+        }
+        K += masses[i]*v2/2;
+    }
+    return K;
+}
+
+template <unsigned int D, typename Real>
+double FrameND<D, Real>::potentialEnergy() const {
+    // Diagnostic O(N^2) sum in double precision, whatever Real is, softened like the accelerations.
+    double U = 0;
+    for (unsigned int i = 0; i < size(); i++) {
+        for (unsigned int j = i + 1; j < size(); j++) {
+            double r2 = softening*softening;
+            for (unsigned int d = 0; d < D; d++) {
+                double dd = (double)x[d][j] - x[d][i];
+                r2 += dd*dd;
+            }
+            U -= G*masses[i]*masses[j]/std::sqrt(r2);
+        }
+    }
+    return U;
+}
+
+template <unsigned int D, typename Real>
+void FrameND<D, Real>::writeState(std::ostream& ostr) const {
+    // One line per body, "time;ID;x;y[;z];vx;vy[;vz]", in slot order.
+    for (unsigned int i = 0; i < size(); i++) {
+        ostr << time << ";" << IDs[i];
+        for (unsigned int d = 0; d < D; d++) {
+            ostr << ";" << x[d][i];
+        }
+        for (unsigned int d = 0; d < D; d++) {
+            ostr << ";" << v[d][i];
+        }
+        ostr << "\n";
+    }
+}
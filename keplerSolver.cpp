@@ -0,0 +1,96 @@
+#include "keplerSolver.h"
+#include <cmath>
+
+static void stumpff(double z, double& c0, double& c1, double& c2, double& c3) {
+    // Stumpff functions c_k(z). Near z = 0 the closed forms lose everything to cancellation, so use the series.
+    if (std::abs(z) < 1e-2) {
+        c3 = (1 - z/20*(1 - z/42*(1 - z/72*(1 - z/110))))/6;
+        c2 = (1 - z/12*(1 - z/30*(1 - z/56*(1 - z/90))))/2;
+        c1 = 1 - z*c3;
+        c0 = 1 - z*c2;
+    } else if (z > 0) {
+        double w = std::sqrt(z);
+        c0 = std::cos(w);
+        c1 = std::sin(w)/w;
+        c2 = (1 - c0)/z;
+        c3 = (1 - c1)/z;
+    } else {
+        double w = std::sqrt(-z);
+        c0 = std::cosh(w);
+        c1 = std::sinh(w)/w;
+        c2 = (1 - c0)/z;
+        c3 = (1 - c1)/z;
+    }
+}
+
+bool keplerDrift(double mu, double h, double& x, double& y, double& vx, double& vy) {
+    const double r0 = std::sqrt(x*x + y*y);
+    const double v2 = vx*vx + vy*vy;
+    const double eta0 = x*vx + y*vy;        // r0 . v0
+    const double beta = 2*mu/r0 - v2;       // > 0 bound, < 0 unbound
+    const double zeta0 = mu - beta*r0;
+
+    // State 1 (anomaly found): s solves r0*G1 + eta0*G2 + mu*G3 = h, where G_k = s^k*c_k(beta*s^2).
+    // The left-hand side increases monotonically with s (its derivative is the distance r), so the root can be
+    // bracketed: s = 0 gives -h, which bounds the root on one side. Laguerre-Conway (n = 5) iterations from the
+    // guess s = h/r0 normally converge in a few steps; any step that leaves the bracket is replaced by bisection,
+    // or by doubling while the far side is not yet known (long hyperbolic drifts).
+    if (h == 0) return true;
+    double lo = 0, hi = 0;
+    bool haveLo = (h > 0), haveHi = (h < 0);
+    double s = h/r0;
+    double G0 = 1, G1 = 0, G2 = 0, G3 = 0;
+    bool converged = false;
+    for (int iter = 0; iter < 200; iter++) {
+        double c0, c1, c2, c3;
+        stumpff(beta*s*s, c0, c1, c2, c3);
+        G0 = c0;
+        G1 = s*c1;
+        G2 = s*s*c2;
+        G3 = s*s*s*c3;
+        double f = r0*G1 + eta0*G2 + mu*G3 - h;
+        double fp = r0*G0 + eta0*G1 + mu*G2;   // = r, the distance at s
+        double fpp = eta0*G0 + zeta0*G1;
+        if (f == 0) {
+            converged = true;
+            break;
+        }
+        if (f < 0) { lo = s; haveLo = true; }
+        else { hi = s; haveHi = true; }
+
+        const double n = 5;
+        double disc = std::sqrt(std::abs((n - 1)*(n - 1)*fp*fp - n*(n - 1)*f*fpp));
+        double next = s - n*f/(fp + (fp >= 0 ? disc : -disc));
+        bool inside = std::isfinite(next) && (!haveLo || next > lo) && (!haveHi || next < hi);
+        if (!inside) {
+            if (haveLo && haveHi) next = lo + (hi - lo)/2;
+            else next = 2*s; // s has the sign of h, which is the side still unbounded
+        }
+        double ds = next - s;
+        s = next;
+        if (std::abs(ds) <= 1e-15*std::abs(s) || (haveLo && haveHi && hi - lo <= 1e-15*std::abs(s))) {
+            converged = true;
+            break;
+        }
+    }
+    if (!converged) return false;
+    double c0, c1, c2, c3;
+    stumpff(beta*s*s, c0, c1, c2, c3);
+    G0 = c0;
+    G1 = s*c1;
+    G2 = s*s*c2;
+    G3 = s*s*s*c3;
+    const double r = r0*G0 + eta0*G1 + mu*G2;
+
+    // State 2 (propagated): Position and velocity from the Gauss f and g functions.
+    const double f = 1 - mu*G2/r0;
+    const double g = h - mu*G3;
+    const double fdot = -mu*G1/(r0*r);
+    const double gdot = 1 - mu*G2/r;
+    const double x0 = x, y0 = y, vx0 = vx, vy0 = vy;
+    x = f*x0 + g*vx0;
+    y = f*y0 + g*vy0;
+    vx = fdot*x0 + gdot*vx0;
+    vy = fdot*y0 + gdot*vy0;
+    return true;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// ==========================================================================================
+// Analytic two-body propagation in universal variables (Danby, "Fundamentals of Celestial Mechanics", ch. 6).
+// A single formulation covers elliptic, parabolic and hyperbolic orbits: the universal anomaly s is found from the
+// universal Kepler equation with Laguerre-Conway iteration, and the new state follows from the f and g functions.
+
+// Abstract: Advance a body on a Kepler orbit about a fixed centre with gravitational parameter mu = G*M by time h.
+//      (x, y) is the position relative to the centre and (vx, vy) the velocity.
+// Postcondition: (x, y, vx, vy) hold the state at time t + h. Returns false if the iteration failed to converge,
+//      in which case the state is left unchanged.
+bool keplerDrift(double mu, double h, double& x, double& y, double& vx, double& vy);
@@ -1,4 +1,7 @@
 #include "modelClasses.h"
+#include "ensemble.h"
+#include "frameND.h"
+#include "scenario.h"
 
 int main(int argc, char* argv[]) {
     // TODO: Add better input parsing
@@ -8,6 +11,9 @@ int main(int argc, char* argv[]) {
     bool earth = false;
     bool three_body = false;
     bool solar = false;
+    bool three_body_sweep = false;
+    bool solar_3d = false;
+    const char* scenarioFile = NULL;
     if (argc == 1) {
         std::cout << "Not enough runtime arguments!" << std::endl;
         return 0;
@@ -21,10 +27,16 @@ int main(int argc, char* argv[]) {
             three_body = true;
         } else if (!strcmp(argv[1], "-solar")) {
             solar = true;
+        } else if (!strcmp(argv[1], "-three_body_sweep")) {
+            three_body_sweep = true;
+        } else if (!strcmp(argv[1], "-solar_3d")) {
+            solar_3d = true;
         } else {
             std::cout << "Incorrect runtime argument: " << argv[1] << std::endl;   
             return 0;        
         }
+    } else if (argc == 3 && !strcmp(argv[1], "-scenario")) {
+        scenarioFile = argv[2];
     } else {
         std::cout << "Too many runtime arguments!" << std::endl;
         return 0;
@@ -44,25 +56,42 @@ int main(int argc, char* argv[]) {
 
         // Test insertion into Frame
         Frame F = Frame(1);
-        std::pair<std::unordered_map<std::string, Particle, ParticleHasher>::iterator, bool> res = F.addParticle(p1);
-        std::pair<std::unordered_map<std::string, Particle, ParticleHasher>::iterator, bool> res2 = F.addParticle(p2);
-        std::pair<std::unordered_map<std::string, Particle, ParticleHasher>::iterator, bool> res3 = F.addParticle(p3);
-        std::pair<std::unordered_map<std::string, Particle, ParticleHasher>::iterator, bool> res4 = F.addParticle(p4);
+        std::pair<particle_itr, bool> res = F.addParticle(p1);
+        std::pair<particle_itr, bool> res2 = F.addParticle(p2);
+        std::pair<particle_itr, bool> res3 = F.addParticle(p3);
+        std::pair<particle_itr, bool> res4 = F.addParticle(p4);
 
         assert (res.second);
         assert (res2.second);
         assert (res3.second);
         assert (res4.second);
 
-        // Use iterator
+        // Use iterator. The index maps each ID to its dense slot, in insertion order.
         assert ( (res.first)->first == "Ship" );
-        assert ( (res.first)->second.getID() == "Ship" );
+        assert ( (res.first)->second == 0 );
+        assert ( (res4.first)->second == 3 );
+        assert ( F.size() == 4 );
+        assert ( !F.addParticle(p1eq).second );
 
         // Check Frame::operator[]
         assert ( F["Ship"] == p1 );
         assert ( F["Sun"] == p2 );
         assert ( F["Planet 2"] == p3 );
         assert ( F["Planet 3"] == p4 );
+        assert ( F["Pluto"].getID() == "__NULL__" );
+        assert ( F.size() == 4 ); // a missed lookup must not insert a placeholder
+
+        // Check the zero-copy accessors: they must hand out the Frame's own records, not copies.
+        assert ( &F["Sun"] == &F.at("Sun") && F.find("Sun") == &F.at("Sun") && &F.atSlot(1) == F.find("Sun") );
+        assert ( F.find("Pluto") == NULL && F.size() == 4 );
+        bool threw = false;
+        try {
+            F.at("Pluto");
+        } catch (const std::out_of_range&) {
+            threw = true;
+        }
+        assert ( threw );
+        assert ( F.getStateArrays().m[3] == F.atSlot(3).getMass() );
 
         // Check adding positions/velocities/forces
         p1.addPos(std::make_pair(1.5, 3));
@@ -82,6 +111,27 @@ int main(int argc, char* argv[]) {
         std::cout << "Testing Particle::operator<<" << std::endl;
         std::cout << p1 << std::endl;
 
+        // Check trajectory history policies: keep every 2nd sample, at most 3 at a time.
+        // Samples 0..9 are offered, 0/2/4/6/8 are kept, and only 4/6/8 survive in the ring.
+        Particle h = Particle("History", 1, std::make_pair(0, 0), std::make_pair(0, 0));
+        h.setHistoryPolicy(HistoryPolicy::everyNthStep(2, 3));
+        for (int k = 1; k < 10; k++) {
+            h.addPos(std::make_pair(k, 0));
+            h.addVel(std::make_pair(0, k));
+        }
+        assert (h.getPosHistory().size() == 3);
+        assert (h.getPosHistory()[0].first == 4 && h.getPosHistory().sampleIndex(0) == 4);
+        assert (h.getVelHistory()[2].second == 8 && h.getVelHistory().sampleIndex(2) == 8);
+        assert (h.getCurrentPos().first == 9); // the latest sample is always available
+        // The ring has wrapped, so the retained samples 4, 6, 8 are split over the two spans: older [8], newer [4, 6].
+        SampleSpan older = h.getPosHistory().olderSpan();
+        SampleSpan newer = h.getPosHistory().newerSpan();
+        assert (older.size() + newer.size() == 3);
+        std::vector<double> inOrder;
+        for (const std::pair<double, double>& sample : older) inOrder.push_back(sample.first);
+        for (const std::pair<double, double>& sample : newer) inOrder.push_back(sample.first);
+        assert (inOrder[0] == 4 && inOrder[1] == 6 && inOrder[2] == 8);
+
         // Check Frame::getGravitationalForceBetween() and operator- for pair<double, double>
         // From manual calculations, F_vec = (2.26519 * 10^21, 3.39778 * 10^21)
         p1.addPos(std::make_pair(10, 15));
@@ -97,6 +147,872 @@ int main(int argc, char* argv[]) {
         std::cout << "All particles after Frame::updateAllForces():" << std::endl;
         std::cout << F << std::endl;
 
+        // Check that the widest available SIMD kernel agrees with the scalar reference kernel.
+        // Use enough bodies that every row has full vectors as well as a scalar tail.
+        Frame K = Frame(1);
+        for (int k = 0; k < 21; k++) {
+            K.addParticle(Particle("k" + std::to_string(k), (k+1)*pow(10,20), std::make_pair(k*k*1000.0, (k%5)*7000.0), std::make_pair(0, 0)));
+        }
+        KernelIsa best = activeForceKernel();
+        selectForceKernel(KERNEL_SCALAR);
+        K.updateAllForces();
+        std::pair<double, double> F_scalar = K["k7"].getNetForce();
+        for (int isa = KERNEL_AVX2; isa <= best; isa++) {
+            selectForceKernel((KernelIsa)isa);
+            K.updateAllForces();
+            std::pair<double, double> F_simd = K["k7"].getNetForce();
+            assert (std::abs(F_simd.first - F_scalar.first) <= 1e-12*std::abs(F_scalar.first));
+            assert (std::abs(F_simd.second - F_scalar.second) <= 1e-12*std::abs(F_scalar.second));
+        }
+        selectForceKernel(best);
+        std::cout << "Force kernel: " << kernelIsaName(best) << std::endl;
+
+        // Check the tiled multithreaded force mode: it must match the serial loop to rounding, and repeat bit for bit.
+        Frame P = Frame(1);
+        for (unsigned int k = 0; k < 2*PARALLEL_FORCE_MIN_BODIES; k++) {
+            P.addParticle(Particle("p" + std::to_string(k), (k%7+1)*pow(10,20), std::make_pair(k*1000.0, (k*k%97)*500.0), std::make_pair(0, 0)));
+        }
+        P.updateAllForces();
+        std::pair<double, double> F_serial = P["p100"].getNetForce();
+        P.setNumThreads(4);
+        P.updateAllForces();
+        std::pair<double, double> F_parallel = P["p100"].getNetForce();
+        P.updateAllForces();
+        assert (P["p100"].getNetForce() == F_parallel);
+        assert (std::abs(F_parallel.first - F_serial.first) <= 1e-9*std::abs(F_serial.first));
+        assert (std::abs(F_parallel.second - F_serial.second) <= 1e-9*std::abs(F_serial.second));
+
+        // Check the Barnes-Hut backend: opening angle 0 must reproduce direct summation, and the default angle should
+        // stay within about a percent of it.
+        P.setNumThreads(1);
+        P.setForceBackend(BARNES_HUT);
+        P.setOpeningAngle(0);
+        P.updateAllForces();
+        std::pair<double, double> F_tree = P["p100"].getNetForce();
+        assert (std::abs(F_tree.first - F_serial.first) <= 1e-9*std::abs(F_serial.first));
+        assert (std::abs(F_tree.second - F_serial.second) <= 1e-9*std::abs(F_serial.second));
+        P.setOpeningAngle(0.5);
+        P.setNumThreads(3);
+        P.updateAllForces();
+        F_tree = P["p100"].getNetForce();
+        double F_mag = std::sqrt(F_serial.first*F_serial.first + F_serial.second*F_serial.second);
+        assert (std::hypot(F_tree.first - F_serial.first, F_tree.second - F_serial.second) < 0.01*F_mag);
+
+        // Check the integrators on one period of a circular orbit around a much heavier body, 1000 steps per period.
+        // The fourth-order schemes must close the orbit several orders of magnitude more tightly than the others.
+        const double M_orbit = 1.989*pow(10,30);
+        const double r_orbit = 1.496*pow(10,11);
+        const double v_orbit = std::sqrt(G*M_orbit/r_orbit);
+        const double period = 2*M_PI*r_orbit/v_orbit;
+        const Integrator schemes[4] = {LEFT_BOX_EULER, VELOCITY_VERLET, YOSHIDA_4, RUNGE_KUTTA_4};
+        const double tolerance[4] = {1e-3, 1e-3, 1e-7, 1e-7};
+        for (int k = 0; k < 4; k++) {
+            Frame O = Frame(period/1000, HistoryPolicy::currentOnly());
+            O.setIntegrator(schemes[k]);
+            O.addParticle(Particle("Star", M_orbit, std::make_pair(0, 0), std::make_pair(0, 0)));
+            O.addParticle(Particle("Probe", 1, std::make_pair(r_orbit, 0), std::make_pair(0, v_orbit)));
+            for (int step = 0; step < 1000; step++) {
+                O.advanceSingleTimeStep();
+            }
+            std::pair<double, double> end = O["Probe"].getCurrentPos();
+            double miss = std::hypot(end.first - r_orbit, end.second)/r_orbit;
+            std::cout << "Integrator " << k << " orbit closure error: " << miss << std::endl;
+            assert (miss < tolerance[k]);
+        }
+
+        // Check the universal-variable Kepler solver: an eccentric orbit must return to its start after one period,
+        // and a hyperbolic flyby propagated forwards then backwards must return to its start.
+        double ex = r_orbit, ey = 0, evx = 0, evy = 1.3*v_orbit;  // e = 0.69
+        double a_ecc = 1/(2/r_orbit - evy*evy/(G*M_orbit));
+        double period_ecc = 2*M_PI*std::sqrt(a_ecc*a_ecc*a_ecc/(G*M_orbit));
+        assert (keplerDrift(G*M_orbit, period_ecc, ex, ey, evx, evy));
+        assert (std::hypot(ex - r_orbit, ey)/r_orbit < 1e-9);
+        double hx = r_orbit, hy = 0, hvx = 0, hvy = 2*v_orbit;
+        assert (keplerDrift(G*M_orbit, 10*period, hx, hy, hvx, hvy));
+        assert (keplerDrift(G*M_orbit, -10*period, hx, hy, hvx, hvy));
+        assert (std::hypot(hx - r_orbit, hy)/r_orbit < 1e-9);
+
+        // Wisdom-Holman solves Kepler orbits analytically, so a circular two-body orbit taken in 10 steps per period
+        // must close to within the (tiny, mass-ratio-sized) coupling error of the splitting.
+        const double m_probe = 5.972*pow(10,24);
+        const double v_pair = std::sqrt(G*(M_orbit + m_probe)/r_orbit);
+        const double period_pair = 2*M_PI*r_orbit/v_pair;
+        Frame WH = Frame(period_pair/10, HistoryPolicy::currentOnly());
+        WH.setIntegrator(WISDOM_HOLMAN);
+        WH.addParticle(Particle("Star", M_orbit, std::make_pair(0, 0), std::make_pair(0, 0)));
+        WH.addParticle(Particle("Probe", m_probe, std::make_pair(r_orbit, 0), std::make_pair(0, v_pair)));
+        for (int step = 0; step < 10; step++) {
+            WH.advanceSingleTimeStep();
+        }
+        double dx_rel = WH["Probe"].getCurrentPos().first - WH["Star"].getCurrentPos().first;
+        double dy_rel = WH["Probe"].getCurrentPos().second - WH["Star"].getCurrentPos().second;
+        std::cout << "Wisdom-Holman orbit closure error: " << std::hypot(dx_rel - r_orbit, dy_rel)/r_orbit << std::endl;
+        assert (std::hypot(dx_rel - r_orbit, dy_rel)/r_orbit < 1e-6);
+
+        // Check streaming binary output: the initial state plus every 2nd of 6 steps gives 4 records, which the
+        // converter turns back into the usual text format.
+        Frame S = Frame(10, HistoryPolicy::currentOnly());
+        S.addParticle(Particle("StreamA", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, 0)));
+        S.addParticle(Particle("StreamB", 5.972*pow(10,24), std::make_pair(r_orbit, 0), std::make_pair(0, v_orbit)));
+        assert (S.streamTrajectory("stream_debug.traj", 2));
+        for (int step = 0; step < 6; step++) {
+            S.advanceSingleTimeStep();
+        }
+        S.closeTrajectory();
+        assert (convertTrajectoryToTextFiles("stream_debug.traj"));
+        std::ifstream streamed("StreamB.txt");
+        std::string line, lastLine;
+        int lines = 0;
+        while (std::getline(streamed, line)) {
+            lines++;
+            lastLine = line;
+        }
+        assert (lines == 5);
+        assert (lastLine.substr(0, 3) == "60;");
+
+        // Check checkpoint/restart: a run restored from a mid-run snapshot must continue bit for bit like the original.
+        Frame C = Frame(3600, HistoryPolicy::currentOnly());
+        C.setIntegrator(VELOCITY_VERLET);
+        C.addParticle(Particle("Sun", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, 0)));
+        C.addParticle(Particle("Earth", 5.972*pow(10,24), std::make_pair(r_orbit, 0), std::make_pair(0, v_orbit), 6.371*pow(10,6)));
+        C.addParticle(Particle("Mars", 6.417*pow(10,23), std::make_pair(0, -1.52*r_orbit), std::make_pair(24070, 0)));
+        for (int step = 0; step < 50; step++) {
+            C.advanceSingleTimeStep();
+        }
+        assert (C.saveCheckpoint("debug.chk"));
+        C.setAutoCheckpoint("debug_auto.chk", 20);
+        for (int step = 0; step < 50; step++) {
+            C.advanceSingleTimeStep();
+        }
+        C.waitForCheckpoints();
+        Frame R;
+        assert (R.restoreCheckpoint("debug.chk"));
+        assert (R.getStepCount() == 50 && R.getDt() == 3600 && R.getIntegrator() == VELOCITY_VERLET);
+        assert (R["Earth"].getRadius() == 6.371*pow(10,6));
+        for (int step = 0; step < 50; step++) {
+            R.advanceSingleTimeStep();
+        }
+        assert (R["Mars"].getCurrentPos() == C["Mars"].getCurrentPos());
+        assert (R["Mars"].getCurrentVel() == C["Mars"].getCurrentVel());
+        Frame RA;
+        assert (RA.restoreCheckpoint("debug_auto.chk"));
+        assert (RA.getStepCount() > 50 && RA.getStepCount() % 20 == 0);
+        assert (!RA.restoreCheckpoint("stream_debug.traj")); // not a checkpoint
+        {
+            // A header with an out-of-range setting is rejected before anything in the Frame is overwritten
+            std::ifstream in("debug.chk", std::ios::binary);
+            std::vector<char> image((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            const std::size_t fields[5] = {offsetof(CheckpointHeader, historyStride),
+                                           offsetof(CheckpointHeader, integrator), offsetof(CheckpointHeader, backend),
+                                           offsetof(CheckpointHeader, collisionResponse),
+                                           offsetof(CheckpointHeader, timeStepMode)};
+            const std::uint32_t values[5] = {0, WISDOM_HOLMAN + 1, PARTICLE_MESH + 1, COLLISION_SOFTEN + 1,
+                                             BLOCK_STEPS + 1};
+            for (unsigned int f = 0; f < 5; f++) {
+                std::vector<char> corrupt = image;
+                std::memcpy(corrupt.data() + fields[f], &values[f], sizeof(values[f]));
+                assert (writeFileAtomically("corrupt_debug.chk", corrupt));
+                assert (!RA.restoreCheckpoint("corrupt_debug.chk"));
+            }
+            assert (RA.getStepCount() > 50 && RA.getIntegrator() == VELOCITY_VERLET && RA["Mars"].getID() == "Mars");
+        }
+
+        // A snapshot taken between two retained steps still restores a printable history: the resume point is kept
+        // as step 3, and the retained steps after it are numbered as in the uninterrupted run
+        Frame D = Frame(3600, HistoryPolicy::everyNthStep(4));
+        D.setIntegrator(VELOCITY_VERLET);
+        D.addParticle(Particle("Sun", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, 0)));
+        D.addParticle(Particle("Earth", 5.972*pow(10,24), std::make_pair(r_orbit, 0), std::make_pair(0, v_orbit)));
+        for (int step = 0; step < 3; step++) {
+            D.advanceSingleTimeStep();
+        }
+        assert (D.saveCheckpoint("stride_debug.chk"));
+        Frame DR;
+        assert (DR.restoreCheckpoint("stride_debug.chk"));
+        assert (DR["Earth"].getPosHistory().size() == 1 && DR["Earth"].getPosHistory().sampleIndex(0) == 3);
+        std::cout << "Restored between retained steps:" << std::endl << DR << std::endl;
+        for (int step = 0; step < 6; step++) {
+            D.advanceSingleTimeStep();
+            DR.advanceSingleTimeStep();
+        }
+        const TrajectoryHistory& resumed = DR["Earth"].getPosHistory();
+        assert (resumed.size() == 3 && resumed.sampleIndex(1) == 4 && resumed.sampleIndex(2) == 8);
+        assert (resumed[2] == D["Earth"].getPosHistory()[2]);
+
+        // Check the metrics: the potential energy gathered during the force pass must match the pairwise sum, Verlet
+        // must conserve energy and momentum closely, reuse one force evaluation per step, and log every 10th step.
+        Frame E = Frame(3600, HistoryPolicy::currentOnly());
+        E.setIntegrator(VELOCITY_VERLET);
+        E.addParticle(Particle("Sun", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, 0)));
+        E.addParticle(Particle("Earth", 5.972*pow(10,24), std::make_pair(r_orbit, 0), std::make_pair(0, v_orbit)));
+        E.addParticle(Particle("Mars", 6.417*pow(10,23), std::make_pair(0, -1.52*r_orbit), std::make_pair(24070, 0)));
+        assert (E.enableMetrics("debug_metrics.txt", 10));
+        double U_pairs = -G*1.989*pow(10,30)*5.972*pow(10,24)/r_orbit - G*1.989*pow(10,30)*6.417*pow(10,23)/(1.52*r_orbit)
+                         - G*5.972*pow(10,24)*6.417*pow(10,23)/std::hypot(r_orbit, 1.52*r_orbit);
+        assert (std::abs(E.getMetrics().potential - U_pairs) <= 1e-12*std::abs(U_pairs));
+        const double Px_start = E.getMetrics().px;
+        const double Lz_start = E.getMetrics().Lz;
+        for (int step = 0; step < 100; step++) {
+            E.advanceSingleTimeStep();
+        }
+        const FrameMetrics& metrics = E.getMetrics();
+        std::cout << "Verlet relative energy error after 100 steps: " << metrics.relativeEnergyError() << std::endl;
+        assert (metrics.sampleStep == 100 && metrics.forceEvaluations == 100 && metrics.interactions == 300);
+        assert (metrics.relativeEnergyError() < 1e-8);
+        assert (std::abs(metrics.px - Px_start) <= 1e-9*std::abs(Px_start));
+        assert (std::abs(metrics.Lz - Lz_start) <= 1e-9*std::abs(Lz_start));
+        E.disableMetrics();
+        std::ifstream metricsFile("debug_metrics.txt");
+        lines = 0;
+        while (std::getline(metricsFile, line)) {
+            lines++;
+        }
+        assert (lines == 12); // header, the sample at enableMetrics(), then steps 10, 20, ..., 100
+        E.setForceBackend(BARNES_HUT);
+        E.setOpeningAngle(0);
+        E.sampleConservedQuantities();
+        const double U_tree = E.getMetrics().potential;
+        E.setForceBackend(DIRECT_SUMMATION);
+        E.sampleConservedQuantities();
+        assert (std::abs(U_tree - E.getMetrics().potential) <= 1e-12*std::abs(U_tree));
+
+        // Check the ensemble runner: each system must follow the same Verlet trajectory as its own Frame, the results
+        // must repeat bit for bit on any number of threads, and agree with the scalar kernel to rounding. 70 three-body systems fill one full block of
+        // lanes and part of another; a fast fourth body in a separate batch must be reported as ejected.
+        Ensemble ens(3600, 200);
+        ens.setEjectionRadius(2*r_orbit, 1);
+        std::vector<Frame> reference;
+        for (int k = 0; k < 70; k++) {
+            std::vector<Particle> system;
+            system.push_back(Particle("Sun", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, 0)));
+            system.push_back(Particle("Earth", 5.972*pow(10,24), std::make_pair(r_orbit, 0), std::make_pair(0, v_orbit)));
+            system.push_back(Particle("Mars", 6.417*pow(10,23), std::make_pair(0, -1.52*r_orbit), std::make_pair(24070 + 100*k, 0)));
+            ens.addSystem(system);
+            if (k % 23 == 0) {
+                reference.push_back(Frame(3600, HistoryPolicy::currentOnly()));
+                reference.back().setIntegrator(VELOCITY_VERLET);
+                for (unsigned int b = 0; b < system.size(); b++) {
+                    reference.back().addParticle(system[b]);
+                }
+            }
+        }
+        std::vector<Particle> escaping;
+        escaping.push_back(Particle("Sun", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, 0)));
+        escaping.push_back(Particle("Earth", 5.972*pow(10,24), std::make_pair(r_orbit, 0), std::make_pair(0, v_orbit)));
+        escaping.push_back(Particle("Mars", 6.417*pow(10,23), std::make_pair(0, -1.52*r_orbit), std::make_pair(24070, 0)));
+        escaping.push_back(Particle("Comet", 1*pow(10,14), std::make_pair(1.9*r_orbit, 0), std::make_pair(300000, 0)));
+        unsigned int escapingIndex = ens.addSystem(escaping);
+        ens.run();
+        for (unsigned int k = 0; k < reference.size(); k++) {
+            for (int step = 0; step < 200; step++) {
+                reference[k].advanceSingleTimeStep();
+            }
+            std::pair<double, double> expected = reference[k]["Mars"].getCurrentPos();
+            std::pair<double, double> actual = ens.getSummary(23*k).finalState[2].getCurrentPos();
+            assert (std::hypot(actual.first - expected.first, actual.second - expected.second) < 1e-9*r_orbit);
+        }
+        assert (ens.getSummary(0).ejectedBody == -1 && ens.getSummary(0).ejectionTime < 0);
+        assert (std::abs(ens.getSummary(0).minSeparation - r_orbit)/r_orbit < 1e-3);
+        assert (ens.getSummary(escapingIndex).ejectedBody == 3);
+        assert (std::abs(ens.getSummary(escapingIndex).ejectionTime - 0.1*r_orbit/300000) <= 3600);
+        std::vector<RunSummary> firstRun;
+        for (unsigned int k = 0; k < ens.size(); k++) {
+            firstRun.push_back(ens.getSummary(k));
+        }
+        ens.setNumThreads(3);
+        ens.run();
+        for (unsigned int k = 0; k < ens.size(); k++) {
+            assert (ens.getSummary(k).finalState[2].getCurrentPos() == firstRun[k].finalState[2].getCurrentPos());
+            assert (ens.getSummary(k).minSeparation == firstRun[k].minSeparation);
+        }
+        selectForceKernel(KERNEL_SCALAR);
+        ens.run();
+        selectForceKernel(best);
+        for (unsigned int k = 0; k < ens.size(); k++) {
+            double dx = ens.getSummary(k).finalState[2].getCurrentPos().first - firstRun[k].finalState[2].getCurrentPos().first;
+            assert (std::abs(dx) <= 1e-12*r_orbit);
+            assert (std::abs(ens.getSummary(k).minSeparation - firstRun[k].minSeparation) <= 1e-12*r_orbit);
+        }
+
+        // Check collision detection against a brute-force swept-sphere test of every pair: 3000 bodies with a spread
+        // of radii (and one star-sized body that is too large for the grid) moving in random directions.
+        const unsigned int nDebris = 3000;
+        std::vector<double> cx0(nDebris), cy0(nDebris), cx1(nDebris), cy1(nDebris), cr(nDebris);
+        for (unsigned int k = 0; k < nDebris; k++) {
+            cx0[k] = std::fmod(k*7919.0, 1000.0)*1000;
+            cy0[k] = std::fmod(k*104729.0, 997.0)*1000;
+            cx1[k] = cx0[k] + std::fmod(k*31.0, 17.0)*300 - 2500;
+            cy1[k] = cy0[k] + std::fmod(k*57.0, 13.0)*300 - 2000;
+            cr[k] = 200 + std::fmod(k*13.0, 7.0)*100;
+        }
+        cr[42] = 50000;
+        CollisionDetector detector;
+        std::vector<CollisionEvent> found;
+        detector.detect(cx0.data(), cy0.data(), cx1.data(), cy1.data(), cr.data(), nDebris, found);
+        unsigned int bruteForce = 0;
+        for (unsigned int i = 0; i < nDebris; i++) {
+            for (unsigned int j = i + 1; j < nDebris; j++) {
+                // Closest approach of the two centres over the step, compared with the sum of the radii.
+                double d0x = cx0[j] - cx0[i], d0y = cy0[j] - cy0[i];
+                double ddx = cx1[j] - cx1[i] - d0x, ddy = cy1[j] - cy1[i] - d0y;
+                double a = ddx*ddx + ddy*ddy;
+                double t = (a > 0) ? std::min(1.0, std::max(0.0, -(d0x*ddx + d0y*ddy)/a)) : 0;
+                if (std::hypot(d0x + t*ddx, d0y + t*ddy) <= cr[i] + cr[j]) bruteForce++;
+            }
+        }
+        std::cout << "Collision pairs found: " << found.size() << " (brute force: " << bruteForce << ")" << std::endl;
+        assert (found.size() == bruteForce && bruteForce > 10);
+
+        // Check the collision responses on a head-on approach fast enough that the bodies would pass through each
+        // other within one step: merging must conserve mass and momentum, bouncing must exchange equal velocities.
+        for (int response = 0; response < 2; response++) {
+            Frame H = Frame(100, HistoryPolicy::currentOnly());
+            H.setIntegrator(VELOCITY_VERLET);
+            H.addParticle(Particle("Left", 2*pow(10,20), std::make_pair(-5*pow(10,6), 0), std::make_pair(100000, 0), 1*pow(10,6)));
+            H.addParticle(Particle("Right", 2*pow(10,20), std::make_pair(5*pow(10,6), 1*pow(10,5)), std::make_pair(-100000, 0), 1*pow(10,6)));
+            H.setCollisionResponse(response ? COLLISION_BOUNCE : COLLISION_MERGE);
+            assert (H.streamTrajectory("collision_debug.traj"));
+            H.advanceSingleTimeStep();
+            H.advanceSingleTimeStep();
+            H.closeTrajectory();
+            assert (H.getMetrics().collisions == 1);
+            if (response == 0) {
+                assert (H.size() == 1 && H["Left"].getMass() == 4*pow(10,20) && H["Right"].getID() == "__NULL__");
+                assert (std::abs(H["Left"].getCurrentVel().first) < 1e-9*100000);
+                assert (std::abs(H["Left"].getRadius() - std::cbrt(2.0)*pow(10,6)) < 1e-3);
+                assert (convertTrajectoryToTextFiles("collision_debug.traj"));
+                std::ifstream merged("Right.txt");
+                lines = 0;
+                while (std::getline(merged, line)) {
+                    lines++;
+                    lastLine = line;
+                }
+                assert (lines == 4 && lastLine.find("nan") != std::string::npos);
+            } else {
+                assert (H.size() == 2 && H["Left"].getCurrentVel().first < -90000 && H["Right"].getCurrentVel().first > 90000);
+                assert (H["Left"].getCurrentPos().first < H["Right"].getCurrentPos().first);
+            }
+        }
+
+        // Check softening: two bodies on top of each other feel no force, and a close pair feels G*m1*m2*r/(r^2 + eps^2)^1.5.
+        Frame SF = Frame(1);
+        SF.setCollisionResponse(COLLISION_SOFTEN, 1000);
+        SF.addParticle(Particle("A", 1*pow(10,20), std::make_pair(0, 0), std::make_pair(0, 0)));
+        SF.addParticle(Particle("B", 1*pow(10,20), std::make_pair(0, 0), std::make_pair(0, 0)));
+        SF.addParticle(Particle("C", 1*pow(10,20), std::make_pair(0, 1*pow(10,9)), std::make_pair(0, 0)));
+        SF.updateAllForces();
+        assert (SF["A"].getNetForce().first == 0 && std::isfinite(SF["A"].getNetForce().second));
+        assert (SF.removeParticle("B") && !SF.removeParticle("B") && SF.size() == 2 && SF["C"].getMass() == 1*pow(10,20));
+        SF.updateAllForces();
+        double F_soft = G*pow(10,40)*pow(10,9)/std::pow(pow(10,18) + pow(10,6), 1.5);
+        assert (std::abs(SF["A"].getNetForce().second - F_soft) <= 1e-12*F_soft);
+
+        // Check massless tracers: a tracer must follow the same path as a 1 kg Particle in an otherwise identical Frame,
+        // whose own pull is negligible. Enough tracers are added to take the parallel path, which must repeat bit for
+        // bit on any number of threads and across a checkpoint.
+        Frame TP = Frame(3600, HistoryPolicy::currentOnly());
+        TP.setIntegrator(VELOCITY_VERLET);
+        TP.addParticle(Particle("Sun", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, 0)));
+        TP.addParticle(Particle("Earth", 5.972*pow(10,24), std::make_pair(r_orbit, 0), std::make_pair(0, v_orbit)));
+        TP.addParticle(Particle("Probe", 1, std::make_pair(0, -1.52*r_orbit), std::make_pair(24070, 0)));
+        for (int step = 0; step < 100; step++) {
+            TP.advanceSingleTimeStep();
+        }
+        std::pair<double, double> tracerEnd[2];
+        for (int threads = 1; threads <= 3; threads += 2) {
+            Frame T = Frame(3600, HistoryPolicy::currentOnly());
+            T.setIntegrator(VELOCITY_VERLET);
+            T.setNumThreads(threads);
+            T.addParticle(Particle("Sun", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, 0)));
+            T.addParticle(Particle("Earth", 5.972*pow(10,24), std::make_pair(r_orbit, 0), std::make_pair(0, v_orbit)));
+            assert (T.addTracer(Particle("Ghost", 0, std::make_pair(0, -1.52*r_orbit), std::make_pair(24070, 0))));
+            assert (!T.addTracer(Particle("Earth", 0, std::make_pair(0, 0), std::make_pair(0, 0))));
+            for (unsigned int k = 0; k < 17000; k++) {
+                T.addTracer(Particle("a" + std::to_string(k), 0, std::make_pair((2 + k%97*0.01)*r_orbit, 0), std::make_pair(0, 0.7*v_orbit)));
+            }
+            assert (T.removeTracer("a5") && !T.removeTracer("a5") && T.numTracers() == 17000);
+            for (int step = 0; step < 50; step++) {
+                T.advanceSingleTimeStep();
+            }
+            assert (T.saveCheckpoint("tracer_debug.chk"));
+            for (int step = 0; step < 50; step++) {
+                T.advanceSingleTimeStep();
+            }
+            std::pair<double, double> ghost = T.getTracer("Ghost").getCurrentPos();
+            std::pair<double, double> probe = TP["Probe"].getCurrentPos();
+            assert (std::hypot(ghost.first - probe.first, ghost.second - probe.second) < 1e-9*r_orbit);
+            assert (T.getTracer("a5").getID() == "__NULL__" && T.getTracer("a16999").getMass() == 0);
+            tracerEnd[threads/2] = T.getTracer("a16999").getCurrentPos();
+            Frame TR;
+            assert (TR.restoreCheckpoint("tracer_debug.chk") && TR.numTracers() == 17000);
+            for (int step = 0; step < 50; step++) {
+                TR.advanceSingleTimeStep();
+            }
+            assert (TR.getTracer("a16999").getCurrentPos() == tracerEnd[threads/2]);
+        }
+        assert (tracerEnd[0] == tracerEnd[1]);
+
+        // Check the dimension/precision templated core. In 2D double precision it must follow the same Verlet
+        // trajectory as Frame; in 3D an inclined circular orbit must close; single precision must agree with double to
+        // float accuracy; and the tiled multithreaded mode must repeat bit for bit.
+        Frame V2 = Frame(3600, HistoryPolicy::currentOnly());
+        V2.setIntegrator(VELOCITY_VERLET);
+        FrameND<2, double> N2(3600);
+        const double m_sun = 1.989*pow(10,30), m_earth = 5.972*pow(10,24), m_mars = 6.417*pow(10,23);
+        V2.addParticle(Particle("Sun", m_sun, std::make_pair(0, 0), std::make_pair(0, 0)));
+        V2.addParticle(Particle("Earth", m_earth, std::make_pair(r_orbit, 0), std::make_pair(0, v_orbit)));
+        V2.addParticle(Particle("Mars", m_mars, std::make_pair(0, -1.52*r_orbit), std::make_pair(24070, 0)));
+        N2.addParticle("Sun", m_sun, {{0, 0}}, {{0, 0}});
+        N2.addParticle("Earth", m_earth, {{r_orbit, 0}}, {{0, v_orbit}});
+        N2.addParticle("Mars", m_mars, {{0, -1.52*r_orbit}}, {{24070, 0}});
+        assert (!N2.addParticle("Mars", m_mars, {{0, 0}}, {{0, 0}}) && N2.find("Pluto") == NULL);
+        for (int step = 0; step < 200; step++) {
+            V2.advanceSingleTimeStep();
+            N2.advanceSingleTimeStep();
+        }
+        FrameND<2, double>::vec marsND = N2.getPos(*N2.find("Mars"));
+        assert (std::hypot(marsND[0] - V2["Mars"].getCurrentPos().first, marsND[1] - V2["Mars"].getCurrentPos().second) < 1e-9*r_orbit);
+
+        Frame3D N3(period/1000);
+        const double incline = 30*M_PI/180;
+        N3.addParticle("Star", M_orbit, {{0, 0, 0}}, {{0, 0, 0}});
+        N3.addParticle("Probe", 1, {{r_orbit, 0, 0}}, {{0, v_orbit*std::cos(incline), v_orbit*std::sin(incline)}});
+        const double E3_start = N3.kineticEnergy() + N3.potentialEnergy();
+        double zMax = 0;
+        for (int step = 0; step < 1000; step++) {
+            N3.advanceSingleTimeStep();
+            zMax = std::max(zMax, N3.getPos(1)[2]);
+        }
+        Frame3D::vec probeEnd = N3.getPos(1);
+        assert (std::sqrt(std::pow(probeEnd[0] - r_orbit, 2) + std::pow(probeEnd[1], 2) + std::pow(probeEnd[2], 2)) < 1e-3*r_orbit);
+        assert (std::abs(zMax - r_orbit*std::sin(incline)) < 1e-3*r_orbit);
+        assert (std::abs(N3.kineticEnergy() + N3.potentialEnergy() - E3_start) < 1e-6*std::abs(E3_start));
+
+        Frame3F N3F(1);
+        Frame3D N3D(1);
+        for (unsigned int k = 0; k < 600; k++) {
+            Frame3D::vec pos = {{std::fmod(k*7919.0, 1000.0)*1e9, std::fmod(k*104729.0, 997.0)*1e9, std::fmod(k*31.0, 89.0)*1e9}};
+            N3D.addParticle("f" + std::to_string(k), (k%7 + 1)*pow(10,24), pos, {{0, 0, 0}});
+            N3F.addParticle("f" + std::to_string(k), (k%7 + 1)*pow(10,24), {{(float)pos[0], (float)pos[1], (float)pos[2]}}, {{0, 0, 0}});
+        }
+        N3D.updateAllAccelerations();
+        N3F.updateAllAccelerations();
+        Frame3D::vec aD = N3D.getAcc(77);
+        Frame3F::vec aF = N3F.getAcc(77);
+        double aMag = std::sqrt(aD[0]*aD[0] + aD[1]*aD[1] + aD[2]*aD[2]);
+        for (int d = 0; d < 3; d++) {
+            assert (std::abs(aF[d] - aD[d]) < 1e-4*aMag);
+        }
+        selectForceKernel(KERNEL_SCALAR);
+        N3F.updateAllAccelerations();
+        Frame3F::vec aScalar = N3F.getAcc(77);
+        selectForceKernel(best);
+        for (int d = 0; d < 3; d++) {
+            assert (std::abs(aScalar[d] - aF[d]) < 1e-5*aMag);
+        }
+        N3F.setNumThreads(3);
+        N3F.updateAllAccelerations();
+        Frame3F::vec aThreads = N3F.getAcc(77);
+        N3F.updateAllAccelerations();
+        assert (N3F.getAcc(77) == aThreads);
+        for (int d = 0; d < 3; d++) {
+            assert (std::abs(aThreads[d] - aF[d]) < 1e-5*aMag);
+        }
+
+        // Scenario files: a text file naming every directive loads into the same Frame as building it by hand, a
+        // binary copy loads back bit for bit, and malformed lines are reported with their line number
+        {
+            std::ofstream text("debug.scenario");
+            text << "# debugging scenario\n"
+                 << "dt 600\n"
+                 << "steps 12   # unused here\n"
+                 << "integrator VELOCITY_VERLET\n"
+                 << "backend BARNES_HUT 0.3\n"
+                 << "threads 2\n"
+                 << "history every 4 16\n"
+                 << "\n"
+                 << "body Sun 1.989e30 0 0 0 0 6.957e8\n"
+                 << "body Earth 5.972e24 1.496e11 0 0 29780\n"
+                 << "tracer Probe 0 1.0e11 -36000 0\n"
+                 << "plummer 100 1e26 1e9 7\n"
+                 << "disk 50 1.989e30 1e24 5e10 2e11\n"
+                 << "belt 40 1.989e30 3e11 4.5e11 0.2 0\n"
+                 << "belt 10 1.989e30 3e11 4.5e11 0.2 1e18 3\n";
+        }
+        Scenario SC;
+        std::string error;
+        assert (loadScenario("debug.scenario", SC, error));
+        assert (SC.dt == 600 && SC.numSteps == 12 && SC.integrator == VELOCITY_VERLET && SC.backend == BARNES_HUT);
+        assert (SC.theta == 0.3 && SC.numThreads == 2 && SC.history.stride == 4 && SC.history.capacity == 16);
+        assert (SC.bodies.size() == 2 + 100 + 50 + 10 && SC.tracers.size() == 1 + 40);
+        assert (SC.bodies[0].getID() == "Sun" && SC.bodies[0].getRadius() == 6.957e8 && SC.bodies[1].getRadius() == 0);
+        assert (SC.bodies[2].getID() == "plummer0" && SC.bodies[152].getID() == "belt40" && SC.tracers[40].getID() == "belt39");
+        double Px = 0, Py = 0;
+        for (unsigned int k = 2; k < 102; k++) {
+            Px += SC.bodies[k].getMass()*SC.bodies[k].getCurrentVel().first;
+            Py += SC.bodies[k].getMass()*SC.bodies[k].getCurrentVel().second;
+        }
+        assert (std::abs(Px) < 1e20 && std::abs(Py) < 1e20); // total |p| is about 1e29
+        for (unsigned int k = 102; k < 152; k++) {
+            std::pair<double, double> r = SC.bodies[k].getCurrentPos();
+            double dist = std::sqrt(r.first*r.first + r.second*r.second);
+            assert (dist >= 5e10 && dist <= 2e11);
+        }
+        Scenario again;
+        assert (loadScenario("debug.scenario", again, error));
+        assert (again.bodies[60] == SC.bodies[60] && again.tracers[20] == SC.tracers[20]); // generators are seeded
+
+        assert (saveScenarioBinary("debug.scenario.bin", SC));
+        Scenario B;
+        assert (loadScenario("debug.scenario.bin", B, error));
+        assert (B.dt == SC.dt && B.theta == SC.theta && B.history.capacity == 16 && B.numSteps == 12);
+        assert (B.bodies.size() == SC.bodies.size() && B.tracers.size() == SC.tracers.size());
+        Frame SCF(SC.dt, SC.history), SCB(B.dt, B.history);
+        assert (SC.populate(SCF) && B.populate(SCB));
+        assert (SC.bodies.empty() && SCF.size() == 162 && SCF.numTracers() == 41 && SCF.getNumThreads() == 2);
+        for (int i = 0; i < 5; i++) {
+            SCF.advanceSingleTimeStep();
+            SCB.advanceSingleTimeStep();
+        }
+        const StateArrays& scf = SCF.getStateArrays();
+        const StateArrays& scb = SCB.getStateArrays();
+        for (unsigned int i = 0; i < SCF.size(); i++) {
+            assert (scf.x[i] == scb.x[i] && scf.vy[i] == scb.vy[i] && SCF.atSlot(i).getID() == SCB.atSlot(i).getID());
+        }
+        assert (SCF.getTracer("Probe").getCurrentPos() == SCB.getTracer("Probe").getCurrentPos());
+
+        {
+            std::ofstream bad("debug_bad.scenario");
+            bad << "dt 60\nbody A 1 0 0 0 0\nbody B 1 0 0 zero 0\n";
+        }
+        assert (!loadScenario("debug_bad.scenario", B, error) && error.find("line 3") == 0);
+        {
+            std::ofstream bad("debug_bad.scenario");
+            bad << "dt 60\nbody Sun 1.989e30 0 0 0 0\nbody Dust 0 1.5e11 0 0 29780\n";  // a zero-mass body
+        }
+        assert (!loadScenario("debug_bad.scenario", B, error) && error.find("line 3") == 0);
+        assert (!loadScenario("no_such.scenario", B, error));
+        {
+            // A binary header whose strides or softening could not have come from a valid text file is rejected
+            std::ofstream settings("debug_settings.scenario");
+            settings << "dt 60\nsoftening 1e6\nstream debug_settings.traj 2\nmetrics debug_settings.txt 2\n"
+                     << "body A 1 0 0 0 0\n";
+        }
+        Scenario SS;
+        assert (loadScenario("debug_settings.scenario", SS, error) && saveScenarioBinary("debug_settings.scenario.bin", SS));
+        std::ifstream binary("debug_settings.scenario.bin", std::ios::binary);
+        std::vector<char> image((std::istreambuf_iterator<char>(binary)), std::istreambuf_iterator<char>());
+        const std::size_t fields[3] = {offsetof(ScenarioHeader, streamStride), offsetof(ScenarioHeader, metricsStride),
+                                       offsetof(ScenarioHeader, softening)};
+        for (unsigned int f = 0; f < 3; f++) {
+            std::vector<char> corrupt = image;
+            std::memset(corrupt.data() + fields[f], 0, (f < 2) ? sizeof(std::uint32_t) : sizeof(double));
+            assert (writeFileAtomically("corrupt_debug.scenario.bin", corrupt));
+            assert (!loadScenario("corrupt_debug.scenario.bin", SS, error) && error == "corrupt scenario header");
+        }
+
+        // Variable time steps. A comet on an e = 0.9 orbit takes short adaptive steps at perihelion and long ones at
+        // aphelion, and still conserves energy over a full orbit; the text output is written against the real times
+        {
+            const double AU = 149600000000, a = AU, e = 0.9;
+            const double vAphelion = std::sqrt(G*1.989e30*(1 - e)/(a*(1 + e)));
+            const double period = 2*M_PI*std::sqrt(a*a*a/(G*1.989e30));
+            Frame AF(86400);
+            AF.setIntegrator(VELOCITY_VERLET);
+            AF.setTimeStepPolicy(TimeStepPolicy::adaptive(0.01, 1));
+            AF.addParticle(Particle("Sun", 1.989e30, std::make_pair(0, 0), std::make_pair(0, 0)));
+            AF.addParticle(Particle("Comet", 1e14, std::make_pair(a*(1 + e), 0), std::make_pair(0, vAphelion)));
+            AF.enableMetrics();
+            double shortest = AF.getDt(), longest = 0, elapsed = 0;
+            while (AF.getTime() < period) {
+                AF.advanceSingleTimeStep();
+                shortest = std::min(shortest, AF.getLastStepSize());
+                longest = std::max(longest, AF.getLastStepSize());
+                elapsed += AF.getLastStepSize();
+            }
+            assert (AF.getTime() == elapsed && longest <= AF.getDt() && shortest >= 1);
+            assert (longest > 20*shortest);
+            AF.sampleConservedQuantities();
+            assert (std::abs(AF.getMetrics().relativeEnergyError()) < 1e-4);
+            std::pair<double, double> comet = AF.at("Comet").getCurrentPos();
+            assert (std::hypot(comet.first - a*(1 + e), comet.second) < 0.01*a);
+            AF.saveAllParticleDataToTextFiles();
+            std::ifstream cometFile("Comet.txt");
+            std::string row, lastRow;
+            unsigned long rows = 0;
+            while (std::getline(cometFile, row)) {
+                lastRow = row;
+                rows++;
+            }
+            assert (rows == AF.getStepCount() + 2); // header and initial state
+            assert (std::abs(std::stod(lastRow.substr(0, lastRow.find(';'))) - AF.getTime()) < 1e-5*AF.getTime());
+
+            // A restored adaptive run picks the same step sizes as the original
+            assert (AF.saveCheckpoint("adaptive_debug.chk"));
+            Frame AR;
+            assert (AR.restoreCheckpoint("adaptive_debug.chk"));
+            for (int i = 0; i < 20; i++) {
+                AF.advanceSingleTimeStep();
+                AR.advanceSingleTimeStep();
+                assert (AR.getLastStepSize() == AF.getLastStepSize());
+            }
+            assert (AR.at("Comet").getCurrentPos() == AF.at("Comet").getCurrentPos());
+        }
+
+        // A body added between two retained steps keeps its initial state as its first sample, prints, and is
+        // written against the Frame's step times from the next retained step on
+        {
+            Frame MF(3600, HistoryPolicy::everyNthStep(4));
+            MF.addParticle(Particle("Sun", 1.989e30, std::make_pair(0, 0), std::make_pair(0, 0)));
+            for (int step = 0; step < 3; step++) {
+                MF.advanceSingleTimeStep();
+            }
+            MF.addParticle(Particle("Probe", 1, std::make_pair(r_orbit, 0), std::make_pair(0, v_orbit)));
+            assert (MF["Probe"].getPosHistory().size() == 1 && MF["Probe"].getPosHistory().sampleIndex(0) == 3);
+            std::cout << "Added between retained steps:" << std::endl << MF["Probe"] << std::endl;
+            for (int step = 0; step < 6; step++) {
+                MF.advanceSingleTimeStep();
+            }
+            assert (MF["Probe"].getPosHistory().size() == 3);
+            MF.saveAllParticleDataToTextFiles();
+            std::ifstream probeFile("Probe.txt");
+            std::string row, lastRow;
+            unsigned int rows = 0;
+            while (std::getline(probeFile, row)) {
+                lastRow = row;
+                rows++;
+            }
+            assert (rows == 3); // header, steps 4 and 8
+            assert (std::stod(lastRow.substr(0, lastRow.find(';'))) == 8*3600.0);
+        }
+
+        // Block time steps put the comet on a deeper level than the distant bodies and track it more closely than a
+        // fixed step of the same total cost. Threaded partial force passes agree with serial ones (bitwise for
+        // Barnes-Hut, whose full passes are thread-count independent too)
+        {
+            const double AU = 149600000000, a = AU, e = 0.99;
+            const double vAphelion = std::sqrt(G*1.989e30*(1 - e)/(a*(1 + e)));
+            const double halfPeriod = M_PI*std::sqrt(a*a*a/(G*1.989e30));
+            auto cometSystem = [&](Frame& f) {
+                f.addParticle(Particle("Sun", 1.989e30, std::make_pair(0, 0), std::make_pair(0, 0)));
+                f.addParticle(Particle("Comet", 1e14, std::make_pair(-a*(1 + e), 0), std::make_pair(0, -vAphelion)));
+                for (int k = 0; k < 20; k++) {
+                    double r = (30 + k)*AU, v = std::sqrt(G*1.989e30/r);
+                    f.addParticle(Particle("Far" + std::to_string(k), 1e20, std::make_pair(r*std::cos(k), r*std::sin(k)),
+                                           std::make_pair(-v*std::sin(k), v*std::cos(k))));
+                }
+            };
+            // Reference: a fine fixed step up to just past perihelion
+            const double blockDt = halfPeriod/64;
+            Frame ref(blockDt/4096);
+            ref.setIntegrator(VELOCITY_VERLET);
+            cometSystem(ref);
+            for (int i = 0; i < 65*4096; i++) {
+                ref.advanceSingleTimeStep();
+            }
+            Frame BF(blockDt, HistoryPolicy::currentOnly());
+            BF.setTimeStepPolicy(TimeStepPolicy::block(0.005, 16));
+            cometSystem(BF);
+            BF.enableMetrics();
+            for (int i = 0; i < 64; i++) {
+                BF.advanceSingleTimeStep();
+            }
+            assert (BF.getTimeStepLevel(1) > BF.getTimeStepLevel(10) + 4);
+            BF.advanceSingleTimeStep();
+            assert (std::abs(BF.getTime() - ref.getTime()) < 1e-6*BF.getTime());
+            std::pair<double, double> cb = BF.at("Comet").getCurrentPos(), cr = ref.at("Comet").getCurrentPos();
+            Frame coarse(blockDt/(BF.getMetrics().forceEvaluations/65));
+            coarse.setIntegrator(VELOCITY_VERLET);
+            cometSystem(coarse);
+            while (coarse.getTime() < ref.getTime() - 1) {
+                coarse.advanceSingleTimeStep();
+            }
+            std::pair<double, double> cc = coarse.at("Comet").getCurrentPos();
+            assert (std::hypot(cb.first - cr.first, cb.second - cr.second) < 1e-3*a);
+            assert (std::hypot(cb.first - cr.first, cb.second - cr.second) < 0.1*std::hypot(cc.first - cr.first, cc.second - cr.second));
+
+            std::vector<Particle> cluster;
+            generatePlummerSphere(cluster, 300, 1e30, 1e11, 3, "star");
+            for (int backend = 0; backend < 2; backend++) {
+                Frame B1(86400*30), B3(86400*30);
+                B3.setNumThreads(3);
+                Frame* both[2] = {&B1, &B3};
+                for (int f = 0; f < 2; f++) {
+                    both[f]->setForceBackend(backend ? BARNES_HUT : DIRECT_SUMMATION);
+                    both[f]->setCollisionResponse(COLLISION_SOFTEN, 1e9);
+                    both[f]->setTimeStepPolicy(TimeStepPolicy::block(0.05, 8));
+                    std::vector<Particle> copy = cluster;
+                    both[f]->addParticles(std::move(copy));
+                    for (int i = 0; i < 3; i++) {
+                        both[f]->advanceSingleTimeStep();
+                    }
+                }
+                unsigned int deepest = 0;
+                for (unsigned int i = 0; i < 300; i++) {
+                    if (backend) {
+                        assert (B1.getStateArrays().x[i] == B3.getStateArrays().x[i]);
+                        assert (B1.getStateArrays().vy[i] == B3.getStateArrays().vy[i]);
+                    } else {
+                        assert (std::abs(B1.getStateArrays().x[i] - B3.getStateArrays().x[i]) < 1e-9*1e11);
+                    }
+                    deepest = std::max(deepest, B1.getTimeStepLevel(i));
+                }
+                assert (deepest > 0);
+            }
+
+            // The policy is part of a checkpoint
+            assert (BF.saveCheckpoint("block_debug.chk"));
+            Frame BR;
+            assert (BR.restoreCheckpoint("block_debug.chk"));
+            assert (BR.getTimeStepPolicy().mode == BLOCK_STEPS && BR.getTimeStepPolicy().maxLevel == 16);
+            assert (BR.getTimeStepPolicy().eta == 0.005 && BR.getLastStepSize() == blockDt);
+            // and so are the levels and timescales, so the restored run continues bit for bit
+            for (unsigned int i = 0; i < 22; i++) {
+                assert (BR.getTimeStepLevel(i) == BF.getTimeStepLevel(i));
+            }
+            for (int i = 0; i < 3; i++) {
+                BF.advanceSingleTimeStep();
+                BR.advanceSingleTimeStep();
+            }
+            assert (BR.at("Comet").getCurrentPos() == BF.at("Comet").getCurrentPos());
+            assert (BR.at("Far3").getCurrentVel() == BF.at("Far3").getCurrentVel());
+        }
+
+        // Live state publishing. A reader thread samples snapshots while the Frame steps; each one it takes is
+        // complete and newer than the last, and after the run the newest one matches the Frame exactly
+        {
+            std::vector<Particle> cluster;
+            generatePlummerSphere(cluster, 200, 1e30, 1e11, 5, "star");
+            Frame PF(3600, HistoryPolicy::currentOnly());
+            PF.addParticles(std::move(cluster));
+            std::shared_ptr<StatePublisher> pub = PF.publishState(5, 2);
+            StateReader watcher(pub), inspector(pub);
+            assert (watcher.isAttached() && inspector.isAttached() && !StateReader(pub).isAttached());
+            assert (!inspector.poll() && inspector.snapshot().size() == 0);
+            unsigned long seen = 0;
+            std::thread watch([&]() {
+                unsigned long last = 0;
+                while (last < 100) {
+                    if (!watcher.poll()) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    const StateSnapshot& s = watcher.snapshot();
+                    assert (s.step > last && s.step % 5 == 0 && s.size() == 200 && s.IDs->size() == 200);
+                    assert (s.m.size() == 200 && s.vy.size() == 200 && std::abs(s.time - s.step*3600.0) < 1e-6);
+                    last = s.step;
+                    seen++;
+                }
+            });
+            for (int i = 0; i < 100; i++) {
+                PF.advanceSingleTimeStep();
+            }
+            watch.join();
+            assert (seen > 0 && pub->snapshotsPublished() == 20);
+            assert (inspector.poll() && !inspector.poll());
+            const StateSnapshot& latest = inspector.snapshot();
+            assert (latest.step == 100 && latest.time == PF.getTime());
+            for (unsigned int i = 0; i < PF.size(); i++) {
+                assert (latest.x[i] == PF.getStateArrays().x[i] && latest.vy[i] == PF.getStateArrays().vy[i]);
+                assert ((*latest.IDs)[i] == PF.atSlot(i).getID());
+            }
+            std::shared_ptr<const std::vector<std::string>> IDsBefore = latest.IDs;
+            PF.removeParticle("star0");
+            for (int i = 0; i < 5; i++) {
+                PF.advanceSingleTimeStep();
+            }
+            PF.stopPublishing();
+            assert (inspector.poll() && inspector.snapshot().size() == 199 && IDsBefore->size() == 200);
+            assert ((*inspector.snapshot().IDs)[0] == PF.atSlot(0).getID() && PF.atSlot(0).getID() != "star0");
+        }
+
+        // Particle-mesh backend. On a disk around a star the plain mesh gets most forces within a few percent and the
+        // short-range correction within a fraction of a percent; both conserve momentum exactly and barely depend on
+        // the thread count. The settings survive checkpoints and scenario files
+        {
+            std::vector<Particle> disk;
+            generateKeplerianDisk(disk, 1000, 2e30, 2e29, 1e10, 1e12, 2, "disk");
+            disk.push_back(Particle("Star", 2e30, std::make_pair(0, 0), std::make_pair(0, 0)));
+            Frame DF(3600);
+            std::vector<Particle> copy = disk;
+            DF.addParticles(std::move(copy));
+            DF.enableMetrics();
+            const StateArrays& exact = DF.getStateArrays();
+            const double exactPotential = DF.getMetrics().potential;
+            for (int p3m = 0; p3m < 2; p3m++) {
+                Frame MF(3600), MT(3600);
+                Frame* both[2] = {&MF, &MT};
+                for (int f = 0; f < 2; f++) {
+                    both[f]->setForceBackend(PARTICLE_MESH);
+                    both[f]->setMeshResolution(256, p3m);
+                    copy = disk;
+                    both[f]->addParticles(std::move(copy));
+                    both[f]->enableMetrics();
+                }
+                MT.setNumThreads(3);
+                MT.updateAllForces();
+                assert (MF.getMeshResolution() == 256 && MF.getShortRangeCorrection() == (p3m == 1));
+                const StateArrays& mesh = MF.getStateArrays();
+                std::vector<double> errors;
+                double Fx = 0, Fy = 0, Fsum = 0;
+                for (unsigned int i = 0; i < MF.size(); i++) {
+                    const double F = std::hypot(exact.fx[i], exact.fy[i]);
+                    errors.push_back(std::hypot(mesh.fx[i] - exact.fx[i], mesh.fy[i] - exact.fy[i])/F);
+                    assert (std::abs(mesh.fx[i] - MT.getStateArrays().fx[i]) < 1e-9*F);
+                    Fx += mesh.fx[i];
+                    Fy += mesh.fy[i];
+                    Fsum += F;
+                }
+                std::sort(errors.begin(), errors.end());
+                std::cout << "Particle mesh" << (p3m ? " with P3M" : "") << " median force error: "
+                          << errors[errors.size()/2] << std::endl;
+                assert (errors[errors.size()/2] < (p3m ? 0.005 : 0.03));
+                assert (!p3m || errors[errors.size()*99/100] < 0.1);
+                assert (std::hypot(Fx, Fy) < 1e-10*Fsum);
+                assert (std::abs(MF.getMetrics().potential/exactPotential - 1) < (p3m ? 1e-3 : 0.05));
+            }
+
+            // Block steps sample the mesh for the active bodies only. Softening keeps close pairs in the disk smooth
+            Frame BM(86400*10, HistoryPolicy::currentOnly());
+            BM.setForceBackend(PARTICLE_MESH);
+            BM.setMeshResolution(128, true);
+            BM.setCollisionResponse(COLLISION_SOFTEN, 1e9);
+            BM.setTimeStepPolicy(TimeStepPolicy::block(0.02, 6));
+            copy = disk;
+            BM.addParticles(std::move(copy));
+            BM.enableMetrics();
+            for (int i = 0; i < 10; i++) {
+                BM.advanceSingleTimeStep();
+            }
+            BM.sampleConservedQuantities();
+            assert (std::abs(BM.getMetrics().relativeEnergyError()) < 5e-3);
+
+            assert (BM.saveCheckpoint("mesh_debug.chk"));
+            Frame BR;
+            assert (BR.restoreCheckpoint("mesh_debug.chk"));
+            assert (BR.getForceBackend() == PARTICLE_MESH && BR.getMeshResolution() == 128 && BR.getShortRangeCorrection());
+            {
+                std::ofstream meshScenario("mesh_debug.scenario");
+                meshScenario << "dt 3600\nbackend PARTICLE_MESH 512 P3M\nbody A 1 0 0 0 0\n";
+            }
+            Scenario MS;
+            std::string error;
+            assert (loadScenario("mesh_debug.scenario", MS, error) && MS.backend == PARTICLE_MESH);
+            assert (MS.meshCells == 512 && MS.meshShortRange);
+            assert (saveScenarioBinary("mesh_debug.scenario.bin", MS) && loadScenario("mesh_debug.scenario.bin", MS, error));
+            assert (MS.meshCells == 512 && MS.meshShortRange);
+            {
+                std::ofstream meshScenario("mesh_debug.scenario");
+                meshScenario << "dt 3600\nbackend PARTICLE_MESH P3M\n";
+            }
+            assert (loadScenario("mesh_debug.scenario", MS, error) && MS.meshCells == 256 && MS.meshShortRange);
+            {
+                std::ofstream meshScenario("mesh_debug.scenario");
+                meshScenario << "dt 3600\nbackend PARTICLE_MESH 100\n";
+            }
+            assert (!loadScenario("mesh_debug.scenario", MS, error) && error.find("line 2") == 0);
+        }
+
         // Debugging force at different positions
         // t2x > t1x
         // t2y > t1y
@@ -129,7 +1045,9 @@ int main(int argc, char* argv[]) {
 
     if (earth) {
         // Model the earth orbiting around the sun
-        Frame F2 = Frame(1);
+        // Velocity Verlet at one-hour steps, keeping every sample
+        Frame F2 = Frame(3600);
+        F2.setIntegrator(VELOCITY_VERLET);
         Particle p5 = Particle("Earth", 5.972*pow(10,24), std::make_pair(0, 149600000000), std::make_pair(29780, 0));
         Particle p6 = Particle("Sun", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, 0));
         F2.addParticle(p5);
@@ -138,7 +1056,7 @@ int main(int argc, char* argv[]) {
         // Number of seconds in a year
         double secs = 3.154*pow(10,7);
         // Number of steps to achieve that
-        double steps = secs/1;
+        double steps = secs/F2.getDt();
 
         // One year period
         for (int i = 0; i < steps; i++) {
@@ -155,7 +1073,9 @@ int main(int argc, char* argv[]) {
 
     if (three_body) {
         // Model a three body problem
-        Frame F3(100);
+        // Only the current state is kept in memory; every 100th step (~3 hours) is streamed to disk as it happens
+        Frame F3(100, HistoryPolicy::currentOnly());
+        F3.setIntegrator(VELOCITY_VERLET);
         Particle three_body_1("Sun_1", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, -20000));
         Particle three_body_2("Sun_2", 1.989*pow(10,30), std::make_pair(149600000000*1.5, 0), std::make_pair(-5000, 20000));
         Particle three_body_3("Planet", 1.989*pow(10,22), std::make_pair(149600000000*0.5, 149600000000*0.5), std::make_pair(30000, -30000));
@@ -164,20 +1084,109 @@ int main(int argc, char* argv[]) {
         F3.addParticle(three_body_2);
         F3.addParticle(three_body_3);
         F3.addParticle(three_body_4);
+        F3.streamTrajectory("three_body.traj", 100);
 
         for (int i = 0; i < 3.154*pow(10,7)*0.5; i++) {
             F3.advanceSingleTimeStep();
         }
 
-        F3.saveAllParticleDataToTextFiles();
+        F3.closeTrajectory();
+        convertTrajectoryToTextFiles("three_body.traj");
         std::cout << "Three Body Problem data saved to text file.\n";
     }
 
+    if (three_body_sweep) {
+        // Sweep the Planet's initial velocity in the -three_body setup over a 32x32 grid of +-10 km/s, one year per
+        // run at the same dt, and record for every run when (if ever) a body was ejected and how close any two came
+        const double AU = 149600000000;
+        const unsigned int gridSize = 32;
+        Ensemble sweep(100, 3.154*pow(10,7)/100);
+        sweep.setNumThreads(std::max(1u, std::thread::hardware_concurrency()));
+        sweep.setEjectionRadius(10*AU);
+        for (unsigned int i = 0; i < gridSize; i++) {
+            for (unsigned int j = 0; j < gridSize; j++) {
+                double dvx = -10000 + 20000.0*i/(gridSize - 1);
+                double dvy = -10000 + 20000.0*j/(gridSize - 1);
+                std::vector<Particle> system;
+                system.push_back(Particle("Sun_1", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, -20000)));
+                system.push_back(Particle("Sun_2", 1.989*pow(10,30), std::make_pair(AU*1.5, 0), std::make_pair(-5000, 20000)));
+                system.push_back(Particle("Planet", 1.989*pow(10,22), std::make_pair(AU*0.5, AU*0.5), std::make_pair(30000 + dvx, -30000 + dvy)));
+                sweep.addSystem(system);
+            }
+        }
+        sweep.run();
+
+        std::ofstream summary("three_body_sweep.txt");
+        summary.precision(10);
+        for (unsigned int k = 0; k < sweep.size(); k++) {
+            const RunSummary& run = sweep.getSummary(k);
+            summary << -10000 + 20000.0*(k/gridSize)/(gridSize - 1) << ";" << -10000 + 20000.0*(k%gridSize)/(gridSize - 1)
+                    << ";" << run.ejectionTime << ";" << run.ejectedBody << ";" << run.minSeparation << ";"
+                    << run.minSeparationTime << "\n";
+        }
+        std::cout << "Three Body sweep summaries saved to three_body_sweep.txt.\n";
+    }
+
+    if (solar_3d) {
+        // The 8 planets again, in 3D: each starts at its mean distance on the x axis, moving along an orbit tilted by
+        // its inclination to the ecliptic. Velocity Verlet at one-hour steps for ten years, with every body's state
+        // written to solar_3d.txt every ten days.
+        Frame3D F5(3600);
+        const char* names[9] = {"Sun", "Mercury", "Venus", "Earth", "Mars", "Jupiter", "Saturn", "Uranus", "Neptune"};
+        const double masses[9] = {1.989*pow(10,30), 3.285*pow(10,23), 4.8675*pow(10,24), 5.9724*pow(10,24), 0.64171*pow(10,24),
+                                  1898.19*pow(10,24), 568.34*pow(10,24), 86.813*pow(10,24), 102.413*pow(10,24)};
+        const double distances[9] = {0, 57904197000, 108683828350, 151625954300, 207930000000, 770300000000,
+                                     1494400000000, 2960500000000, 4476400000000};
+        const double speeds[9] = {0, 47360, 35020, 29780, 24070, 13060, 9680, 6800, 5430};
+        const double inclinations[9] = {0, 7.0, 3.39, 0, 1.85, 1.31, 2.49, 0.77, 1.77}; // in degrees
+        for (int k = 0; k < 9; k++) {
+            double inc = inclinations[k]*M_PI/180;
+            F5.addParticle(names[k], masses[k], {{distances[k], 0, 0}}, {{0, speeds[k]*std::cos(inc), speeds[k]*std::sin(inc)}});
+        }
+        const double E_start = F5.kineticEnergy() + F5.potentialEnergy();
+        std::ofstream out("solar_3d.txt");
+        out << "Time;ID;Pos_X;Pos_Y;Pos_Z;Vel_X;Vel_Y;Vel_Z\n";
+        F5.writeState(out);
+        for (int i = 0; i < 3.154*pow(10,8)/F5.getDt(); i++) {
+            F5.advanceSingleTimeStep();
+            if (F5.getStepCount() % 240 == 0) F5.writeState(out);
+        }
+        std::cout << "Relative energy error: " << (F5.kineticEnergy() + F5.potentialEnergy() - E_start)/std::abs(E_start) << std::endl;
+        std::cout << "3D Solar System data saved to solar_3d.txt.\n";
+    }
+
+    if (scenarioFile) {
+        // Run whatever the scenario file describes for its number of steps, reporting how long loading took
+        Scenario scenario;
+        std::string error;
+        auto start = std::chrono::steady_clock::now();
+        if (!loadScenario(scenarioFile, scenario, error)) {
+            std::cout << scenarioFile << ": " << error << std::endl;
+            return 0;
+        }
+        Frame F6(scenario.dt, scenario.history);
+        if (!scenario.populate(F6)) {
+            std::cout << "Could not open the scenario's output files." << std::endl;
+            return 0;
+        }
+        std::chrono::duration<double> loadTime = std::chrono::steady_clock::now() - start;
+        std::cout << "Loaded " << F6.size() << " bodies and " << F6.numTracers() << " tracers in " << loadTime.count()
+                  << " s." << std::endl;
+        for (unsigned long i = 0; i < scenario.numSteps; i++) {
+            F6.advanceSingleTimeStep();
+        }
+        F6.closeTrajectory();
+        std::cout << "Ran " << scenario.numSteps << " steps of " << scenarioFile << ".\n";
+    }
+
     if (solar) {
         // Model the 8 planets of the solar system (sorry pluto)
         // Quick and dirty, using avg values. Source: https://nssdc.gsfc.nasa.gov/planetary/factsheet/
         // TODO: Understand the orbital parameters and create more accurate simulation
-        Frame F4(10);
+        // Wisdom-Holman at one-day steps: the planets' orbits about the Sun are solved analytically, so the step
+        // only has to resolve the planet-planet interactions
+        Frame F4(86400);
+        F4.setIntegrator(WISDOM_HOLMAN);
         Particle solar_0("Sun", 1.989*pow(10,30), std::make_pair(0, 0), std::make_pair(0, 0));
         Particle solar_1("Mercury", 3.285*pow(10,23), std::make_pair(57904197000, 0), std::make_pair(0, 47360));
         Particle solar_2("Venus", 4.8675*pow(10,24), std::make_pair(108683828350, 0), std::make_pair(0, 35020));
@@ -198,7 +1207,7 @@ int main(int argc, char* argv[]) {
         F4.addParticle(solar_8);
 
         // Simulate for ten earth orbits
-        for (int i = 0; i < 3.154*pow(10,7); i++) {
+        for (int i = 0; i < 3.154*pow(10,8)/F4.getDt(); i++) {
             F4.advanceSingleTimeStep();
         }
 
@@ -0,0 +1,41 @@
+#include "metrics.h"
+#include <cmath>
+
+void FrameMetrics::reset() {
+    forceSeconds = 0;
+    integrateSeconds = 0;
+    ioSeconds = 0;
+    forceEvaluations = 0;
+    interactions = 0;
+    collisions = 0;
+    sampleStep = 0;
+    kinetic = 0;
+    potential = 0;
+    initialEnergy = 0;
+    px = 0;
+    py = 0;
+    Lz = 0;
+}
+
+double FrameMetrics::relativeEnergyError() const {
+    // |E - E_0|/|E_0|, or the absolute error if the initial energy happens to be zero.
+    double E0 = std::fabs(initialEnergy);
+    return std::fabs(this->totalEnergy() - initialEnergy)/(E0 > 0 ? E0 : 1);
+}
+
+MetricsLog::MetricsLog(const std::string& filename) : out(filename) {
+    if (!out.is_open()) return;
+    out.precision(17);
+    out << "Step;Time;Force_s;Integrate_s;IO_s;Force_Evaluations;Interactions;Kinetic;Potential;Total;"
+           "Rel_Energy_Error;Px;Py;Lz;Collisions\n";
+    out.flush();
+}
+
+void MetricsLog::write(double time, const FrameMetrics& metrics) {
+    out << metrics.sampleStep << ";" << time << ";" << metrics.forceSeconds << ";" << metrics.integrateSeconds << ";"
+        << metrics.ioSeconds << ";" << metrics.forceEvaluations << ";" << metrics.interactions << ";"
+        << metrics.kinetic << ";" << metrics.potential << ";" << metrics.totalEnergy() << ";"
+        << metrics.relativeEnergyError() << ";" << metrics.px << ";" << metrics.py << ";" << metrics.Lz << ";"
+        << metrics.collisions << "\n";
+    out.flush();
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <chrono>
+
+// ==========================================================================================
+// Run-time instrumentation for a Frame (see Frame::enableMetrics). Counters are kept on every force evaluation; the
+// phase timers and conserved quantities are only gathered while metrics are enabled, so an uninstrumented run pays
+// nothing but a couple of integer adds per step.
+struct FrameMetrics {
+    // Constructor
+    FrameMetrics() { this->reset(); }
+
+    // Member functions
+    void reset();
+    double totalEnergy() const { return kinetic + potential; }
+    double relativeEnergyError() const;
+
+    // Phase timers, in seconds of wall time
+    double forceSeconds;            // inside updateAllForces()
+    double integrateSeconds;        // the rest of the integrator step
+    double ioSeconds;               // history recording, trajectory streaming, checkpoints and the metrics log
+
+    // Counters
+    unsigned long forceEvaluations;
+    unsigned long interactions;     // body-body pairs (direct summation) or body-body/body-node terms (Barnes-Hut)
+    unsigned long collisions;       // touching pairs found and resolved (see Frame::setCollisionResponse)
+
+    // Conserved quantities at the last sample. The potential energy comes from the force pass at the same positions,
+    // so it is exact for direct summation and carries the tree's approximation error for Barnes-Hut.
+    unsigned long sampleStep;
+    double kinetic, potential;      // J
+    double initialEnergy;           // total energy at the first sample after enableMetrics(), for drift monitoring
+    double px, py;                  // linear momentum, kg*m/s
+    double Lz;                      // angular momentum about the origin, kg*m^2/s
+};
+
+// ==========================================================================================
+// Adds the wall time between its construction and destruction to *seconds. A null target makes it a no-op, so call
+// sites can be timed conditionally without branching around the timed code.
+class PhaseTimer {
+public:
+    explicit PhaseTimer(double* _seconds) : seconds(_seconds) {
+        if (seconds) start = std::chrono::steady_clock::now();
+    }
+    ~PhaseTimer() {
+        if (seconds) *seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator= (const PhaseTimer&) = delete;
+
+private:
+    double* seconds;
+    std::chrono::steady_clock::time_point start;
+};
+
+// ==========================================================================================
+// Semicolon-separated metrics file, one line per sample, with a header naming the columns. Each line is flushed as it
+// is written so the file can be watched while a long run is in progress.
+class MetricsLog {
+public:
+    explicit MetricsLog(const std::string& filename);
+
+    bool isOpen() const { return out.is_open(); }
+    void write(double time, const FrameMetrics& metrics);
+
+private:
+    std::ofstream out;
+};
@@ -1,12 +1,88 @@
 #include "modelClasses.h"
 
+void TrajectoryHistory::add(std::pair<double, double> sample) {
+    // Postcondition: sample is the latest value, and has been retained if its number is a multiple of the stride.
+    //      Once a bounded history is full, the oldest retained sample is overwritten in place.
+    current = sample;
+    if (offered++ % policy.stride != 0) return;
+    if (policy.capacity == 0 || samples.size() < policy.capacity) {
+        samples.push_back(sample);
+    } else {
+        samples[head] = sample;
+        head = (head + 1) % policy.capacity;
+        offStride = false; // the oldest sample, which is the resume point if there is one, was just overwritten
+    }
+    kept++;
+}
+
+void TrajectoryHistory::setPolicy(const HistoryPolicy& newPolicy) {
+    // Abstract: Switch to a new retention policy, re-filtering the samples held so far as if newPolicy had been in
+    //      effect from the start. This is only exact while nothing has been dropped yet, so we require that.
+    // Postcondition: Retained samples obey newPolicy, and bounded storage has been allocated up front.
+    assert (kept == offered); // policy can only be changed before any sample has been discarded
+    std::vector<std::pair<double, double>> old;
+    old.swap(samples);
+    policy = newPolicy;
+    offered = 0;
+    kept = 0;
+    head = 0;
+    offStride = false;
+    if (policy.capacity != 0) samples.reserve(policy.capacity);
+    for (unsigned int i = 0; i < old.size(); i++) {
+        this->add(old[i]);
+    }
+}
+
+void TrajectoryHistory::restart(std::pair<double, double> sample, unsigned long index) {
+    // Abstract: Discard everything retained and continue as if sample were sample number index, e.g. after
+    //      restoring a checkpoint taken at step index or adding a body mid-run. Later samples keep the same numbering
+    //      (and retention) they would have had in an uninterrupted run. sample itself is always retained, even when
+    //      the stride would have dropped it, so the history is never empty; it is then numbered index rather than by
+    //      the stride, and is the first sample a bounded history overwrites.
+    samples.clear();
+    if (policy.capacity != 0) samples.reserve(policy.capacity);
+    offered = index;
+    kept = (index + policy.stride - 1)/policy.stride; // multiples of stride below index
+    head = 0;
+    offStride = false;
+    if (index % policy.stride == 0) {
+        this->add(sample);
+        return;
+    }
+    current = sample;
+    samples.push_back(sample);
+    offered++;
+    offStride = true;
+    resumedAt = index;
+}
+
+unsigned long TrajectoryHistory::sampleIndex(unsigned int j) const {
+    // Number of the j-th oldest retained sample among all samples offered, i.e. the step it was recorded at.
+    if (offStride && j == 0) return resumedAt;
+    return (kept - samples.size() + j)*policy.stride;
+}
+
+bool TrajectoryHistory::findSample(unsigned long index, unsigned int& j) const {
+    // Postcondition: Returns whether the sample numbered index is retained, and if so sets j to its position.
+    if (samples.empty()) return false;
+    if (offStride && index == resumedAt) {
+        j = 0;
+        return true;
+    }
+    if (index % policy.stride != 0 || index/policy.stride + samples.size() < kept) return false;
+    const unsigned long position = index/policy.stride + samples.size() - kept;
+    if (position < (offStride ? 1u : 0u) || position >= samples.size()) return false;
+    j = position;
+    return true;
+}
+
 Particle::Particle(std::string _ID, 
                    double _mass, 
                    std::pair<double, double> _pos, 
                    std::pair<double, double> _vel) : ID(_ID), mass(_mass), radius(0), net_force(std::make_pair(0, 0)) 
 {
-    pos.push_back(_pos);
-    vel.push_back(_vel);
+    pos.add(_pos);
+    vel.add(_vel);
 }
 
 Particle::Particle(std::string _ID, 
@@ -15,8 +91,8 @@ Particle::Particle(std::string _ID,
                    std::pair<double, double> _vel,
                    double _radius) : ID(_ID), mass(_mass), radius(_radius), net_force(std::make_pair(0, 0)) 
 {
-    pos.push_back(_pos);
-    vel.push_back(_vel);
+    pos.add(_pos);
+    vel.add(_vel);
 }
 
 bool Particle::operator== (const Particle& other) const {
@@ -32,7 +108,8 @@ std::ostream& operator<< (std::ostream& ostr, const Particle& p) {
     // Only print the very first and final 4 history entries to avoid clogging data
     ostr << "Particle ID: " << p.ID << std::endl;
     ostr << "Mass: " << p.mass << std::endl;
-    ostr << "Position History: [" << "(" << p.pos[0].first << ", " << p.pos[0].second << ") ... ";
+    ostr << "Position History: [";
+    if (p.pos.size() > 0) ostr << "(" << p.pos[0].first << ", " << p.pos[0].second << ") ... ";
     if (p.pos.size() >= 6) {
         for (unsigned int i = p.pos.size() - 5; i < p.pos.size(); i++ ) {
             ostr << "(" << p.pos[i].first << ", " << p.pos[i].second << ")";
@@ -40,7 +117,8 @@ std::ostream& operator<< (std::ostream& ostr, const Particle& p) {
         }
     }
     ostr << "]" << std::endl;
-    ostr << "Velocity History: [" << "(" << p.vel[0].first << ", " << p.vel[0].second << ") ... ";
+    ostr << "Velocity History: [";
+    if (p.vel.size() > 0) ostr << "(" << p.vel[0].first << ", " << p.vel[0].second << ") ... ";
     if (p.vel.size() >= 6) {
         for (unsigned int i = p.vel.size() - 5; i < p.vel.size(); i++ ) {
             ostr << "(" << p.vel[i].first << ", " << p.vel[i].second << ")";
@@ -59,16 +137,26 @@ void Particle::addForce(std::pair<double, double> F_vec) {
     net_force.second += F_vec.second;
 }
 
-void Particle::saveDataToTextFile(double dt) const {
-    // Save all position and velocity history to [filename].txt
+void Particle::saveDataToTextFile(const TrajectoryHistory& stepTimes) const {
+    // Save all retained position and velocity history to [filename].txt
+    // Each row's time is looked up in the Frame's stepTimes by the step its sample was recorded at, so decimated,
+    // ring-buffered or variable-step histories are still written against the correct time axis. stepTimes must
+    // follow the same HistoryPolicy as this Particle, so every retained sample of ours has its time retained too --
+    // except the first sample of a body added between two retained steps, which is left out of the file.
     assert (pos.size() == vel.size());
+    assert (stepTimes.getPolicy().stride == pos.getPolicy().stride);
     std::ofstream ostr;
-    double time = 0;
     ostr.open(ID + ".txt");
-    ostr << "Time;Pos_X;Pos_Y;Vel_X;Vel_Y" << std::endl; 
+    // Lines end in '\n' rather than std::endl so the stream is not flushed after every sample.
+    ostr << "Time;Pos_X;Pos_Y;Vel_X;Vel_Y\n";
     for (unsigned int i = 0; i < pos.size(); i++) {
-        ostr << time << ";" << pos[i].first << ";" << pos[i].second << ";" << vel[i].first << ";" << vel[i].second << std::endl;
-        time = time + dt;
+        unsigned int t;
+        if (!stepTimes.findSample(pos.sampleIndex(i), t)) {
+            assert (i == 0);
+            continue;
+        }
+        double time = stepTimes[t].first;
+        ostr << time << ";" << pos[i].first << ";" << pos[i].second << ";" << vel[i].first << ";" << vel[i].second << "\n";
     }
 }
 
@@ -82,113 +170,1438 @@ unsigned int ParticleHasher::operator() (const std::string& IDToHash) const {
     return hash;
 }
 
+void StateArrays::reserve(unsigned int n) {
+    x.reserve(n); y.reserve(n);
+    vx.reserve(n); vy.reserve(n);
+    m.reserve(n);
+    fx.reserve(n); fy.reserve(n);
+    radius.reserve(n);
+}
+
+void StateArrays::push_back(const Particle& p) {
+    x.push_back(p.getCurrentPos().first);
+    y.push_back(p.getCurrentPos().second);
+    vx.push_back(p.getCurrentVel().first);
+    vy.push_back(p.getCurrentVel().second);
+    m.push_back(p.getMass());
+    fx.push_back(p.getNetForce().first);
+    fy.push_back(p.getNetForce().second);
+    radius.push_back(p.getRadius());
+}
+
+void StateArrays::swapRemove(unsigned int i) {
+    // Postcondition: Slot i holds what was the last slot, and the arrays are one shorter.
+    aligned_vector* arrays[8] = {&x, &y, &vx, &vy, &m, &fx, &fy, &radius};
+    for (unsigned int a = 0; a < 8; a++) {
+        (*arrays[a])[i] = arrays[a]->back();
+        arrays[a]->pop_back();
+    }
+}
+
+void TracerArrays::reserve(unsigned int n) {
+    x.reserve(n); y.reserve(n);
+    vx.reserve(n); vy.reserve(n);
+    ax.reserve(n); ay.reserve(n);
+}
+
+void TracerArrays::push_back(const Particle& p) {
+    x.push_back(p.getCurrentPos().first);
+    y.push_back(p.getCurrentPos().second);
+    vx.push_back(p.getCurrentVel().first);
+    vy.push_back(p.getCurrentVel().second);
+    ax.push_back(0);
+    ay.push_back(0);
+}
+
+void TracerArrays::swapRemove(unsigned int i) {
+    // Postcondition: Slot i holds what was the last slot, and the arrays are one shorter.
+    aligned_vector* arrays[6] = {&x, &y, &vx, &vy, &ax, &ay};
+    for (unsigned int a = 0; a < 6; a++) {
+        (*arrays[a])[i] = arrays[a]->back();
+        arrays[a]->pop_back();
+    }
+}
+
 std::ostream& operator<< (std::ostream& ostr, const Frame& f) {
     // Ostream operator overload to print all Particles in a Frame
-    for (const_particle_itr itr = f.particles.begin(); itr != f.particles.end(); itr++ ) {
-        ostr << itr->second;
+    for (unsigned int i = 0; i < f.bodies.size(); i++) {
+        ostr << f.bodies[i];
     }
     return ostr;
 }
 
+// Returned by Frame::operator[] for an ID that is not in the Frame.
+static const Particle NULL_PARTICLE;
+
+const Particle& Frame::operator[] (const std::string& particleName) const {
+    // Look up a Particle by ID. A miss returns a default ("__NULL__") Particle rather than inserting one, since a
+    // massless placeholder in the state arrays would poison every later step with a division by zero.
+    const Particle* p = this->find(particleName);
+    return p ? *p : NULL_PARTICLE;
+}
+
+const Particle& Frame::at(const std::string& particleName) const {
+    // Like operator[], but a miss throws std::out_of_range, as with the standard containers.
+    const Particle* p = this->find(particleName);
+    if (!p) throw std::out_of_range("Frame::at: no Particle with ID " + particleName);
+    return *p;
+}
+
+const Particle* Frame::find(const std::string& particleName) const {
+    // Postcondition: Returns the Particle with ID particleName, or NULL if there is none.
+    const_particle_itr itr = particles.find(particleName);
+    return (itr == particles.end()) ? NULL : &bodies[itr->second];
+}
+
+Particle Frame::getTracer(const std::string& tracerName) const {
+    // Look up a tracer by ID, returned as a massless Particle holding only its current position and velocity. A miss
+    // returns a default ("__NULL__") Particle, as with operator[].
+    const_particle_itr itr = tracerIndex.find(tracerName);
+    if (itr == tracerIndex.end()) return Particle();
+    const unsigned int k = itr->second;
+    return Particle(tracerName, 0, std::make_pair(tracers.x[k], tracers.y[k]), std::make_pair(tracers.vx[k], tracers.vy[k]));
+}
+
+bool Frame::addTracer(const Particle& newTracer) {
+    // Abstract: Add a massless tracer at newTracer's current position and velocity (its mass, radius and history are
+    //      ignored). Tracers are pulled by every Particle in the Frame but pull on nothing, so M tracers add O(N*M)
+    //      work per step instead of turning an N-body problem into an (N+M)-body one. They are not streamed, do not
+    //      collide, and keep no history.
+    // Postcondition: Returns false, leaving the Frame unchanged, if the ID is already used by a Particle or tracer.
+    if (particles.count(newTracer.getID()) || tracerIndex.count(newTracer.getID())) return false;
+    tracerIndex.insert(std::make_pair(newTracer.getID(), (unsigned int)tracers.size()));
+    tracerIDs.push_back(newTracer.getID());
+    tracers.push_back(newTracer);
+    tracerAccelerationsCurrent = false;
+    return true;
+}
+
+unsigned int Frame::addTracers(const std::vector<Particle>& newTracers) {
+    // Bulk version of addTracer(), growing the tracer storage once. Returns how many tracers were added.
+    const unsigned int capacity = tracers.size() + newTracers.size();
+    tracers.reserve(capacity);
+    tracerIDs.reserve(capacity);
+    tracerIndex.reserve(capacity);
+    unsigned int added = 0;
+    for (unsigned int k = 0; k < newTracers.size(); k++) {
+        if (this->addTracer(newTracers[k])) added++;
+    }
+    return added;
+}
+
+bool Frame::removeTracer(const std::string& tracerName) {
+    // Postcondition: Returns whether tracerName was present. As with removeParticle(), the last tracer fills the gap.
+    particle_itr itr = tracerIndex.find(tracerName);
+    if (itr == tracerIndex.end()) return false;
+    const unsigned int k = itr->second;
+    const unsigned int last = tracerIDs.size() - 1;
+    tracerIndex.erase(itr);
+    if (k != last) {
+        tracerIDs[k] = std::move(tracerIDs[last]);
+        tracerIndex[tracerIDs[k]] = k;
+    }
+    tracerIDs.pop_back();
+    tracers.swapRemove(k);
+    return true;
+}
+
 std::pair<particle_itr, bool> Frame::addParticle(const Particle &newParticle) {
-    return particles.insert(std::make_pair(newParticle.getID(), newParticle));
+    // Postcondition: If the ID was not already present, newParticle occupies the next dense slot of bodies and state
+    //      and the ID index points at it. Otherwise the Frame is unchanged and the existing entry is returned.
+    assert (!writer); // a streamed trajectory's body count is fixed by its header
+    assert (!tracerIndex.count(newParticle.getID()));
+    std::pair<particle_itr, bool> res = particles.insert(std::make_pair(newParticle.getID(), (unsigned int)bodies.size()));
+    if (res.second) {
+        bodies.push_back(newParticle);
+        bodies.back().setHistoryPolicy(history);
+        if (stepCount > 0) bodies.back().resumeHistoryAt(stepCount); // samples are numbered by the Frame's step
+        state.push_back(newParticle);
+        forcesCurrent = false;
+        tracerAccelerationsCurrent = false;
+        timescalesCurrent = false;
+        publishedIDs.reset();
+    }
+    return res;
+}
+
+unsigned int Frame::addParticles(std::vector<Particle>&& newParticles) {
+    // Abstract: Bulk version of addParticle() for large initial conditions. Every container is grown once up front
+    //      and the Particles are moved in rather than copied, so newParticles is left empty.
+    // Postcondition: Returns how many Particles were added; those whose ID was already present are skipped.
+    assert (!writer);
+    const unsigned int capacity = bodies.size() + newParticles.size();
+    bodies.reserve(capacity);
+    state.reserve(capacity);
+    particles.reserve(capacity);
+    unsigned int added = 0;
+    for (unsigned int k = 0; k < newParticles.size(); k++) {
+        assert (!tracerIndex.count(newParticles[k].getID()));
+        if (!particles.insert(std::make_pair(newParticles[k].getID(), (unsigned int)bodies.size())).second) continue;
+        bodies.push_back(std::move(newParticles[k]));
+        bodies.back().setHistoryPolicy(history);
+        if (stepCount > 0) bodies.back().resumeHistoryAt(stepCount);
+        state.push_back(bodies.back());
+        added++;
+    }
+    newParticles.clear();
+    forcesCurrent = false;
+    tracerAccelerationsCurrent = false;
+    timescalesCurrent = false;
+    publishedIDs.reset();
+    return added;
+}
+
+bool Frame::removeParticle(const std::string& particleName) {
+    // Abstract: Remove a Particle from the Frame. Slots stay dense: the Particle in the last slot moves into the freed
+    //      one, so slot order is not preserved. A trajectory being streamed keeps its columns, and the removed
+    //      Particle's column reads NaN from now on.
+    // Postcondition: Returns whether particleName was present.
+    particle_itr itr = particles.find(particleName);
+    if (itr == particles.end()) return false;
+    const unsigned int i = itr->second;
+    const unsigned int last = bodies.size() - 1;
+    particles.erase(itr);
+    if (i != last) {
+        bodies[i] = std::move(bodies[last]);
+        particles[bodies[i].getID()] = i;
+    }
+    bodies.pop_back();
+    state.swapRemove(i);
+    forcesCurrent = false;
+    tracerAccelerationsCurrent = false;
+    timescalesCurrent = false;
+    publishedIDs.reset();
+    if (writer) this->remapWriterColumns();
+    return true;
+}
+
+void Frame::setCollisionResponse(CollisionResponse response, double softeningLength) {
+    // Postcondition: Collisions are handled by response from the next step on. COLLISION_SOFTEN needs a positive
+    //      softening length, which every force backend then applies; the other responses use pure 1/r^2 forces.
+    assert (response != COLLISION_SOFTEN || softeningLength > 0);
+    collisionResponse = response;
+    softening = (response == COLLISION_SOFTEN) ? softeningLength : 0;
+    forcesCurrent = false;
+    tracerAccelerationsCurrent = false;
+    timescalesCurrent = false;
+}
+
+void Frame::setHistoryPolicy(const HistoryPolicy& policy) {
+    // Postcondition: Every Particle currently in the Frame, and every Particle added later, retains its trajectory
+    //      according to policy. Must be called before any samples have been discarded (see TrajectoryHistory).
+    history = policy;
+    for (unsigned int i = 0; i < bodies.size(); i++) {
+        bodies[i].setHistoryPolicy(history);
+    }
+    stepTimes.setPolicy(history);
+}
+
+void Frame::setMeshResolution(unsigned int cells, bool shortRangeCorrection) {
+    // Abstract: Configure the PARTICLE_MESH backend: a mesh of cells x cells nodes (a power of two, at least 16) over
+    //      the bodies' bounding square, optionally with the P3M short-range correction (see ParticleMesh). The
+    //      default is 256 cells without the correction. Finer meshes resolve more but cost cells^2 log cells per pass
+    //      whatever the number of bodies; the correction makes close pairs exact but costs a pair loop over the
+    //      bodies within a few cells of each other.
+    // Postcondition: The next force pass with the PARTICLE_MESH backend uses these settings.
+    mesh.setResolution(cells, shortRangeCorrection);
+    forcesCurrent = false;
+}
+
+void Frame::setTimeStepPolicy(const TimeStepPolicy& policy) {
+    // Abstract: Choose how steps are sized from the next step on. ADAPTIVE_STEP works with every integrator, though
+    //      varying the step gives up the exact long-term energy behaviour of the symplectic ones. BLOCK_STEPS always
+    //      integrates with the kick-drift-kick leapfrog, whatever the integrator setting, and cannot be combined
+    //      with COLLISION_MERGE or COLLISION_BOUNCE. Tracers do not influence the step size; they take one leapfrog
+    //      step per step of the Frame, as always.
+    // Postcondition: Timescales are re-estimated at the start of the next step.
+    stepPolicy = policy;
+    lastStep = 0;
+    timescalesCurrent = false;
+}
+
+unsigned int Frame::getTimeStepLevel(unsigned int slot) const {
+    // Level of the last sub-step taken by the body in slot (0 unless the policy is BLOCK_STEPS).
+    assert (slot < bodies.size());
+    return (stepPolicy.mode == BLOCK_STEPS && slot < levels.size()) ? levels[slot] : 0;
 }
 
 std::pair<double, double> Frame::getGravitationalForceBetween(const Particle& p1, const Particle& p2) {
     // Abstract: Implement Newton's Law of Universal Gravitation to determine force between two Particles.
-    //      Newton's Law of Universal Gravitation is: F = G*(m1*m2/r^2)
     // Postcondition: F_vec is the 2D force vector pointing from p1 to p2, and F_vec has been returned. The force vector from 
     //      p2 to p1 will be the same, but the user will have to reverse the signs of the elements in F_vec to obtain it.
     assert( p1 != p2 ); // quick and dirty checking. We shouldn't ever call this on the same particle.
-    double G = 6.67259*pow(10, -11); // Constant of Gravitation
-    double p1x = p1.getCurrentPos().first;
-    double p1y = p1.getCurrentPos().second;
-    double p2x = p2.getCurrentPos().first;
-    double p2y = p2.getCurrentPos().second;
-    double r = pow(pow(p2x-p1x, 2) + pow(p2y-p1y, 2), 0.5); // distance formula
-    double F = G*(p1.getMass()*p2.getMass()/pow(r,2)); // Magnitude of Force Vector
-    double theta = atan(std::abs(p2y-p1y)/std::abs(p2x-p1x)); // angle of interest, in radians
-    double F_x = F*cos(theta);
-    double F_y = F*sin(theta);
-    // Ensure direction of returned force vector is correct
-    if ( p2y > p1y && p2x > p1x ) return std::make_pair(F_x, F_y);
-    else if ( p2y < p1y && p2x > p1x ) return std::make_pair(F_x, -F_y);
-    else if ( p2y < p1y && p2x < p1x ) return std::make_pair(-F_x, -F_y);
-    else return std::make_pair(-F_x, F_y);
+    std::pair<double, double> p1Pos = p1.getCurrentPos();
+    std::pair<double, double> p2Pos = p2.getCurrentPos();
+    return gravitationalForce(p1Pos.first, p1Pos.second, p1.getMass(), p2Pos.first, p2Pos.second, p2.getMass());
 }
 
 void Frame::updateAllForces() {
     // Abstract: Calculate and store the net force incident on each Particle in the Frame.
-    // Postcondition: For every Particle in Frame.particles, Particle.net_force is accurate for the system
-    //      conditions at the current timestep.
+    // Postcondition: For every slot i, state.fx[i] and state.fy[i] (and the matching Particle's net_force) are
+    //      accurate for the system conditions at the current timestep, and lastPotential holds the total potential
+    //      energy at those positions.
+    PhaseTimer timer(metricsEnabled ? &metrics.forceSeconds : NULL);
+    const unsigned int n = state.size();
+    const double eps2 = softening*softening;
+    double* x = state.x.data();
+    double* y = state.y.data();
+    double* m = state.m.data();
+    double* fx = state.fx.data();
+    double* fy = state.fy.data();
 
     // State 1 (forces reset): The net force on each Particle has been set to zero.
-    for (particle_itr i = particles.begin(); i != particles.end(); i++ ) {
-        i->second.setForce(std::make_pair(0,0));
+    for (unsigned int i = 0; i < n; i++) {
+        fx[i] = 0;
+        fy[i] = 0;
     }
 
     // State 2 (new forces calculated): The net force on a particle has been calculated for the current timestep.
     // We individually calculate the force between each pair of particles, checking each unique
-    // pair only once so as to avoid double-counting.
-    for (particle_itr i = particles.begin(); i != particles.end(); i++ ) {
-        for (particle_itr j = i; j != particles.end(); j++ ) {
-            if (j == i) continue;
-            std::pair<double, double> F_i_j = getGravitationalForceBetween(i->second, j->second);
-            i->second.addForce(F_i_j);
-            j->second.addForce(-F_i_j);
+    // pair only once so as to avoid double-counting. Each row i is handed to the vectorized kernel, which
+    // processes several j > i at once. Large Frames with a thread pool split the pairs into tiles instead.
+    // The Barnes-Hut backend replaces the pair loop with a quadtree walk, and the particle-mesh backend with a field
+    // solved on a grid.
+    // The kernels return the potential energy of the pairs they visit, which is summed along the way.
+    if (backend == BARNES_HUT) {
+        unsigned long treeInteractions;
+        tree.build(x, y, m, n);
+        tree.accumulateForces(fx, fy, theta, eps2, pool.get(), lastPotential, treeInteractions);
+        metrics.interactions += treeInteractions;
+    } else if (backend == PARTICLE_MESH) {
+        unsigned long meshInteractions;
+        mesh.build(x, y, m, n, pool.get());
+        mesh.accumulateForces(fx, fy, eps2, pool.get(), lastPotential, meshInteractions);
+        metrics.interactions += meshInteractions;
+    } else if (pool && n >= PARALLEL_FORCE_MIN_BODIES) {
+        this->accumulateForcesParallel();
+        metrics.interactions += (unsigned long)n*(n - 1)/2;
+    } else {
+        double U = 0;
+        for (unsigned int i = 0; i < n; i++) {
+            U += accumulateRowForces(x, y, m, fx, fy, i, i + 1, n, eps2);
         }
+        lastPotential = U;
+        if (n > 0) metrics.interactions += (unsigned long)n*(n - 1)/2;
     }
+    metrics.forceEvaluations++;
+
+    // State 3 (records synced): Each Particle record reports the same net force as the state arrays.
+    for (unsigned int i = 0; i < n; i++) {
+        bodies[i].setForce(std::make_pair(fx[i], fy[i]));
+    }
+    forcesCurrent = true;
+    potentialCurrent = true;
 }
 
-void Frame::advanceSingleTimeStep() {
-    // Abstract: Perform all required calculations to move forward by one time step.
-    // Postcondition: Frame.time has been incremented by dt, and the positions and velocities of all Particles
-    //      have been updated to reflect their new state within the Frame.
+void Frame::updateTracerAccelerations() {
+    // Abstract: Evaluate the acceleration of every tracer from the Particles at their current positions. Tracers are
+    //      independent of each other, so each worker simply takes a contiguous range of them; this parallelizes even
+    //      when there are far too few massive bodies for accumulateForcesParallel(), e.g. a planetary system.
+    // Postcondition: tracers.ax/ay match the current positions of the tracers and the Particles.
+    PhaseTimer timer(metricsEnabled ? &metrics.forceSeconds : NULL);
+    const unsigned int n = state.size();
+    const unsigned int M = tracers.size();
+    const double eps2 = softening*softening;
+    const bool parallel = pool && (unsigned long)n*M >= PARALLEL_TRACER_MIN_INTERACTIONS;
+    const unsigned int workers = parallel ? pool->size() : 1;
+    auto part = [&](unsigned int w) {
+        computeTracerAccelerations(state.x.data(), state.y.data(), state.m.data(), n,
+                                   tracers.x.data(), tracers.y.data(), tracers.ax.data(), tracers.ay.data(),
+                                   (unsigned long)M*w/workers, (unsigned long)M*(w + 1)/workers, eps2);
+    };
+    if (parallel) pool->runOnAll(part);
+    else part(0);
+    metrics.interactions += (unsigned long)n*M;
+    tracerAccelerationsCurrent = true;
+}
 
-    // State 1 (forces current): The net force of each Particle has been updated for the current Frame state.
-    this->updateAllForces();
+void Frame::kickDriftTracers(double h) {
+    // Opening half of a kick-drift-kick leapfrog step of length h for every tracer. Split over the same worker
+    // ranges as updateTracerAccelerations(), so each worker streams through the tracers it has just updated.
+    const unsigned int M = tracers.size();
+    const bool parallel = pool && (unsigned long)state.size()*M >= PARALLEL_TRACER_MIN_INTERACTIONS;
+    const unsigned int workers = parallel ? pool->size() : 1;
+    auto part = [&](unsigned int w) {
+        for (unsigned int k = (unsigned long)M*w/workers; k < (unsigned long)M*(w + 1)/workers; k++) {
+            tracers.vx[k] = tracers.vx[k] + h/2*tracers.ax[k];
+            tracers.vy[k] = tracers.vy[k] + h/2*tracers.ay[k];
+            tracers.x[k] = tracers.x[k] + h*tracers.vx[k];
+            tracers.y[k] = tracers.y[k] + h*tracers.vy[k];
+        }
+    };
+    if (parallel) pool->runOnAll(part);
+    else part(0);
+    tracerAccelerationsCurrent = false;
+}
+
+void Frame::kickTracers(double h) {
+    // V_next = V_current + h*a, using the tracer accelerations currently stored.
+    const unsigned int M = tracers.size();
+    const bool parallel = pool && (unsigned long)state.size()*M >= PARALLEL_TRACER_MIN_INTERACTIONS;
+    const unsigned int workers = parallel ? pool->size() : 1;
+    auto part = [&](unsigned int w) {
+        for (unsigned int k = (unsigned long)M*w/workers; k < (unsigned long)M*(w + 1)/workers; k++) {
+            tracers.vx[k] = tracers.vx[k] + h*tracers.ax[k];
+            tracers.vy[k] = tracers.vy[k] + h*tracers.ay[k];
+        }
+    };
+    if (parallel) pool->runOnAll(part);
+    else part(0);
+}
+
+void Frame::setNumThreads(unsigned int n) {
+    // Postcondition: Force evaluation uses n workers (the calling thread included). n == 1 disables the pool.
+    assert (n > 0);
+    numThreads = n;
+    if (n == 1) pool.reset();
+    else pool.reset(new ThreadPool(n));
+    workerFx.assign(n, aligned_vector());
+    workerFy.assign(n, aligned_vector());
+    workerPotential.assign(n, 0);
+}
+
+void Frame::accumulateForcesParallel() {
+    // Abstract: Tiled, multithreaded version of the pair loop in updateAllForces(). Bodies are split into blocks
+    //      and every tile (I, J) with I <= J covers the unique pairs between block I and block J. Tiles are dealt to
+    //      workers round-robin, each worker accumulating into its own force arrays, and the per-worker arrays are
+    //      then summed in worker order. Both the tile-to-worker mapping and the summation order depend only on the
+    //      number of bodies and workers, so the result is bitwise reproducible for a fixed thread count.
+    // Postcondition: state.fx and state.fy hold the net force on every body, and lastPotential the total potential
+    //      energy (likewise summed in worker order).
+    const unsigned int n = state.size();
+    const unsigned int workers = pool->size();
+
+    // Aim for several tiles per worker so the triangle of pairs balances evenly: B blocks give B*(B+1)/2 tiles.
+    // Tiles are kept a multiple of 8 bodies wide so the SIMD kernels run full vectors.
+    unsigned int targetBlocks = (unsigned int)std::ceil(4*std::sqrt((double)workers)) + 1;
+    unsigned int tile = (n + targetBlocks - 1)/targetBlocks;
+    tile = (tile + 7)/8*8;
+    const unsigned int blocks = (n + tile - 1)/tile;
+
+    const double* x = state.x.data();
+    const double* y = state.y.data();
+    const double* m = state.m.data();
+    const double eps2 = softening*softening;
 
-    // State 2 (positions/velocities updated): The position and velocity of each Particle has been updated to
-    // reflect that Particle's state at time = time + dt. This is accomplished via numerical integration.
-    // Generally, with numerical integration, we aim to solve problems of the form dy/dt = f(t, y), where some
-    // conditions are known (either Initial Values, or Boundary Values) and the function f() is known. In our case,
-    // the function f() is not actually known, since we are solving for the Force values at every step rather than
-    // having them all ahead of time. Thus, we are limited to numerical integration methods which depend only on 
-    // the value of f() at the current time step. This precludes the possibility of using RK4, unfortunately.
-    // We will use the Left Box rule, which means we accept an error term in our calculations which is O(k^2), where
-    // k is our timestep size. The two systems of equations we aim to solve are:
+    // State 1 (partial forces): Worker w has accumulated the forces from its tiles into workerFx[w]/workerFy[w].
+    pool->runOnAll([&](unsigned int w) {
+        workerFx[w].assign(n, 0);
+        workerFy[w].assign(n, 0);
+        double* fx = workerFx[w].data();
+        double* fy = workerFy[w].data();
+        double U = 0;
+        unsigned int t = 0;
+        for (unsigned int I = 0; I < blocks; I++) {
+            for (unsigned int J = I; J < blocks; J++, t++) {
+                if (t % workers != w) continue;
+                unsigned int iEnd = std::min(n, (I + 1)*tile);
+                unsigned int jEnd = std::min(n, (J + 1)*tile);
+                for (unsigned int i = I*tile; i < iEnd; i++) {
+                    U += accumulateRowForces(x, y, m, fx, fy, i, (I == J) ? i + 1 : J*tile, jEnd, eps2);
+                }
+            }
+        }
+        workerPotential[w] = U;
+    });
+
+    // State 2 (reduced): Every body's net force is the sum of the per-worker partials, always added in worker order.
+    pool->runOnAll([&](unsigned int w) {
+        unsigned int iBegin = (unsigned long)n*w/workers;
+        unsigned int iEnd = (unsigned long)n*(w + 1)/workers;
+        for (unsigned int i = iBegin; i < iEnd; i++) {
+            double Fx = 0;
+            double Fy = 0;
+            for (unsigned int v = 0; v < workers; v++) {
+                Fx += workerFx[v][i];
+                Fy += workerFy[v][i];
+            }
+            state.fx[i] = Fx;
+            state.fy[i] = Fy;
+        }
+    });
+    lastPotential = 0;
+    for (unsigned int w = 0; w < workers; w++) {
+        lastPotential += workerPotential[w];
+    }
+}
+
+void Frame::advanceSingleTimeStep() {
+    // Abstract: Perform all required calculations to move forward by one time step, of length dt unless the
+    //      TimeStepPolicy is ADAPTIVE_STEP.
+    // Postcondition: Frame.time has been incremented by the step size h, and the positions and velocities of all
+    //      Particles have been updated to reflect their new state within the Frame.
+
+    // State 1 (positions/velocities updated): The position and velocity of each Particle has been updated to
+    // reflect that Particle's state at time = time + h. This is accomplished via numerical integration of
     //      1x) dx/dt = V_x         1y) dy/dt = V_y
     //      2x) dV_x/dt = F_x/m     2y) dV_y/dt = F_y/m
+    // where the forces are not known ahead of time but can be evaluated for any set of positions by
+    // updateAllForces(). Every scheme below is built from that one operation.
+    // With metrics enabled the step is timed in phases; force evaluations time themselves, so their share is taken
+    // back out of the integration time.
+    const double forceSecondsBefore = metrics.forceSeconds;
+    const bool detectCollisions = (collisionResponse == COLLISION_MERGE || collisionResponse == COLLISION_BOUNCE);
+    double h = dt;
+    {
+        PhaseTimer timer(metricsEnabled ? &metrics.integrateSeconds : NULL);
+        if (stepPolicy.mode == ADAPTIVE_STEP) h = this->chooseAdaptiveStep();
+        if (detectCollisions) {
+            stepStartX.assign(state.x.begin(), state.x.end());
+            stepStartY.assign(state.y.begin(), state.y.end());
+        }
+        // Tracers take a kick-drift-kick leapfrog step whatever the integrator: the bodies are only known at the start
+        // and end of the step, which is exactly what that scheme needs. Here they open it in the starting field.
+        if (tracers.size() > 0) {
+            if (!tracerAccelerationsCurrent) this->updateTracerAccelerations();
+            this->kickDriftTracers(h);
+        }
+        if (stepPolicy.mode == BLOCK_STEPS) {
+            this->stepBlocks();
+        } else {
+            switch (integrator) {
+            case LEFT_BOX_EULER:
+                this->stepLeftBoxEuler(h);
+                break;
+            case VELOCITY_VERLET:
+                this->stepVelocityVerlet(h);
+                break;
+            case YOSHIDA_4: {
+                // Triple-jump composition of leapfrog steps (Forest & Ruth 1990, Yoshida 1990). The negative middle
+                // weight steps backwards in time, cancelling the leading error terms of the outer two steps.
+                const double w1 = 1/(2 - std::cbrt(2.0));
+                const double w0 = 1 - 2*w1;
+                this->stepVelocityVerlet(w1*h);
+                this->stepVelocityVerlet(w0*h);
+                this->stepVelocityVerlet(w1*h);
+                break;
+            }
+            case RUNGE_KUTTA_4:
+                this->stepRungeKutta4(h);
+                break;
+            case WISDOM_HOLMAN:
+                this->stepWisdomHolman(h);
+                break;
+            }
+        }
+        // Any bodies that touched during the step are merged or bounced before the step is recorded.
+        if (detectCollisions) this->resolveCollisions(h);
+        // An adaptive step ends with the accelerations at the new positions, which give the next step's timescales
+        // and are reused by every scheme except Wisdom-Holman to open it.
+        if (stepPolicy.mode == ADAPTIVE_STEP && timescalesCurrent) {
+            if (!forcesCurrent) this->updateAllForces();
+            this->updateTimescales(h);
+        }
+        // Tracers close their leapfrog step in the field of the bodies' final positions. Those accelerations are
+        // reused to open the next step.
+        if (tracers.size() > 0) {
+            this->updateTracerAccelerations();
+            this->kickTracers(h/2);
+        }
+    }
+    if (metricsEnabled) metrics.integrateSeconds -= metrics.forceSeconds - forceSecondsBefore;
+
+    {
+        PhaseTimer timer(metricsEnabled ? &metrics.ioSeconds : NULL);
+        this->recordHistory();
+    }
+
+    // State 2 (time incremented): The frame time has been increased by the amount of the time step.
+    time = time + h;
+    lastStep = h;
+    stepCount++;
+    stepTimes.add(std::make_pair(time, h));
+
+    // State 3 (output queued): If a trajectory is being streamed, this step's state has been handed to its writer,
+    // and if live state is being published and a snapshot is due, it has been handed to the readers. If a periodic
+    // checkpoint is due (and the previous one has finished writing) it has been started. With metrics enabled, a due
+    // sample of the conserved quantities has been taken and logged.
+    {
+        PhaseTimer timer(metricsEnabled ? &metrics.ioSeconds : NULL);
+        if (writer && stepCount % writerStride == 0) {
+            this->pushToWriter();
+        }
+        if (publisher && stepCount % publisherStride == 0) {
+            this->pushToPublisher();
+        }
+        if (checkpointer && stepCount % checkpointStride == 0 && checkpointer->readyForNext()) {
+            this->buildCheckpointImage(checkpointBuffer);
+            checkpointer->submit(checkpointBuffer);
+        }
+    }
+    if (metricsEnabled && stepCount % metricsStride == 0) {
+        this->sampleConservedQuantities();
+        PhaseTimer timer(&metrics.ioSeconds);
+        if (metricsLog) metricsLog->write(time, metrics);
+    }
+}
+
+void Frame::kick(double h) {
+    // V_next = V_current + h*F/m, using the forces currently in the state arrays.
+    const unsigned int n = state.size();
+    for (unsigned int i = 0; i < n; i++) {
+        state.vx[i] = state.vx[i] + h*state.fx[i]/state.m[i];
+        state.vy[i] = state.vy[i] + h*state.fy[i]/state.m[i];
+    }
+}
+
+void Frame::drift(double h) {
+    // P_next = P_current + h*V_current. The forces no longer match the positions afterwards.
+    const unsigned int n = state.size();
+    for (unsigned int i = 0; i < n; i++) {
+        state.x[i] = state.x[i] + h*state.vx[i];
+        state.y[i] = state.y[i] + h*state.vy[i];
+    }
+    forcesCurrent = false;
+}
+
+void Frame::stepLeftBoxEuler(double h) {
+    // Left Box rule on the velocities, after which the positions are advanced with the new velocities
+    // (semi-implicit Euler). The error term is O(k^2) per step, where k is the timestep size.
+    if (!forcesCurrent) this->updateAllForces();
+    this->kick(h);
+    this->drift(h);
+}
+
+void Frame::stepVelocityVerlet(double h) {
+    // Kick-drift-kick leapfrog: half kick with the forces at the current positions, full drift, then a half kick with
+    // the forces at the new positions. Those closing forces are still current at the start of the next step, so
+    // after the first step this costs a single force evaluation.
+    if (!forcesCurrent) this->updateAllForces();
+    this->kick(h/2);
+    this->drift(h);
+    this->updateAllForces();
+    this->kick(h/2);
+}
+
+void Frame::stepRungeKutta4(double h) {
+    // Classic fourth-order Runge-Kutta on (position, velocity). Stage k evaluates the slope (V, F/m) at
+    // start + c_k*h*(previous slope), which means moving the state arrays to the stage positions and re-running
+    // the force backend there. The slopes are accumulated with weights 1/6, 1/3, 1/3, 1/6.
+    const unsigned int n = state.size();
+    stageStart = state;
+    stageSum.x.assign(n, 0);
+    stageSum.y.assign(n, 0);
+    stageSum.vx.assign(n, 0);
+    stageSum.vy.assign(n, 0);
+
+    const double stageOffset[4] = {0, h/2, h/2, h};
+    const double stageWeight[4] = {h/6, h/3, h/3, h/6};
+    for (unsigned int k = 0; k < 4; k++) {
+        // State k.1 (stage state): The state arrays hold start + stageOffset[k]*(slope of stage k-1).
+        if (k > 0) {
+            for (unsigned int i = 0; i < n; i++) {
+                double ax = state.fx[i]/state.m[i];
+                double ay = state.fy[i]/state.m[i];
+                state.x[i] = stageStart.x[i] + stageOffset[k]*state.vx[i];
+                state.y[i] = stageStart.y[i] + stageOffset[k]*state.vy[i];
+                state.vx[i] = stageStart.vx[i] + stageOffset[k]*ax;
+                state.vy[i] = stageStart.vy[i] + stageOffset[k]*ay;
+            }
+        }
+        // State k.2 (stage slope): Forces, and hence the slope (V, F/m), are known at the stage state. Forces
+        // still current at the start of the step are reused for the first stage.
+        if (k > 0 || !forcesCurrent) this->updateAllForces();
+        for (unsigned int i = 0; i < n; i++) {
+            stageSum.x[i] += stageWeight[k]*state.vx[i];
+            stageSum.y[i] += stageWeight[k]*state.vy[i];
+            stageSum.vx[i] += stageWeight[k]*state.fx[i]/state.m[i];
+            stageSum.vy[i] += stageWeight[k]*state.fy[i]/state.m[i];
+        }
+    }
 
-    for (particle_itr itr = particles.begin(); itr != particles.end(); itr++ ) {
-        // Left Box Rule: V_next = V_current + dt*f(t)
-        // f(t) = F/m
-        // Equations 2x and 2y solved
-        std::pair<double, double> V_next = std::make_pair(0, 0);
-        V_next.first = itr->second.getCurrentVel().first + (this->dt)*(itr->second.getNetForce().first)/(itr->second.getMass());
-        V_next.second = itr->second.getCurrentVel().second + (this->dt)*(itr->second.getNetForce().second)/(itr->second.getMass());
-        itr->second.addVel(V_next);
+    for (unsigned int i = 0; i < n; i++) {
+        state.x[i] = stageStart.x[i] + stageSum.x[i];
+        state.y[i] = stageStart.y[i] + stageSum.y[i];
+        state.vx[i] = stageStart.vx[i] + stageSum.vx[i];
+        state.vy[i] = stageStart.vy[i] + stageSum.vy[i];
+    }
+    forcesCurrent = false;
+}
+
+void Frame::stepWisdomHolman(double h) {
+    // Abstract: Wisdom-Holman map in democratic heliocentric coordinates (Duncan, Levison & Lee 1998). The
+    //      Hamiltonian is split into Kepler motion of each body about the central (most massive) one, the mutual
+    //      interactions of the non-central bodies, and a "jump" term from the central body's reflex motion. Kepler
+    //      motion is solved exactly, so the step size only has to resolve the interactions, not the orbits.
+    //      The central-body interactions are already inside the Kepler part and are not evaluated as forces.
+    // Postcondition: The state arrays hold inertial positions and velocities at time + h.
+    const unsigned int n = state.size();
+    if (n < 2) {
+        this->drift(h);
+        return;
+    }
+
+    // State 1 (coordinates changed): For every non-central body i, the state arrays hold its heliocentric position
+    // Q_i = x_i - x_c and barycentric velocity V_i = v_i - v_cm. The central body sits at the origin.
+    unsigned int c = std::max_element(state.m.begin(), state.m.end()) - state.m.begin();
+    double M = 0, Mx = 0, My = 0, Mvx = 0, Mvy = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        M += state.m[i];
+        Mx += state.m[i]*state.x[i];
+        My += state.m[i]*state.y[i];
+        Mvx += state.m[i]*state.vx[i];
+        Mvy += state.m[i]*state.vy[i];
+    }
+    const double cmX = Mx/M, cmY = My/M, cmVx = Mvx/M, cmVy = Mvy/M;
+    const double xc = state.x[c], yc = state.y[c];
+    for (unsigned int i = 0; i < n; i++) {
+        state.x[i] -= xc;
+        state.y[i] -= yc;
+        state.vx[i] -= cmVx;
+        state.vy[i] -= cmVy;
+    }
+
+    // State 2 (stepped): interaction kick, jump, Kepler drift, jump, interaction kick.
+    const double mu = G*state.m[c];
+    this->interactionKick(h/2, c);
+    this->jump(h/2, c);
+    auto keplerPart = [&](unsigned int w) {
+        unsigned int workers = pool ? pool->size() : 1;
+        for (unsigned int i = (unsigned long)n*w/workers; i < (unsigned long)n*(w + 1)/workers; i++) {
+            if (i == c) continue;
+            bool converged = keplerDrift(mu, h, state.x[i], state.y[i], state.vx[i], state.vy[i]);
+            assert (converged);
+            (void)converged;
+        }
+    };
+    if (pool) pool->runOnAll(keplerPart);
+    else keplerPart(0);
+    this->jump(h/2, c);
+    this->interactionKick(h/2, c);
+
+    // State 3 (coordinates restored): The centre of mass has moved uniformly, the central body sits where the
+    // heliocentric positions put the centre of mass, and its velocity balances the others' barycentric momentum.
+    double SmQx = 0, SmQy = 0, Px = 0, Py = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        if (i == c) continue;
+        SmQx += state.m[i]*state.x[i];
+        SmQy += state.m[i]*state.y[i];
+        Px += state.m[i]*state.vx[i];
+        Py += state.m[i]*state.vy[i];
+    }
+    const double newXc = cmX + h*cmVx - SmQx/M;
+    const double newYc = cmY + h*cmVy - SmQy/M;
+    for (unsigned int i = 0; i < n; i++) {
+        if (i == c) continue;
+        state.x[i] += newXc;
+        state.y[i] += newYc;
+        state.vx[i] += cmVx;
+        state.vy[i] += cmVy;
+    }
+    state.x[c] = newXc;
+    state.y[c] = newYc;
+    state.vx[c] = cmVx - Px/state.m[c];
+    state.vy[c] = cmVy - Py/state.m[c];
+    forcesCurrent = false;
+}
+
+void Frame::interactionKick(double h, unsigned int central) {
+    // Kick every non-central body by its mutual interactions. Forces are translation invariant, so the selected
+    // force backend can run directly on the heliocentric positions; giving the central body zero mass for the
+    // duration removes its (Keplerian) contribution.
+    const double centralMass = state.m[central];
+    state.m[central] = 0;
+    this->updateAllForces();
+    state.m[central] = centralMass;
+    for (unsigned int i = 0; i < state.size(); i++) {
+        if (i == central) continue;
+        state.vx[i] += h*state.fx[i]/state.m[i];
+        state.vy[i] += h*state.fy[i]/state.m[i];
+    }
+    forcesCurrent = false;
+}
+
+void Frame::jump(double h, unsigned int central) {
+    // Drift every heliocentric position by the total barycentric momentum of the non-central bodies over m_c, which
+    // is minus the central body's own barycentric (reflex) velocity.
+    double Px = 0, Py = 0;
+    for (unsigned int i = 0; i < state.size(); i++) {
+        if (i == central) continue;
+        Px += state.m[i]*state.vx[i];
+        Py += state.m[i]*state.vy[i];
+    }
+    for (unsigned int i = 0; i < state.size(); i++) {
+        if (i == central) continue;
+        state.x[i] += h*Px/state.m[central];
+        state.y[i] += h*Py/state.m[central];
+    }
+}
+
+double Frame::chooseAdaptiveStep() {
+    // Abstract: Size the next shared step as eta times the shortest timescale of any body, estimating the timescales
+    //      first if the bodies have changed since the last step. The step may at most double from one step to the
+    //      next, so a single smooth stretch of the orbits cannot throw the step far ahead of the estimate.
+    // Postcondition: Forces are current, stepStartAx/Ay hold every body's acceleration, and the result lies in
+    //      [minDt, dt].
+    if (!forcesCurrent) this->updateAllForces();
+    if (!timescalesCurrent) this->estimateTimescales(stepPolicy.minDt);
+    const unsigned int n = state.size();
+    double shortest = std::numeric_limits<double>::infinity();
+    for (unsigned int i = 0; i < n; i++) {
+        shortest = std::min(shortest, timescales[i]);
+        stepStartAx[i] = state.fx[i]/state.m[i];
+        stepStartAy[i] = state.fy[i]/state.m[i];
+    }
+    double h = std::min(dt, stepPolicy.eta*shortest);
+    if (lastStep > 0) h = std::min(h, 2*lastStep);
+    return std::max(h, stepPolicy.minDt);
+}
+
+void Frame::estimateTimescales(double h) {
+    // Abstract: Estimate every body's timescale without a previous step to difference against, by drifting the
+    //      positions ahead by h along the current velocities and evaluating the forces there. The trial positions
+    //      and forces are then discarded.
+    // Precondition: forcesCurrent.
+    // Postcondition: timescales, stepStartAx/Ay and levels are sized for the current bodies, timescalesCurrent is
+    //      true, and the state arrays (forces included) are as they were.
+    assert (forcesCurrent);
+    const unsigned int n = state.size();
+    timescales.assign(n, 0);
+    levels.assign(n, 0);
+    stepStartAx.resize(n);
+    stepStartAy.resize(n);
+    for (unsigned int i = 0; i < n; i++) {
+        stepStartAx[i] = state.fx[i]/state.m[i];
+        stepStartAy[i] = state.fy[i]/state.m[i];
+    }
+    stageStart = state;     // the RK4 scratch is free between steps
+    const double potential = lastPotential;
+    for (unsigned int i = 0; i < n; i++) {
+        state.x[i] += h*state.vx[i];
+        state.y[i] += h*state.vy[i];
+    }
+    this->updateAllForces();
+    timescalesCurrent = true;
+    this->updateTimescales(h);
+    state = stageStart;
+    lastPotential = potential;
+    for (unsigned int i = 0; i < n; i++) {
+        bodies[i].setForce(std::make_pair(state.fx[i], state.fy[i]));
+    }
+}
 
-        // P_next = P_current + dt*f(t)
-        // f(t) = V
-        // Equations 1x and 1y solved
-        std::pair<double, double> P_next = std::make_pair(0, 0);
-        P_next.first = itr->second.getCurrentPos().first + (this->dt)*(itr->second.getCurrentVel().first);
-        P_next.second = itr->second.getCurrentPos().second + (this->dt)*(itr->second.getCurrentVel().second);
-        itr->second.addPos(P_next);
+void Frame::updateTimescales(double h) {
+    // Postcondition: timescales[i] = |a|/|da/dt| for every body, with a the acceleration in the state arrays and
+    //      da/dt its change from stepStartAx/Ay over the h since then. A body whose acceleration is not changing has
+    //      an infinite timescale.
+    const unsigned int n = state.size();
+    for (unsigned int i = 0; i < n; i++) {
+        const double ax = state.fx[i]/state.m[i];
+        const double ay = state.fy[i]/state.m[i];
+        const double jerk = std::hypot(ax - stepStartAx[i], ay - stepStartAy[i])/h;
+        timescales[i] = (jerk > 0) ? std::hypot(ax, ay)/jerk : std::numeric_limits<double>::infinity();
     }
+}
+
+unsigned int Frame::levelForTimescale(double timescale) const {
+    // Shallowest block level whose sub-step dt/2^k is at most eta*timescale, or maxLevel if none is.
+    unsigned int k = 0;
+    while (k < stepPolicy.maxLevel && dt/(double)(1ul << k) > stepPolicy.eta*timescale) k++;
+    return k;
+}
+
+void Frame::stepBlocks() {
+    // Abstract: Advance every body by dt with hierarchical block time steps (McMillan 1986; Makino 1991), using
+    //      the kick-drift-kick leapfrog per body. The step dt is split into 2^maxLevel ticks, and a body on level k
+    //      takes sub-steps of 2^(maxLevel - k) ticks, each starting at a multiple of its own length, so the bodies
+    //      that finish a sub-step together always form a nested hierarchy. All positions are drifted together from
+    //      one sub-step end to the next; only the bodies that end a sub-step there need new forces, and those are
+    //      evaluated against every body's current (drifted) position. A tightly bound pair can so take thousands of
+    //      sub-steps while the rest of the system takes one.
+    //      After each sub-step a body moves to the level its new timescale asks for. It may go deeper at any time,
+    //      but only one level shallower per sub-step, and only when the longer sub-step would start on a multiple of
+    //      its length.
+    // Postcondition: All bodies are synchronized at time + dt with current forces.
+    assert (collisionResponse != COLLISION_MERGE && collisionResponse != COLLISION_BOUNCE);
+    const unsigned int n = state.size();
+    if (n == 0) return;
+    const unsigned int L = stepPolicy.maxLevel;
+    const unsigned long ticks = 1ul << L;
+    const double tick = dt/ticks;
+    if (!forcesCurrent) this->updateAllForces();
+    if (!timescalesCurrent) this->estimateTimescales(tick);
+
+    // State 1 (opened): Every body is on the level its timescale asks for (within the same one-level limit) and has
+    // taken the opening half kick of its first sub-step, with stepStartAx/Ay holding the acceleration it used.
+    for (unsigned int i = 0; i < n; i++) {
+        levels[i] = std::max((levels[i] > 0) ? levels[i] - 1 : 0, this->levelForTimescale(timescales[i]));
+        stepStartAx[i] = state.fx[i]/state.m[i];
+        stepStartAy[i] = state.fy[i]/state.m[i];
+        const double h = dt/(double)(1ul << levels[i]);
+        state.vx[i] += h/2*stepStartAx[i];
+        state.vy[i] += h/2*stepStartAy[i];
+    }
+
+    // State 2 (sub-stepped): Repeatedly drift to the next tick at which any sub-step ends, then close those sub-steps
+    // with a half kick in the forces there and, unless the block is over, open their next ones.
+    unsigned long t = 0;
+    while (t < ticks) {
+        const unsigned int deepest = *std::max_element(levels.begin(), levels.end());
+        const unsigned long span = ticks >> deepest;
+        const unsigned long next = (t/span + 1)*span;
+        this->drift((next - t)*tick);
+        t = next;
+
+        activeSlots.clear();
+        for (unsigned int i = 0; i < n; i++) {
+            if (t % (ticks >> levels[i]) == 0) activeSlots.push_back(i);
+        }
+        if (activeSlots.size() == n) this->updateAllForces();
+        else this->updateActiveForces();
+
+        // The shallowest level a sub-step starting at tick t can be on.
+        unsigned int aligned = L;
+        while (aligned > 0 && t % (ticks >> (aligned - 1)) == 0) aligned--;
+        for (unsigned int a = 0; a < activeSlots.size(); a++) {
+            const unsigned int i = activeSlots[a];
+            const double ax = state.fx[i]/state.m[i];
+            const double ay = state.fy[i]/state.m[i];
+            const double h = dt/(double)(1ul << levels[i]);
+            state.vx[i] += h/2*ax;
+            state.vy[i] += h/2*ay;
+            const double jerk = std::hypot(ax - stepStartAx[i], ay - stepStartAy[i])/h;
+            timescales[i] = (jerk > 0) ? std::hypot(ax, ay)/jerk : std::numeric_limits<double>::infinity();
+            if (t == ticks) continue;
+            const unsigned int shallowest = std::max(aligned, (levels[i] > 0) ? levels[i] - 1 : 0);
+            levels[i] = std::max(shallowest, this->levelForTimescale(timescales[i]));
+            const double hNext = dt/(double)(1ul << levels[i]);
+            stepStartAx[i] = ax;
+            stepStartAy[i] = ay;
+            state.vx[i] += hNext/2*ax;
+            state.vy[i] += hNext/2*ay;
+        }
+    }
+}
+
+void Frame::updateActiveForces() {
+    // Abstract: Like updateAllForces(), but only for the bodies in activeSlots: each gets the net force of every other
+    //      body at the current positions. Direct summation runs the selected row kernel for each active body over all
+    //      the others. The kernel also applies each pair's reaction to the other body; those are accumulated into the
+    //      worker's scratch arrays and discarded. Barnes-Hut rebuilds the tree and walks it for the active bodies, and
+    //      the particle-mesh backend solves the whole mesh but samples it only for them.
+    // Postcondition: state.fx/fy hold the new forces of the active bodies; every other entry is unchanged, so the
+    //      forces as a whole are not current. Each active body's force is computed by a single worker, so it does
+    //      not depend on the number of threads (except through the mesh, whose deposit is summed per worker).
+    PhaseTimer timer(metricsEnabled ? &metrics.forceSeconds : NULL);
+    const unsigned int n = state.size();
+    const unsigned int A = activeSlots.size();
+    const double eps2 = softening*softening;
+    const double* x = state.x.data();
+    const double* y = state.y.data();
+    const double* m = state.m.data();
+    if (backend == BARNES_HUT || backend == PARTICLE_MESH) {
+        activeMask.assign(n, 0);
+        for (unsigned int a = 0; a < A; a++) {
+            activeMask[activeSlots[a]] = 1;
+            state.fx[activeSlots[a]] = 0;
+            state.fy[activeSlots[a]] = 0;
+        }
+        double unusedPotential;
+        unsigned long approximateInteractions;
+        if (backend == BARNES_HUT) {
+            tree.build(x, y, m, n);
+            tree.accumulateForces(state.fx.data(), state.fy.data(), theta, eps2, pool.get(), unusedPotential,
+                                  approximateInteractions, activeMask.data());
+        } else {
+            mesh.build(x, y, m, n, pool.get());
+            mesh.accumulateForces(state.fx.data(), state.fy.data(), eps2, pool.get(), unusedPotential,
+                                  approximateInteractions, activeMask.data());
+        }
+        metrics.interactions += approximateInteractions;
+    } else {
+        const bool parallel = pool && (unsigned long)A*n >= PARALLEL_ACTIVE_MIN_INTERACTIONS;
+        const unsigned int workers = parallel ? pool->size() : 1;
+        if (workerFx.size() < workers) {
+            workerFx.resize(workers);
+            workerFy.resize(workers);
+        }
+        auto part = [&](unsigned int w) {
+            workerFx[w].assign(n, 0);
+            workerFy[w].assign(n, 0);
+            double* fx = workerFx[w].data();
+            double* fy = workerFy[w].data();
+            for (unsigned int a = (unsigned long)A*w/workers; a < (unsigned long)A*(w + 1)/workers; a++) {
+                const unsigned int i = activeSlots[a];
+                fx[i] = 0;
+                fy[i] = 0;
+                accumulateRowForces(x, y, m, fx, fy, i, 0, i, eps2);
+                accumulateRowForces(x, y, m, fx, fy, i, i + 1, n, eps2);
+                state.fx[i] = fx[i];
+                state.fy[i] = fy[i];
+            }
+        };
+        if (parallel) pool->runOnAll(part);
+        else part(0);
+        metrics.interactions += (unsigned long)A*(n - 1);
+    }
+    metrics.forceEvaluations++;
+    forcesCurrent = false;
+    potentialCurrent = false;
+}
 
-    // State 3 (time incremented): The frame time has been increased by the amount of the time step.
-    time = time + dt;
+void Frame::resolveCollisions(double h) {
+    // Abstract: Find the bodies that touched while moving from stepStartX/Y to their current positions over a step
+    //      of length h, and apply the collision response to them.
+    // Postcondition: No pair found touching is left unresolved. The number of collisions is added to the metrics.
+    collider.detect(stepStartX.data(), stepStartY.data(), state.x.data(), state.y.data(), state.radius.data(),
+                    state.size(), collisions);
+    if (collisions.empty()) return;
+    metrics.collisions += collisions.size();
+    if (collisionResponse == COLLISION_MERGE) this->mergeCollisions();
+    else this->bounceCollisions(h);
+    forcesCurrent = false;
+}
+
+void Frame::mergeCollisions() {
+    // Perfectly inelastic merging, in order of contact. The heavier body of each pair survives and takes the combined
+    // mass, the centre of mass position and velocity (so momentum is conserved exactly), and the radius of the
+    // combined volume. Chains within one step (A hits B, B hits C) all end up in one survivor.
+    const unsigned int n = state.size();
+    std::vector<unsigned int> mergedInto(n);
+    for (unsigned int i = 0; i < n; i++) {
+        mergedInto[i] = i;
+    }
+    auto survivorOf = [&](unsigned int i) {
+        while (mergedInto[i] != i) i = mergedInto[i];
+        return i;
+    };
+    std::vector<std::string> absorbed;
+    for (unsigned int k = 0; k < collisions.size(); k++) {
+        unsigned int a = survivorOf(collisions[k].i);
+        unsigned int b = survivorOf(collisions[k].j);
+        if (a == b) continue;
+        if (state.m[b] > state.m[a] || (state.m[b] == state.m[a] && b < a)) std::swap(a, b);
+        const double M = state.m[a] + state.m[b];
+        state.x[a] = (state.m[a]*state.x[a] + state.m[b]*state.x[b])/M;
+        state.y[a] = (state.m[a]*state.y[a] + state.m[b]*state.y[b])/M;
+        state.vx[a] = (state.m[a]*state.vx[a] + state.m[b]*state.vx[b])/M;
+        state.vy[a] = (state.m[a]*state.vy[a] + state.m[b]*state.vy[b])/M;
+        state.m[a] = M;
+        state.radius[a] = std::cbrt(std::pow(state.radius[a], 3) + std::pow(state.radius[b], 3));
+        bodies[a].setMergedMassAndRadius(state.m[a], state.radius[a]);
+        mergedInto[b] = a;
+        absorbed.push_back(bodies[b].getID());
+    }
+    for (unsigned int k = 0; k < absorbed.size(); k++) {
+        this->removeParticle(absorbed[k]);
+    }
+}
+
+void Frame::bounceCollisions(double h) {
+    // Elastic hard-sphere bounce, in order of contact. At the moment of contact t (a fraction of the step) the
+    // velocity components along the line of centres are exchanged as for two masses colliding head on, and both
+    // bodies finish the step from their contact positions with their new velocities. A body bounces at most once
+    // per step; any further contact is picked up by the next step.
+    std::vector<bool> bounced(state.size(), false);
+    for (unsigned int k = 0; k < collisions.size(); k++) {
+        const unsigned int i = collisions[k].i;
+        const unsigned int j = collisions[k].j;
+        const double t = collisions[k].t;
+        if (bounced[i] || bounced[j]) continue;
+        const double xi = stepStartX[i] + t*(state.x[i] - stepStartX[i]);
+        const double yi = stepStartY[i] + t*(state.y[i] - stepStartY[i]);
+        const double xj = stepStartX[j] + t*(state.x[j] - stepStartX[j]);
+        const double yj = stepStartY[j] + t*(state.y[j] - stepStartY[j]);
+        const double d = std::hypot(xj - xi, yj - yi);
+        if (d == 0) continue;
+        const double nx = (xj - xi)/d, ny = (yj - yi)/d;
+        const double vn = (state.vx[j] - state.vx[i])*nx + (state.vy[j] - state.vy[i])*ny;
+        if (vn >= 0) continue;  // already separating
+        const double J = 2*vn/(state.m[i] + state.m[j]);
+        state.vx[i] += J*state.m[j]*nx;
+        state.vy[i] += J*state.m[j]*ny;
+        state.vx[j] -= J*state.m[i]*nx;
+        state.vy[j] -= J*state.m[i]*ny;
+        state.x[i] = xi + (1 - t)*h*state.vx[i];
+        state.y[i] = yi + (1 - t)*h*state.vy[i];
+        state.x[j] = xj + (1 - t)*h*state.vx[j];
+        state.y[j] = yj + (1 - t)*h*state.vy[j];
+        bounced[i] = true;
+        bounced[j] = true;
+    }
+}
+
+void Frame::recordHistory() {
+    // Append the current contents of the state arrays to each Particle's position/velocity history.
+    for (unsigned int i = 0; i < bodies.size(); i++) {
+        bodies[i].addVel(std::make_pair(state.vx[i], state.vy[i]));
+        bodies[i].addPos(std::make_pair(state.x[i], state.y[i]));
+    }
+}
+
+bool Frame::streamTrajectory(const std::string& filename, unsigned int everyNSteps) {
+    // Abstract: Start streaming the state of every Particle to a binary trajectory file (see trajectoryWriter.h)
+    //      every everyNSteps steps, beginning with the current state. Pair this with HistoryPolicy::currentOnly() to
+    //      keep memory flat on long runs. Any trajectory already being streamed is closed first.
+    // Postcondition: Returns whether the file could be opened.
+    assert (everyNSteps > 0);
+    this->closeTrajectory();
+    std::vector<std::string> IDs;
+    for (unsigned int i = 0; i < bodies.size(); i++) {
+        IDs.push_back(bodies[i].getID());
+    }
+    std::vector<double> masses(state.m.begin(), state.m.end());
+    writer.reset(new TrajectoryWriter(filename, dt, IDs, masses));
+    if (!writer->isOpen()) {
+        writer.reset();
+        return false;
+    }
+    writerStride = everyNSteps;
+    writerIDs = IDs;
+    writerRemapped = false;
+    writer->push(time, state.x.data(), state.y.data(), state.vx.data(), state.vy.data());
+    return true;
+}
+
+void Frame::pushToWriter() {
+    // Queue the current state to the writer. Until a Particle is removed the columns are the slots themselves and
+    // the state arrays are handed over as they are; afterwards each column is gathered from its Particle's slot.
+    if (!writerRemapped) {
+        writer->push(time, state.x.data(), state.y.data(), state.vx.data(), state.vy.data());
+        return;
+    }
+    const double removed = std::numeric_limits<double>::quiet_NaN();
+    for (unsigned int c = 0; c < writerSlots.size(); c++) {
+        unsigned int i = writerSlots[c];
+        writerRecord.x[c] = (i == WRITER_COLUMN_REMOVED) ? removed : state.x[i];
+        writerRecord.y[c] = (i == WRITER_COLUMN_REMOVED) ? removed : state.y[i];
+        writerRecord.vx[c] = (i == WRITER_COLUMN_REMOVED) ? removed : state.vx[i];
+        writerRecord.vy[c] = (i == WRITER_COLUMN_REMOVED) ? removed : state.vy[i];
+    }
+    writer->push(time, writerRecord.x.data(), writerRecord.y.data(), writerRecord.vx.data(), writerRecord.vy.data());
+}
+
+void Frame::remapWriterColumns() {
+    // Postcondition: writerSlots[c] is the slot of the Particle streamed in column c, or WRITER_COLUMN_REMOVED.
+    const unsigned int columns = writerIDs.size();
+    writerSlots.resize(columns);
+    for (unsigned int c = 0; c < columns; c++) {
+        const_particle_itr itr = particles.find(writerIDs[c]);
+        writerSlots[c] = (itr == particles.end()) ? WRITER_COLUMN_REMOVED : itr->second;
+    }
+    writerRecord.x.resize(columns);
+    writerRecord.y.resize(columns);
+    writerRecord.vx.resize(columns);
+    writerRecord.vy.resize(columns);
+    writerRemapped = true;
+}
+
+void Frame::closeTrajectory() {
+    // Postcondition: Every queued sample has been written and the trajectory file is closed.
+    if (writer) writer->close();
+    writer.reset();
+}
+
+std::shared_ptr<StatePublisher> Frame::publishState(unsigned int everyNSteps, unsigned int maxReaders) {
+    // Abstract: Publish a snapshot of the bodies' state after every everyNSteps-th step, for up to maxReaders reader
+    //      threads to sample through a StateReader (see statePublisher.h). Readers never block the step loop or each
+    //      other. Any publisher already attached is replaced; its readers keep their last snapshot.
+    // Postcondition: Returns the new publisher, to be handed to the readers.
+    assert (everyNSteps > 0);
+    publisher = std::make_shared<StatePublisher>(maxReaders);
+    publisherStride = everyNSteps;
+    return publisher;
+}
+
+void Frame::pushToPublisher() {
+    // Hand the current state to the publisher, first rebuilding the shared list of IDs if the bodies have changed.
+    if (!publishedIDs) {
+        std::shared_ptr<std::vector<std::string>> IDs = std::make_shared<std::vector<std::string>>();
+        IDs->reserve(bodies.size());
+        for (unsigned int i = 0; i < bodies.size(); i++) {
+            IDs->push_back(bodies[i].getID());
+        }
+        publishedIDs = IDs;
+    }
+    publisher->publish(time, stepCount, state.size(), state.m.data(), state.x.data(), state.y.data(), state.vx.data(),
+                       state.vy.data(), publishedIDs);
+}
+
+void Frame::stopPublishing() {
+    // Postcondition: No more snapshots are published. Attached readers keep the publisher alive and can still read
+    //      the last snapshot they took.
+    publisher.reset();
+}
+
+void Frame::buildCheckpointImage(std::vector<char>& image) const {
+    // Postcondition: image holds a complete snapshot of the Frame in the layout described in checkpoint.h.
+    const unsigned int n = state.size();
+    const unsigned int M = tracers.size();
+    CheckpointHeader header;
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_FORMAT_VERSION;
+    header.numBodies = n;
+    header.time = time;
+    header.dt = dt;
+    header.stepCount = stepCount;
+    header.integrator = integrator;
+    header.backend = backend;
+    header.theta = theta;
+    header.forcesCurrent = forcesCurrent;
+    header.historyStride = history.stride;
+    header.historyCapacity = history.capacity;
+    header.collisionResponse = collisionResponse;
+    header.softening = softening;
+    header.numTracers = M;
+    header.timeStepMode = stepPolicy.mode;
+    header.eta = stepPolicy.eta;
+    header.minDt = stepPolicy.minDt;
+    header.maxLevel = stepPolicy.maxLevel;
+    header.meshCells = mesh.numCells();
+    header.lastStep = lastStep;
+    header.meshShortRange = mesh.usesShortRangeCorrection();
+    header.timescalesCurrent = timescalesCurrent;
+
+    std::size_t IDBytes = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        IDBytes += sizeof(std::uint32_t) + bodies[i].getID().size();
+    }
+    for (unsigned int k = 0; k < M; k++) {
+        IDBytes += sizeof(std::uint32_t) + tracerIDs[k].size();
+    }
+    const unsigned int scaled = timescalesCurrent ? n : 0;
+    image.resize(sizeof(header) + (8*(std::size_t)n + 4*(std::size_t)M + 2*(std::size_t)scaled)*sizeof(double)
+                 + IDBytes);
+    char* out = image.data();
+    std::memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    const aligned_vector* arrays[8] = {&state.x, &state.y, &state.vx, &state.vy, &state.m, &state.fx, &state.fy,
+                                       &state.radius};
+    for (unsigned int a = 0; a < 8; a++) {
+        std::memcpy(out, arrays[a]->data(), n*sizeof(double));
+        out += n*sizeof(double);
+    }
+    const aligned_vector* tracerArrays[4] = {&tracers.x, &tracers.y, &tracers.vx, &tracers.vy};
+    for (unsigned int a = 0; a < 4; a++) {
+        std::memcpy(out, tracerArrays[a]->data(), M*sizeof(double));
+        out += M*sizeof(double);
+    }
+    // Levels are whole numbers, so they are stored exactly as doubles and keep the IDs after them aligned.
+    for (unsigned int i = 0; i < scaled; i++) {
+        const double level = levels[i];
+        std::memcpy(out + i*sizeof(double), &timescales[i], sizeof(double));
+        std::memcpy(out + (scaled + i)*sizeof(double), &level, sizeof(double));
+    }
+    out += 2*(std::size_t)scaled*sizeof(double);
+    for (unsigned int i = 0; i < n + M; i++) {
+        const std::string& ID = (i < n) ? bodies[i].getID() : tracerIDs[i - n];
+        std::uint32_t length = ID.size();
+        std::memcpy(out, &length, sizeof(length));
+        std::memcpy(out + sizeof(length), ID.data(), length);
+        out += sizeof(length) + length;
+    }
+}
+
+bool Frame::saveCheckpoint(const std::string& filename) const {
+    // Synchronously write a snapshot of the Frame. Returns whether it reached the disk.
+    std::vector<char> image;
+    this->buildCheckpointImage(image);
+    return writeFileAtomically(filename, image);
+}
+
+bool Frame::restoreCheckpoint(const std::string& filename) {
+    // Abstract: Replace the contents of this Frame with a snapshot written by saveCheckpoint() or setAutoCheckpoint().
+    //      The file is memory mapped and the state arrays are copied straight out of the mapping. Settings that are
+    //      part of the simulation (dt, integrator, force backend, history and time step policies) come from the
+    //      snapshot; the thread count is left as configured on this machine. Histories restart at the snapshot's
+    //      step, so earlier samples are not restored, and any trajectory being streamed is closed.
+    // Postcondition: Returns false, leaving the Frame untouched, if filename is not a valid checkpoint.
+    MappedFile file(filename);
+    if (!file.isOpen() || file.size() < sizeof(CheckpointHeader)) return false;
+    CheckpointHeader header;
+    std::memcpy(&header, file.bytes(), sizeof(header));
+    const unsigned int n = header.numBodies;
+    const unsigned int M = header.numTracers;
+    const unsigned int scaled = header.timescalesCurrent ? n : 0;
+    if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) || header.version != CHECKPOINT_FORMAT_VERSION
+            || file.size() < sizeof(header) + (8*(std::size_t)n + 4*(std::size_t)M + 2*(std::size_t)scaled)
+                             *sizeof(double)) {
+        return false;
+    }
+    if (!(header.dt > 0) || header.historyStride == 0 || header.integrator > WISDOM_HOLMAN
+            || header.backend > PARTICLE_MESH || header.collisionResponse > COLLISION_SOFTEN
+            || header.timeStepMode > BLOCK_STEPS || header.maxLevel > 30 || header.meshCells < 16
+            || (header.meshCells & (header.meshCells - 1))) {
+        return false;
+    }
+
+    // State 1 (IDs read): Every ID is in bounds of the mapping. IDs[0..n) name the Particles, IDs[n..n+M) the tracers.
+    const char* arrays = file.bytes() + sizeof(header);
+    const char* tracerArrays = arrays + 8*(std::size_t)n*sizeof(double);
+    const char* scaleArrays = tracerArrays + 4*(std::size_t)M*sizeof(double);
+    const char* cursor = scaleArrays + 2*(std::size_t)scaled*sizeof(double);
+    const char* end = file.bytes() + file.size();
+    std::vector<std::string> IDs(n + M);
+    for (unsigned int i = 0; i < n + M; i++) {
+        std::uint32_t length;
+        if (end - cursor < (long)sizeof(length)) return false;
+        std::memcpy(&length, cursor, sizeof(length));
+        cursor += sizeof(length);
+        if ((std::size_t)(end - cursor) < length) return false;
+        IDs[i].assign(cursor, length);
+        cursor += length;
+    }
+    const double* storedLevels = reinterpret_cast<const double*>(scaleArrays) + scaled;
+    for (unsigned int i = 0; i < scaled; i++) {
+        if (!(storedLevels[i] >= 0 && storedLevels[i] <= header.maxLevel)) return false;
+    }
+
+    // State 2 (state restored): Settings, state arrays and Particle records match the snapshot.
+    this->closeTrajectory();
+    time = header.time;
+    dt = header.dt;
+    stepCount = header.stepCount;
+    integrator = (Integrator)header.integrator;
+    backend = (ForceBackend)header.backend;
+    theta = header.theta;
+    mesh.setResolution(header.meshCells, header.meshShortRange != 0);
+    history = HistoryPolicy(header.historyStride, header.historyCapacity);
+    collisionResponse = (CollisionResponse)header.collisionResponse;
+    softening = header.softening;
+    stepPolicy = TimeStepPolicy((TimeStepMode)header.timeStepMode, header.eta, header.minDt, header.maxLevel);
+    lastStep = header.lastStep;
+    stepTimes = TrajectoryHistory();
+    stepTimes.setPolicy(history);
+    stepTimes.restart(std::make_pair(time, lastStep), stepCount);
+    aligned_vector* targets[8] = {&state.x, &state.y, &state.vx, &state.vy, &state.m, &state.fx, &state.fy,
+                                  &state.radius};
+    for (unsigned int a = 0; a < 8; a++) {
+        const double* column = reinterpret_cast<const double*>(arrays + a*(std::size_t)n*sizeof(double));
+        targets[a]->assign(column, column + n);
+    }
+    bodies.clear();
+    particles.clear();
+    bodies.reserve(n);
+    for (unsigned int i = 0; i < n; i++) {
+        Particle p(IDs[i], state.m[i], std::make_pair(state.x[i], state.y[i]), std::make_pair(state.vx[i], state.vy[i]),
+                   state.radius[i]);
+        p.setForce(std::make_pair(state.fx[i], state.fy[i]));
+        p.setHistoryPolicy(history);
+        p.resumeHistoryAt(stepCount);
+        particles.insert(std::make_pair(IDs[i], i));
+        bodies.push_back(p);
+    }
+    aligned_vector* tracerTargets[4] = {&tracers.x, &tracers.y, &tracers.vx, &tracers.vy};
+    for (unsigned int a = 0; a < 4; a++) {
+        const double* column = reinterpret_cast<const double*>(tracerArrays + a*(std::size_t)M*sizeof(double));
+        tracerTargets[a]->assign(column, column + M);
+    }
+    tracers.ax.assign(M, 0);
+    tracers.ay.assign(M, 0);
+    tracerIDs.assign(IDs.begin() + n, IDs.end());
+    tracerIndex.clear();
+    for (unsigned int k = 0; k < M; k++) {
+        tracerIndex.insert(std::make_pair(tracerIDs[k], k));
+    }
+    forcesCurrent = header.forcesCurrent != 0;
+    potentialCurrent = false;
+    tracerAccelerationsCurrent = false;  // recomputed from the restored positions, which gives the same bits
+    // With the timescales and levels a variable-step run resumes bit for bit; without them (the snapshot was taken
+    // before the first variable step) they are estimated at the next step, as they would have been.
+    timescalesCurrent = scaled > 0;
+    if (timescalesCurrent) {
+        const double* column = reinterpret_cast<const double*>(scaleArrays);
+        timescales.assign(column, column + n);
+        levels.assign(storedLevels, storedLevels + n);
+        stepStartAx.resize(n);
+        stepStartAy.resize(n);
+    }
+    publishedIDs.reset();
+    return true;
+}
+
+void Frame::setAutoCheckpoint(const std::string& filename, unsigned int everyNSteps) {
+    // Postcondition: Every everyNSteps steps a snapshot is written to filename in the background (see
+    //      CheckpointWriter for what happens when the disk falls behind). An empty filename turns this off.
+    this->waitForCheckpoints();
+    checkpointer.reset();
+    if (filename.empty()) return;
+    assert (everyNSteps > 0);
+    checkpointer.reset(new CheckpointWriter(filename));
+    checkpointStride = everyNSteps;
+}
+
+void Frame::waitForCheckpoints() {
+    // Postcondition: No periodic checkpoint is still being written.
+    if (checkpointer) checkpointer->wait();
+}
+
+bool Frame::enableMetrics(const std::string& filename, unsigned int everyNSteps) {
+    // Abstract: Start instrumenting this Frame. Timers and counters restart from zero, and the conserved quantities
+    //      are sampled immediately to serve as the reference for the energy error. From then on they are resampled
+    //      every everyNSteps steps and, if filename is not empty, appended to it (see MetricsLog).
+    // Postcondition: Returns whether the metrics file could be opened. Metrics are enabled either way.
+    assert (everyNSteps > 0);
+    metricsEnabled = false;
+    metrics.reset();
+    this->sampleConservedQuantities();
+    metrics.forceEvaluations = 0;
+    metrics.interactions = 0;
+    metrics.initialEnergy = metrics.totalEnergy();
+    metricsEnabled = true;
+    metricsStride = everyNSteps;
+    metricsLog.reset();
+    if (filename.empty()) return true;
+    metricsLog.reset(new MetricsLog(filename));
+    if (!metricsLog->isOpen()) {
+        metricsLog.reset();
+        return false;
+    }
+    metricsLog->write(time, metrics);
+    return true;
+}
+
+void Frame::disableMetrics() {
+    // Postcondition: No more timing or sampling is done and the metrics file, if any, is closed. The counters and the
+    //      last sample remain readable through getMetrics().
+    metricsEnabled = false;
+    metricsLog.reset();
+}
+
+void Frame::sampleConservedQuantities() {
+    // Abstract: Record the energy, linear momentum and angular momentum of the current state in the metrics. The
+    //      potential energy is the one left by the last force pass; only if that pass was not at the current
+    //      positions (every scheme but the leapfrog ones ends a step that way) are the forces recomputed here.
+    //      Everything else is a single O(N) sweep over the state arrays.
+    // Postcondition: metrics.sampleStep == stepCount, and the conserved quantities describe the current state.
+    if (!forcesCurrent || !potentialCurrent) this->updateAllForces();
+    const unsigned int n = state.size();
+    double K = 0, Px = 0, Py = 0, L = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        const double m = state.m[i];
+        K += m*(state.vx[i]*state.vx[i] + state.vy[i]*state.vy[i]);
+        Px += m*state.vx[i];
+        Py += m*state.vy[i];
+        L += m*(state.x[i]*state.vy[i] - state.y[i]*state.vx[i]);
+    }
+    metrics.sampleStep = stepCount;
+    metrics.kinetic = K/2;
+    metrics.potential = lastPotential;
+    metrics.px = Px;
+    metrics.py = Py;
+    metrics.Lz = L;
 }
 
 void Frame::saveAllParticleDataToTextFiles() const {
     // Save data for each particle in the Frame to a text file with that particle's name
-    for (const_particle_itr itr = particles.begin(); itr != particles.end(); itr++) {
-        itr->second.saveDataToTextFile(dt);
+    for (unsigned int i = 0; i < bodies.size(); i++) {
+        bodies[i].saveDataToTextFile(stepTimes);
     }
 }
 
+std::pair<double, double> gravitationalForce(double p1x, double p1y, double m1, double p2x, double p2y, double m2) {
+    // Abstract: Implement Newton's Law of Universal Gravitation on raw coordinates, so the Frame's pair loop can
+    //      call it straight from the state arrays. Newton's Law of Universal Gravitation is: F = G*(m1*m2/r^2)
+    //      Scaling the separation vector (dx, dy) by G*m1*m2/r^3 gives both the magnitude and the direction, so
+    //      no angle (and no trig) is needed. This is the same arithmetic as the kernels in forceKernels.cpp.
+    // Postcondition: The 2D force vector on body 1 pointing towards body 2 has been returned.
+    double dx = p2x - p1x;
+    double dy = p2y - p1y;
+    double r2 = dx*dx + dy*dy;
+    double s = G*m1*m2/(r2*std::sqrt(r2));
+    return std::make_pair(s*dx, s*dy);
+}
+
 std::pair<double, double> operator- (const std::pair<double, double>& F_vec) {
     // Overload of - operator, used to easily negate both signs in a force vector, such as the one
     // returned by Frame::getGravitationalForceBetween().
@@ -1,12 +1,104 @@
+#pragma once
 #include <utility>
 #include <vector>
 #include <unordered_map>
 #include <string>
 #include <string.h>
+#include <cstring>
 #include <iostream>
 #include <fstream>
-#include <cmath> // for pow() and trig functions
+#include <cmath> // for pow() and sqrt()
 #include <cassert>
+#include <cstddef>
+#include <new>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include "forceKernels.h"
+#include "threadPool.h"
+#include "barnesHut.h"
+#include "particleMesh.h"
+#include "keplerSolver.h"
+#include "trajectoryWriter.h"
+#include "statePublisher.h"
+#include "checkpoint.h"
+#include "metrics.h"
+#include "collisions.h"
+
+// ==========================================================================================
+// Retention policy for a Particle's trajectory history. Every sample offered to the history is numbered from 0
+// (the initial state); a sample is kept if its number is a multiple of stride, and at most capacity kept samples
+// are held at once, the oldest being overwritten first. A capacity of 0 means unbounded.
+struct HistoryPolicy {
+    unsigned int stride;
+    unsigned int capacity;
+
+    HistoryPolicy() : stride(1), capacity(0) {}
+    HistoryPolicy(unsigned int _stride, unsigned int _capacity) : stride(_stride), capacity(_capacity) { assert(stride > 0); }
+
+    static HistoryPolicy keepAll() { return HistoryPolicy(1, 0); }
+    static HistoryPolicy currentOnly() { return HistoryPolicy(1, 1); }
+    static HistoryPolicy lastSamples(unsigned int K) { return HistoryPolicy(1, K); }
+    static HistoryPolicy everyNthStep(unsigned int N, unsigned int capacity = 0) { return HistoryPolicy(N, capacity); }
+};
+
+// ==========================================================================================
+// Read-only view of count consecutive history samples, in place. Cheap to copy; it stays valid until the history it
+// came from is next added to (i.e. until the next step of the owning Frame).
+struct SampleSpan {
+    const std::pair<double, double>* first;
+    unsigned int count;
+
+    unsigned int size() const { return count; }
+    bool empty() const { return count == 0; }
+    const std::pair<double, double>* begin() const { return first; }
+    const std::pair<double, double>* end() const { return first + count; }
+    const std::pair<double, double>& operator[] (unsigned int j) const { return first[j]; }
+};
+
+// ==========================================================================================
+// Position or velocity history of a single Particle. The latest sample is always available, whether or not the
+// policy retains it; retained samples are stored in a ring buffer that is allocated once when bounded, so memory
+// stays constant regardless of how many steps are run.
+class TrajectoryHistory {
+public:
+    TrajectoryHistory() : offered(0), kept(0), head(0), offStride(false), resumedAt(0), current(std::make_pair(0, 0)) {}
+
+    // Getters
+    const std::pair<double, double>& latest() const { return current; }
+    const HistoryPolicy&             getPolicy() const { return policy; }
+    unsigned int                     size() const { return samples.size(); }
+    unsigned long                    samplesOffered() const { return offered; }
+
+    // Operators
+    // Index 0 is the oldest retained sample. With nothing retained, the latest sample stands in.
+    const std::pair<double, double>& operator[] (unsigned int j) const {
+        return samples.empty() ? current : samples[(head + j) % samples.size()];
+    }
+
+    // The retained samples, oldest first, are olderSpan() followed by newerSpan(). Until a bounded history wraps
+    // around, everything is in olderSpan() and newerSpan() is empty.
+    SampleSpan olderSpan() const { SampleSpan s = {samples.data() + head, (unsigned int)samples.size() - head}; return s; }
+    SampleSpan newerSpan() const { SampleSpan s = {samples.data(), head}; return s; }
+
+    // Member functions
+    void add(std::pair<double, double> sample);
+    void setPolicy(const HistoryPolicy& newPolicy);
+    void restart(std::pair<double, double> sample, unsigned long index);
+    unsigned long sampleIndex(unsigned int j) const;
+    bool findSample(unsigned long index, unsigned int& j) const;
+
+private:
+    HistoryPolicy policy;
+    unsigned long offered;                          // number of samples ever passed to add()
+    unsigned long kept;                             // number of samples ever retained, including overwritten ones
+    unsigned int head;                              // slot of the oldest retained sample once the ring has wrapped
+    bool offStride;                                 // whether the oldest retained sample is a resume point that the
+    unsigned long resumedAt;                        //      stride would not have kept, and its number (see restart)
+    std::pair<double, double> current;
+    std::vector<std::pair<double, double>> samples;
+};
 
 // ==========================================================================================
 // Class representing a single point with some mass, position, and velocity.
@@ -23,14 +115,20 @@ public:
     // Getters
     const std::string&        getID() const { return ID; }
     double                    getMass() const { return mass; }
-    std::pair<double, double> getCurrentPos() const { return pos.back(); }
-    std::pair<double, double> getCurrentVel() const { return vel.back(); }
+    double                    getRadius() const { return radius; }
+    std::pair<double, double> getCurrentPos() const { return pos.latest(); }
+    std::pair<double, double> getCurrentVel() const { return vel.latest(); }
     std::pair<double, double> getNetForce() const { return net_force; }
+    const TrajectoryHistory&  getPosHistory() const { return pos; }
+    const TrajectoryHistory&  getVelHistory() const { return vel; }
 
     // Setters
-    // No setters for ID and mass, since those should stay constant
+    // No setter for ID, since that should stay constant. Mass and radius only change when two Particles merge.
     // No setters for pos and vel since they are growing incrementally by adding entries
     void setForce(std::pair<double, double> F_vec) { net_force = F_vec; }
+    void setMergedMassAndRadius(double _mass, double _radius) { mass = _mass; radius = _radius; }
+    void setHistoryPolicy(const HistoryPolicy& policy) { pos.setPolicy(policy); vel.setPolicy(policy); }
+    void resumeHistoryAt(unsigned long step) { pos.restart(pos.latest(), step); vel.restart(vel.latest(), step); }
 
     // Operators
     bool operator== (const Particle& other) const;
@@ -38,18 +136,18 @@ public:
     friend std::ostream& operator<< (std::ostream& ostr, const Particle& p);
     
     // Member functions
-    void addPos(std::pair<double, double> newPos) { pos.push_back(newPos); }
-    void addVel(std::pair<double, double> newVel) { vel.push_back(newVel); }
+    void addPos(std::pair<double, double> newPos) { pos.add(newPos); }
+    void addVel(std::pair<double, double> newVel) { vel.add(newVel); }
     void addForce(std::pair<double, double> F_vec);
-    void saveDataToTextFile(double dt) const;
+    void saveDataToTextFile(const TrajectoryHistory& stepTimes) const;
 
 private:
-    // We store vectors for pos and vel so we have access to a Particle's entire history/path
+    // We store histories for pos and vel so we have access to as much of a Particle's path as its HistoryPolicy keeps
     std::string ID;
     double mass;                                // in kg
     double radius;                              // optional, to specify a planet's surface for launching off it, in meters
-    std::vector<std::pair<double, double>> pos; // in meters from some as of now arbitrary location
-    std::vector<std::pair<double, double>> vel; // in meters per second
+    TrajectoryHistory pos;                      // in meters from some as of now arbitrary location
+    TrajectoryHistory vel;                      // in meters per second
     std::pair<double, double> net_force;        // in Newtons
 };
 
@@ -60,44 +158,329 @@ public:
     unsigned int operator() (const std::string& IDToHash) const;
 };
 
+// ==========================================================================================
+// Minimal allocator returning storage aligned to a cache line. Used so the per-slot state arrays in a Frame start on
+// a 64-byte boundary, which keeps SIMD loads aligned and avoids splitting a cache line between two arrays.
+template <typename T, std::size_t Alignment = 64>
+class AlignedAllocator {
+public:
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(std::size_t n) { return static_cast<T*>(::operator new(n*sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T* ptr, std::size_t) { ::operator delete(ptr, std::align_val_t(Alignment)); }
+
+    template <typename U> bool operator== (const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U> bool operator!= (const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+typedef std::vector<double, AlignedAllocator<double> > aligned_vector;
+
+// ==========================================================================================
+// Structure-of-arrays copy of the state the integrator actually touches every step. Entry i of every array belongs
+// to the Particle in dense slot i of the owning Frame, so the pair loop walks contiguous memory instead of
+// hash-bucket nodes.
+struct StateArrays {
+    aligned_vector x, y;    // current position, in meters
+    aligned_vector vx, vy;  // current velocity, in meters per second
+    aligned_vector m;       // mass, in kg
+    aligned_vector fx, fy;  // net force for the current step, in Newtons
+    aligned_vector radius;  // collision radius, in meters
+
+    unsigned int size() const { return x.size(); }
+    void reserve(unsigned int n);
+    void push_back(const Particle& p);
+    void swapRemove(unsigned int i);
+};
+
+// ==========================================================================================
+// Structure-of-arrays state of a Frame's massless tracers (see Frame::addTracer). Kept apart from StateArrays so the
+// massive pair loop never walks over them, and so a tracer costs six doubles rather than a full Particle record.
+struct TracerArrays {
+    aligned_vector x, y;    // current position, in meters
+    aligned_vector vx, vy;  // current velocity, in meters per second
+    aligned_vector ax, ay;  // acceleration due to the massive bodies at the current positions, in m/s^2
+
+    unsigned int size() const { return x.size(); }
+    void reserve(unsigned int n);
+    void push_back(const Particle& p);
+    void swapRemove(unsigned int i);
+};
+
 // ==========================================================================================
 // Class representing the collection of particles in 2D space. It tracks how that space changes with time due to 
 // forces between each particle. Should be able to impose boundaries on space somehow.
 
-// Useful typedefs
-typedef std::unordered_map<std::string, Particle, ParticleHasher>::iterator particle_itr;
-typedef std::unordered_map<std::string, Particle, ParticleHasher>::const_iterator const_particle_itr;
+// Useful typedefs. The hashtable only maps a Particle's ID to its dense slot; the Particles themselves live in
+// Frame::bodies and their hot state in Frame::state.
+typedef std::unordered_map<std::string, unsigned int, ParticleHasher> particle_index;
+typedef particle_index::iterator particle_itr;
+typedef particle_index::const_iterator const_particle_itr;
+
+// Frames smaller than this evaluate forces serially even when given a thread pool, since handing the work to
+// other threads costs more than the pair loop itself.
+const unsigned int PARALLEL_FORCE_MIN_BODIES = 256;
+
+// Likewise for tracers: below this many tracer-body interactions per evaluation they are updated serially.
+const unsigned long PARALLEL_TRACER_MIN_INTERACTIONS = 32768;
+
+// And for the partial force passes of block time steps, counting active-body interactions.
+const unsigned long PARALLEL_ACTIVE_MIN_INTERACTIONS = 32768;
+
+// Marks a trajectory file column whose Particle has left the Frame.
+const unsigned int WRITER_COLUMN_REMOVED = 0xFFFFFFFFu;
+
+// Method used by Frame::updateAllForces() to find the net force on each Particle.
+enum ForceBackend {
+    DIRECT_SUMMATION,   // exact pair loop, O(N^2)
+    BARNES_HUT,         // quadtree approximation controlled by the opening angle, O(N log N)
+    PARTICLE_MESH       // FFT mesh of Frame::setMeshResolution, O(N + cells^2 log cells), for collisionless runs
+};
+
+// Time integration scheme used by Frame::advanceSingleTimeStep().
+enum Integrator {
+    LEFT_BOX_EULER,     // semi-implicit Euler: first order, one force evaluation per step
+    VELOCITY_VERLET,    // kick-drift-kick leapfrog: second order, symplectic, one force evaluation per step
+    YOSHIDA_4,          // three leapfrog sub-steps (Forest-Ruth/Yoshida): fourth order, symplectic, three evaluations
+    RUNGE_KUTTA_4,      // classic RK4 with forces re-evaluated at each stage: fourth order, four evaluations
+    WISDOM_HOLMAN       // mixed-variable symplectic: analytic Kepler orbits about the most massive body, with the
+                        // remaining interactions applied as kicks. Second order, one force evaluation per step.
+};
+
+// How Frame::advanceSingleTimeStep() sizes its steps (see Frame::setTimeStepPolicy). Adaptive step sizes follow each
+// body's timescale |a|/|da/dt|, the time its acceleration takes to change by its own size (r/v on a circular orbit).
+// The rate of change is estimated from the accelerations at the two ends of the body's previous step.
+enum TimeStepMode {
+    FIXED_STEP,     // every step is the Frame's dt
+    ADAPTIVE_STEP,  // one step size shared by every body: eta times the shortest timescale, within [minDt, dt]
+    BLOCK_STEPS     // every step covers dt, within which each body takes sub-steps of dt/2^k for its own level k
+};
+
+struct TimeStepPolicy {
+    TimeStepMode mode;
+    double eta;             // fraction of a body's timescale covered by one of its steps
+    double minDt;           // ADAPTIVE_STEP: shortest step, in seconds
+    unsigned int maxLevel;  // BLOCK_STEPS: deepest level, so the shortest sub-step is dt/2^maxLevel
+
+    TimeStepPolicy() : mode(FIXED_STEP), eta(0), minDt(0), maxLevel(0) {}
+    TimeStepPolicy(TimeStepMode _mode, double _eta, double _minDt, unsigned int _maxLevel)
+        : mode(_mode), eta(_eta), minDt(_minDt), maxLevel(_maxLevel) {}
+
+    static TimeStepPolicy fixed() { return TimeStepPolicy(); }
+    static TimeStepPolicy adaptive(double eta, double minDt) {
+        assert (eta > 0 && minDt > 0);
+        return TimeStepPolicy(ADAPTIVE_STEP, eta, minDt, 0);
+    }
+    static TimeStepPolicy block(double eta, unsigned int maxLevel) {
+        assert (eta > 0 && maxLevel <= 30);
+        return TimeStepPolicy(BLOCK_STEPS, eta, 0, maxLevel);
+    }
+};
 
 class Frame {
 public:
     // Constructor
-    Frame() : time(0), dt(1) {}
-    Frame(double _dt) : time(0), dt(_dt) {}
+    Frame() : Frame(1) {}
+    Frame(double _dt) : Frame(_dt, HistoryPolicy()) {}
+    Frame(double _dt, const HistoryPolicy& _history) : time(0), dt(_dt), history(_history), numThreads(1),
+                                                       backend(DIRECT_SUMMATION), theta(0.5),
+                                                       integrator(LEFT_BOX_EULER), forcesCurrent(false),
+                                                       stepCount(0), writerStride(1), writerRemapped(false),
+                                                       publisherStride(1), checkpointStride(1),
+                                                       lastPotential(0), potentialCurrent(false),
+                                                       metricsEnabled(false), metricsStride(1),
+                                                       collisionResponse(COLLISIONS_IGNORED), softening(0),
+                                                       tracerAccelerationsCurrent(false), lastStep(0),
+                                                       timescalesCurrent(false) {
+        stepTimes.setPolicy(history);
+        stepTimes.add(std::make_pair(0.0, 0.0));
+    }
 
     // Getters
     double getTime() const { return time; }
     double getDt() const { return dt; }
+    unsigned long getStepCount() const { return stepCount; }
+    unsigned int size() const { return bodies.size(); }
+    unsigned int numTracers() const { return tracers.size(); }
+    const HistoryPolicy& getHistoryPolicy() const { return history; }
+    unsigned int getNumThreads() const { return numThreads; }
+    ForceBackend getForceBackend() const { return backend; }
+    double getOpeningAngle() const { return theta; }
+    unsigned int getMeshResolution() const { return mesh.numCells(); }
+    bool getShortRangeCorrection() const { return mesh.usesShortRangeCorrection(); }
+    Integrator getIntegrator() const { return integrator; }
+    CollisionResponse getCollisionResponse() const { return collisionResponse; }
+    double getSoftening() const { return softening; }
+    const FrameMetrics& getMetrics() const { return metrics; }
+    const TimeStepPolicy& getTimeStepPolicy() const { return stepPolicy; }
+    double getLastStepSize() const { return lastStep; }
+    unsigned int getTimeStepLevel(unsigned int slot) const;
 
-    // No Setters since time and timestep remain constant.
+    // No Setters for time and timestep since they only change by stepping (or restoring a checkpoint). With a
+    // TimeStepPolicy other than FIXED_STEP, dt is the longest step and getLastStepSize() the one actually taken.
+    void setHistoryPolicy(const HistoryPolicy& policy);
+    void setNumThreads(unsigned int n);
+    void setForceBackend(ForceBackend _backend) { backend = _backend; forcesCurrent = false; }
+    void setOpeningAngle(double _theta) { assert(_theta >= 0); theta = _theta; forcesCurrent = false; }
+    void setMeshResolution(unsigned int cells, bool shortRangeCorrection = false);
+    void setIntegrator(Integrator _integrator) { integrator = _integrator; }
+    void setCollisionResponse(CollisionResponse response, double softeningLength = 0);
+    void setTimeStepPolicy(const TimeStepPolicy& policy);
+
+    // Particle access. None of these copy a Particle or insert one. References and pointers stay valid until the
+    // next addParticle() or removeParticle() (or a step that merges bodies), and always show the latest state.
+    // Slots are dense, 0 .. size()-1, but removing a Particle moves the last one into its slot.
+    const Particle& operator[] (const std::string& particleName) const;
+    const Particle& at(const std::string& particleName) const;
+    const Particle* find(const std::string& particleName) const;
+    const Particle& atSlot(unsigned int slot) const { assert (slot < bodies.size()); return bodies[slot]; }
+    const StateArrays& getStateArrays() const { return state; }
+    Particle getTracer(const std::string& tracerName) const;
 
     // Operators
-    Particle operator[] (const std::string& particleName ) { return particles[particleName]; }
     friend std::ostream& operator<< (std::ostream& ostr, const Frame& f);
 
     // Member Functions
     std::pair<particle_itr, bool> addParticle(const Particle& newParticle);
+    unsigned int addParticles(std::vector<Particle>&& newParticles);
+    bool removeParticle(const std::string& particleName);
+    bool addTracer(const Particle& newTracer);
+    unsigned int addTracers(const std::vector<Particle>& newTracers);
+    bool removeTracer(const std::string& tracerName);
     std::pair<double, double> getGravitationalForceBetween(const Particle& p1, const Particle& p2);
     void updateAllForces();
     void advanceSingleTimeStep();
     void saveAllParticleDataToTextFiles() const;
+    bool streamTrajectory(const std::string& filename, unsigned int everyNSteps = 1);
+    void closeTrajectory();
+    std::shared_ptr<StatePublisher> publishState(unsigned int everyNSteps, unsigned int maxReaders = 4);
+    void stopPublishing();
+    bool saveCheckpoint(const std::string& filename) const;
+    bool restoreCheckpoint(const std::string& filename);
+    void setAutoCheckpoint(const std::string& filename, unsigned int everyNSteps);
+    void waitForCheckpoints();
+    bool enableMetrics(const std::string& filename = "", unsigned int everyNSteps = 1);
+    void disableMetrics();
+    void sampleConservedQuantities();
 
 private:
+    void accumulateForcesParallel();
+    void stepLeftBoxEuler(double h);
+    void stepVelocityVerlet(double h);
+    void stepRungeKutta4(double h);
+    void stepWisdomHolman(double h);
+    void interactionKick(double h, unsigned int central);
+    void jump(double h, unsigned int central);
+    void kick(double h);
+    void drift(double h);
+    void recordHistory();
+    double chooseAdaptiveStep();
+    void estimateTimescales(double h);
+    void updateTimescales(double h);
+    unsigned int levelForTimescale(double timescale) const;
+    void stepBlocks();
+    void updateActiveForces();
+    void resolveCollisions(double h);
+    void mergeCollisions();
+    void bounceCollisions(double h);
+    void updateTracerAccelerations();
+    void kickDriftTracers(double h);
+    void kickTracers(double h);
+    void pushToWriter();
+    void remapWriterColumns();
+    void pushToPublisher();
+    void buildCheckpointImage(std::vector<char>& image) const;
+
     double time;
-    const double dt;
-    std::unordered_map<std::string, Particle, ParticleHasher> particles; // hashtable between a Particle's ID and that Particle.
+    double dt;
+    HistoryPolicy history;          // retention policy applied to every Particle added to this Frame
+    StateArrays state;              // hot per-slot state, iterated by the force and integration loops
+    std::vector<Particle> bodies;   // per-slot Particle records (ID, mass, radius, history)
+    particle_index particles;       // hashtable between a Particle's ID and its slot in bodies/state
+
+    // Parallel force evaluation. With numThreads == 1 there is no pool and forces are computed serially.
+    unsigned int numThreads;
+    std::unique_ptr<ThreadPool> pool;
+    std::vector<aligned_vector> workerFx, workerFy; // per-worker force accumulators, reduced in worker order
+
+    // Force backend selection. The quadtree and the mesh are kept between steps so their storage is reused.
+    ForceBackend backend;
+    double theta;                   // Barnes-Hut opening angle
+    QuadTree tree;
+    ParticleMesh mesh;              // also holds the mesh resolution
+
+    // Integration scheme. forcesCurrent records whether state.fx/fy were computed at the current positions, so the
+    // leapfrog-based schemes can reuse the closing force evaluation of one step as the opening one of the next.
+    Integrator integrator;
+    bool forcesCurrent;
+    StateArrays stageStart, stageSum;   // RK4 scratch: state at the start of the step, weighted sum of stage slopes
+
+    // Streaming output. While a writer is attached, every writerStride-th step is queued to its background thread.
+    // The file's columns are fixed when streaming starts; once a Particle has been removed, each record is gathered
+    // through writerSlots instead (removed Particles are written as NaN).
+    unsigned long stepCount;
+    std::unique_ptr<TrajectoryWriter> writer;
+    unsigned int writerStride;
+    std::vector<std::string> writerIDs;     // ID of each column of the trajectory file
+    std::vector<unsigned int> writerSlots;  // current slot of each column, or WRITER_COLUMN_REMOVED
+    bool writerRemapped;
+    StateArrays writerRecord;               // gather buffer for remapped records
+
+    // Live state publishing. While a publisher is attached, every publisherStride-th step is handed to its readers.
+    // publishedIDs is shared by every snapshot until the bodies change, when it is rebuilt at the next publish.
+    std::shared_ptr<StatePublisher> publisher;
+    unsigned int publisherStride;
+    std::shared_ptr<const std::vector<std::string>> publishedIDs;
+
+    // Periodic checkpoints, written asynchronously every checkpointStride steps while a checkpointer is attached.
+    std::unique_ptr<CheckpointWriter> checkpointer;
+    unsigned int checkpointStride;
+    std::vector<char> checkpointBuffer;  // reused image buffer, so periodic checkpoints do not allocate
+
+    // Instrumentation. Every force pass leaves its potential energy in lastPotential; potentialCurrent says whether
+    // that still matches the positions (like forcesCurrent, but also false after a restore, which stores no energy).
+    FrameMetrics metrics;
+    double lastPotential;
+    bool potentialCurrent;
+    std::vector<double> workerPotential;    // per-worker potential energy partials of accumulateForcesParallel()
+    bool metricsEnabled;
+    unsigned int metricsStride;
+    std::unique_ptr<MetricsLog> metricsLog;
+
+    // Collision handling. For swept-sphere detection the positions at the start of each step are kept.
+    CollisionResponse collisionResponse;
+    double softening;                       // Plummer softening length, in meters (only with COLLISION_SOFTEN)
+    CollisionDetector collider;
+    std::vector<CollisionEvent> collisions;
+    aligned_vector stepStartX, stepStartY;
+
+    // Massless tracers. They are advanced alongside the massive bodies but kept out of every massive-body pass, and
+    // hold no history: only their current state is available. tracerAccelerationsCurrent plays the role of
+    // forcesCurrent for tracers.ax/ay.
+    TracerArrays tracers;
+    std::vector<std::string> tracerIDs;     // ID of each tracer slot
+    particle_index tracerIndex;             // hashtable between a tracer's ID and its slot in tracers
+    bool tracerAccelerationsCurrent;
+
+    // Variable time steps. timescales[i] is body i's |a|/|da/dt| and stepStartAx/Ay its acceleration at the start of
+    // its current step; timescalesCurrent says whether they still describe the bodies in the Frame. stepTimes records
+    // (time, step size) after every step under the history policy, so retained samples can be given their times.
+    TimeStepPolicy stepPolicy;
+    double lastStep;
+    bool timescalesCurrent;
+    std::vector<double> timescales;
+    aligned_vector stepStartAx, stepStartAy;
+    std::vector<unsigned int> levels;       // BLOCK_STEPS: each body's level
+    std::vector<unsigned int> activeSlots;  // BLOCK_STEPS: bodies whose sub-step ends now
+    std::vector<unsigned char> activeMask;  // BLOCK_STEPS: activeSlots as a per-slot flag, for the quadtree
+    TrajectoryHistory stepTimes;
 };
 
 // ==========================================================================================
 // Helper Functions
 
+std::pair<double, double> gravitationalForce(double p1x, double p1y, double m1, double p2x, double p2y, double m2);
 std::pair<double, double> operator- (const std::pair<double, double>& F_vec);
\ No newline at end of file
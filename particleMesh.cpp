@@ -0,0 +1,427 @@
+#include "particleMesh.h"
+#include "forceKernels.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// Kernel split of the short-range correction, in cells: the mesh carries -G*erf(r/2rs)/r with rs = SPLIT_SCALE cells,
+// and pairs are corrected out to CUTOFF_SCALES*rs, where erfc(r/2rs) < 1.5e-3 of the full force is left to the mesh.
+static const double SPLIT_SCALE = 1.25;
+static const double CUTOFF_SCALES = 4.5;
+// The long-range pair terms are interpolated from tables of SPLIT_TABLE intervals in (r/rs)^2 out to the cutoff.
+static const unsigned int SPLIT_TABLE = 4096;
+// Empty nodes kept between the bodies and the edge of the mesh, so every CIC node and its centred difference exist.
+static const unsigned int MARGIN = 2;
+
+void ParticleMesh::setResolution(unsigned int _cells, bool _shortRange) {
+    // Postcondition: The next build() uses a mesh of _cells x _cells nodes, with or without the short-range
+    //      correction. The kernel is recomputed on that build.
+    assert (_cells >= 16 && (_cells & (_cells - 1)) == 0);
+    cells = _cells;
+    shortRange = _shortRange;
+}
+
+static inline std::complex<double> multiply(std::complex<double> a, std::complex<double> b) {
+    // Plain complex product, without the NaN recovery of operator* that keeps it from being inlined.
+    return std::complex<double>(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+}
+
+void ParticleMesh::fft(std::complex<double>* a, bool inverse) const {
+    // In-place iterative radix-2 FFT of length P = bitReverse.size(), unnormalized. The inverse uses conjugate
+    // twiddles; its 1/P^2 for the 2D transform is folded into kernelHat.
+    const unsigned int P = bitReverse.size();
+    for (unsigned int k = 0; k < P; k++) {
+        if (k < bitReverse[k]) std::swap(a[k], a[bitReverse[k]]);
+    }
+    for (unsigned int len = 2; len <= P; len <<= 1) {
+        const unsigned int half = len/2;
+        const unsigned int stride = P/len;
+        for (unsigned int start = 0; start < P; start += len) {
+            for (unsigned int k = 0; k < half; k++) {
+                std::complex<double> w = twiddles[k*stride];
+                if (inverse) w = std::conj(w);
+                std::complex<double> u = a[start + k];
+                std::complex<double> v = multiply(a[start + k + half], w);
+                a[start + k] = u + v;
+                a[start + k + half] = u - v;
+            }
+        }
+    }
+}
+
+void ParticleMesh::transformRows(unsigned int rowBegin, unsigned int rowEnd, bool inverse, ThreadPool* pool) {
+    // Transform rows [rowBegin, rowEnd) of the padded grid, each worker taking a contiguous range of them.
+    const unsigned int P = 2*cells;
+    const unsigned int rows = rowEnd - rowBegin;
+    const unsigned int workers = pool ? pool->size() : 1;
+    auto part = [&](unsigned int w) {
+        const unsigned int rEnd = rowBegin + (unsigned long)rows*(w + 1)/workers;
+        for (unsigned int r = rowBegin + (unsigned long)rows*w/workers; r < rEnd; r++) {
+            this->fft(grid.data() + (std::size_t)r*P, inverse);
+        }
+    };
+    if (pool) pool->runOnAll(part);
+    else part(0);
+}
+
+void ParticleMesh::transformColumns(bool inverse, ThreadPool* pool) {
+    // Transform every column of the padded grid. Columns are copied out in tiles of COLUMNS, so each row of the grid
+    // is read a couple of cache lines at a time rather than one strided element at a time.
+    const unsigned int COLUMNS = 8;
+    const unsigned int P = 2*cells;
+    const unsigned int tiles = P/COLUMNS;
+    const unsigned int workers = pool ? pool->size() : 1;
+    workerColumn.resize(workers);
+    auto part = [&](unsigned int w) {
+        std::vector<std::complex<double>>& tile = workerColumn[w];
+        tile.resize((std::size_t)COLUMNS*P);
+        for (unsigned int t = (unsigned long)tiles*w/workers; t < (unsigned long)tiles*(w + 1)/workers; t++) {
+            const unsigned int c0 = t*COLUMNS;
+            for (unsigned int r = 0; r < P; r++) {
+                for (unsigned int b = 0; b < COLUMNS; b++) {
+                    tile[(std::size_t)b*P + r] = grid[(std::size_t)r*P + c0 + b];
+                }
+            }
+            for (unsigned int b = 0; b < COLUMNS; b++) {
+                this->fft(tile.data() + (std::size_t)b*P, inverse);
+            }
+            for (unsigned int r = 0; r < P; r++) {
+                for (unsigned int b = 0; b < COLUMNS; b++) {
+                    grid[(std::size_t)r*P + c0 + b] = tile[(std::size_t)b*P + r];
+                }
+            }
+        }
+    };
+    if (pool) pool->runOnAll(part);
+    else part(0);
+}
+
+void ParticleMesh::prepareKernel() {
+    // Abstract: Transform the kernel for the current resolution, once per resolution. Expressed in cells it does not
+    //      depend on the cell size, so the mesh can follow the bodies from step to step without recomputing it.
+    // Postcondition: kernelHat, selfKernel and the FFT tables match cells and shortRange.
+    if (kernelCells == cells && kernelShortRange == shortRange) return;
+    const unsigned int P = 2*cells;
+    unsigned int bits = 0;
+    while ((1u << bits) < P) bits++;
+    bitReverse.resize(P);
+    for (unsigned int k = 0; k < P; k++) {
+        unsigned int r = 0;
+        for (unsigned int b = 0; b < bits; b++) {
+            if (k & (1u << b)) r |= 1u << (bits - 1 - b);
+        }
+        bitReverse[k] = r;
+    }
+    twiddles.resize(P/2);
+    for (unsigned int k = 0; k < P/2; k++) {
+        twiddles[k] = std::polar(1.0, -2*M_PI*k/P);
+    }
+
+    // State 1 (kernel sampled): Node (i, j) of the padded grid holds the kernel at a separation of (i, j) cells,
+    // wrapping around so that the upper half of each axis stands for negative separations. Without the correction
+    // the kernel is -1/r softened over one cell; with it, the long-range part of the split.
+    grid.assign((std::size_t)P*P, 0);
+    const double rs = SPLIT_SCALE;
+    for (unsigned int j = 0; j < P; j++) {
+        const double dj = std::min(j, P - j);
+        for (unsigned int i = 0; i < P; i++) {
+            const double di = std::min(i, P - i);
+            const double d = std::sqrt(di*di + dj*dj);
+            double k;
+            if (!shortRange) k = 1/std::sqrt(d*d + 1);
+            else if (d == 0) k = 1/(rs*std::sqrt(M_PI));
+            else k = std::erf(d/(2*rs))/d;
+            grid[(std::size_t)j*P + i] = k;
+        }
+    }
+
+    // State 2 (kernel transformed): kernelHat is the kernel's spectrum, which is real because the kernel is even. With
+    // the correction, the spectrum is divided by that of CIC deposit and interpolation along both axes, so the smooth
+    // long-range force comes out sharp enough to meet the short-range part at the cutoff; the split kernel has all
+    // but vanished at the frequencies where that division would amplify noise.
+    this->transformRows(0, P, false, NULL);
+    this->transformColumns(false, NULL);
+    kernelHat.resize((std::size_t)P*P);
+    for (unsigned int j = 0; j < P; j++) {
+        for (unsigned int i = 0; i < P; i++) {
+            double k = grid[(std::size_t)j*P + i].real()/((double)P*P);
+            if (shortRange) {
+                const double fi = M_PI*std::min(i, P - i)/P;
+                const double fj = M_PI*std::min(j, P - j)/P;
+                const double si = (fi == 0) ? 1 : std::sin(fi)/fi;
+                const double sj = (fj == 0) ? 1 : std::sin(fj)/fj;
+                k /= std::pow(si*sj, 4);
+            }
+            kernelHat[(std::size_t)j*P + i] = k;
+        }
+    }
+
+    // State 3 (self kernel): Transforming kernelHat back gives the kernel as the mesh applies it, whose values at
+    // neighbouring nodes fix each body's interaction with itself.
+    for (std::size_t k = 0; k < kernelHat.size(); k++) {
+        grid[k] = kernelHat[k];
+    }
+    this->transformColumns(true, NULL);
+    this->transformRows(0, P, true, NULL);
+    for (unsigned int dj = 0; dj < 2; dj++) {
+        for (unsigned int di = 0; di < 2; di++) {
+            selfKernel[di][dj] = grid[(std::size_t)dj*P + di].real();
+        }
+    }
+
+    // State 4 (split tables): With the correction, splitForce and splitPotential tabulate the long-range pair terms in
+    // units of rs, erf(r/2)/r^3 - exp(-r^2/4)/(sqrt(pi)*r^2) and erf(r/2)/r, against q = r^2, so the pair loop needs
+    // no erf or exp. At r = 0 they take their limits.
+    if (shortRange) {
+        const double dq = CUTOFF_SCALES*CUTOFF_SCALES/SPLIT_TABLE;
+        splitForce.resize(SPLIT_TABLE + 2);
+        splitPotential.resize(SPLIT_TABLE + 2);
+        splitForce[0] = 1/(6*std::sqrt(M_PI));
+        splitPotential[0] = 1/std::sqrt(M_PI);
+        for (unsigned int t = 1; t < SPLIT_TABLE + 2; t++) {
+            const double r = std::sqrt(t*dq);
+            const double e = std::erf(r/2);
+            splitForce[t] = e/(r*r*r) - std::exp(-r*r/4)/(std::sqrt(M_PI)*r*r);
+            splitPotential[t] = e/r;
+        }
+    }
+    kernelCells = cells;
+    kernelShortRange = shortRange;
+}
+
+void ParticleMesh::build(const double* x, const double* y, const double* m, unsigned int n, ThreadPool* pool) {
+    // Abstract: Solve for the mesh potential and accelerations of the bodies at their current positions. The work
+    //      grids keep their capacity between steps, so after the first step a build does no allocation.
+    // Postcondition: potentialGrid, accelX and accelY describe the field of the bodies, which accumulateForces()
+    //      can then sample, and with the short-range correction the chaining mesh is sorted.
+    this->prepareKernel();
+    numBodies = n;
+    bx = x;
+    by = y;
+    bm = m;
+    if (n == 0) return;
+    const unsigned int P = 2*cells;
+    const unsigned int workers = pool ? pool->size() : 1;
+
+    // State 1 (mesh placed): The bodies' bounding square, grown by MARGIN cells on every side, spans the mesh.
+    double minX = x[0], maxX = x[0], minY = y[0], maxY = y[0];
+    for (unsigned int i = 1; i < n; i++) {
+        minX = std::min(minX, x[i]); maxX = std::max(maxX, x[i]);
+        minY = std::min(minY, y[i]); maxY = std::max(maxY, y[i]);
+    }
+    double side = std::max(maxX - minX, maxY - minY);
+    if (side == 0) side = 1;
+    cellSize = side/(cells - 2*MARGIN - 1);
+    originX = minX - MARGIN*cellSize;
+    originY = minY - MARGIN*cellSize;
+
+    // State 2 (mass deposited): Each worker spreads a contiguous range of bodies over the four nodes around each with
+    // CIC weights into its own grid; the grids are then summed in worker order into the corner of the padded grid,
+    // whose remainder is zeroed. The result depends only on the number of workers.
+    workerMass.resize(workers);
+    auto deposit = [&](unsigned int w) {
+        std::vector<double>& mass = workerMass[w];
+        mass.assign((std::size_t)cells*cells, 0);
+        for (unsigned int b = (unsigned long)n*w/workers; b < (unsigned long)n*(w + 1)/workers; b++) {
+            const double u = (x[b] - originX)/cellSize;
+            const double v = (y[b] - originY)/cellSize;
+            const unsigned int i = (unsigned int)u;
+            const unsigned int j = (unsigned int)v;
+            const double wx = u - i;
+            const double wy = v - j;
+            double* node = mass.data() + (std::size_t)j*cells + i;
+            node[0] += m[b]*(1 - wx)*(1 - wy);
+            node[1] += m[b]*wx*(1 - wy);
+            node[cells] += m[b]*(1 - wx)*wy;
+            node[cells + 1] += m[b]*wx*wy;
+        }
+    };
+    auto reduce = [&](unsigned int w) {
+        for (unsigned int r = (unsigned long)P*w/workers; r < (unsigned long)P*(w + 1)/workers; r++) {
+            std::complex<double>* row = grid.data() + (std::size_t)r*P;
+            std::fill(row, row + P, std::complex<double>(0));
+            if (r >= cells) continue;
+            for (unsigned int i = 0; i < cells; i++) {
+                double sum = 0;
+                for (unsigned int v = 0; v < workers; v++) {
+                    sum += workerMass[v][(std::size_t)r*cells + i];
+                }
+                row[i] = sum;
+            }
+        }
+    };
+    if (pool) {
+        pool->runOnAll(deposit);
+        pool->runOnAll(reduce);
+    } else {
+        deposit(0);
+        reduce(0);
+    }
+
+    // State 3 (potential solved): The padded grid holds the convolution of the node masses with the kernel. Only the
+    // first cells rows are non-zero going in and needed coming out, so the other rows skip their row transforms.
+    this->transformRows(0, cells, false, pool);
+    this->transformColumns(false, pool);
+    auto convolve = [&](unsigned int w) {
+        for (std::size_t k = (std::size_t)P*P*w/workers; k < (std::size_t)P*P*(w + 1)/workers; k++) {
+            grid[k] *= kernelHat[k];
+        }
+    };
+    if (pool) pool->runOnAll(convolve);
+    else convolve(0);
+    this->transformColumns(true, pool);
+    this->transformRows(0, cells, true, pool);
+
+    // State 4 (field on the mesh): potentialGrid holds the potential at every node and accelX/accelY its centred
+    // differences, zero on the outermost nodes, which no body samples.
+    potentialGrid.resize((std::size_t)cells*cells);
+    accelX.assign((std::size_t)cells*cells, 0);
+    accelY.assign((std::size_t)cells*cells, 0);
+    auto extract = [&](unsigned int w) {
+        for (unsigned int j = (unsigned long)cells*w/workers; j < (unsigned long)cells*(w + 1)/workers; j++) {
+            for (unsigned int i = 0; i < cells; i++) {
+                potentialGrid[(std::size_t)j*cells + i] = grid[(std::size_t)j*P + i].real();
+            }
+        }
+    };
+    auto gradient = [&](unsigned int w) {
+        for (unsigned int j = std::max(1ul, (unsigned long)cells*w/workers);
+             j < std::min((unsigned long)cells - 1, (unsigned long)cells*(w + 1)/workers); j++) {
+            for (unsigned int i = 1; i < cells - 1; i++) {
+                const std::size_t k = (std::size_t)j*cells + i;
+                accelX[k] = (potentialGrid[k + 1] - potentialGrid[k - 1])/2;
+                accelY[k] = (potentialGrid[k + cells] - potentialGrid[k - cells])/2;
+            }
+        }
+    };
+    if (pool) {
+        pool->runOnAll(extract);
+        pool->runOnAll(gradient);
+    } else {
+        extract(0);
+        gradient(0);
+    }
+
+    // State 5 (chaining mesh sorted): With the short-range correction, the bodies are counting-sorted into square
+    // chain cells at least as wide as the cutoff, so every partner of a body lies in its own chain cell or the eight
+    // around it.
+    if (!shortRange) return;
+    chainCells = (unsigned int)std::ceil(CUTOFF_SCALES*SPLIT_SCALE);
+    chainSide = (cells + chainCells - 1)/chainCells;
+    const unsigned int numChains = chainSide*chainSide;
+    chainStart.assign(numChains + 1, 0);
+    chainOf.resize(n);
+    chained.resize(n);
+    for (unsigned int b = 0; b < n; b++) {
+        const unsigned int ci = (unsigned int)((x[b] - originX)/cellSize)/chainCells;
+        const unsigned int cj = (unsigned int)((y[b] - originY)/cellSize)/chainCells;
+        chainOf[b] = cj*chainSide + ci;
+        chainStart[chainOf[b]]++;
+    }
+    // Running totals make chainStart[c] the end of chain cell c; filling each cell from its end back moves it to the
+    // start, leaving the bodies of every cell in ascending order.
+    for (unsigned int c = 1; c < numChains; c++) {
+        chainStart[c] += chainStart[c - 1];
+    }
+    chainStart[numChains] = n;
+    for (unsigned int b = n; b-- > 0;) {
+        chained[--chainStart[chainOf[b]]] = b;
+    }
+}
+
+void ParticleMesh::shortRangeForce(unsigned int i, double eps2, double& Fx, double& Fy, double& U,
+                                   unsigned long& count) const {
+    // Add to body i the part of its force from every body within the cutoff that the mesh leaves out: the full pair
+    // force (softened like direct summation) minus the long-range part -G*erf(r/2rs)/r already on the mesh. Each pair
+    // is visited from both of its bodies, so only half of its potential energy is added here.
+    const double rs = SPLIT_SCALE*cellSize;
+    const double rcut2 = (CUTOFF_SCALES*rs)*(CUTOFF_SCALES*rs);
+    const double toTable = SPLIT_TABLE/rcut2;
+    const double forceUnit = 1/(rs*rs*rs);
+    const double potentialUnit = 1/rs;
+    const double xi = bx[i], yi = by[i], mi = bm[i];
+    const unsigned int ci = chainOf[i]%chainSide, cj = chainOf[i]/chainSide;
+    for (unsigned int nj = (cj > 0 ? cj - 1 : 0); nj <= std::min(cj + 1, chainSide - 1); nj++) {
+        for (unsigned int ni = (ci > 0 ? ci - 1 : 0); ni <= std::min(ci + 1, chainSide - 1); ni++) {
+            const unsigned int c = nj*chainSide + ni;
+            for (unsigned int k = chainStart[c]; k < chainStart[c + 1]; k++) {
+                const unsigned int j = chained[k];
+                const double dx = bx[j] - xi;
+                const double dy = by[j] - yi;
+                const double r2 = dx*dx + dy*dy;
+                if (j == i || r2 >= rcut2 || r2 == 0) continue;
+                count++;
+                const double sinv = 1/std::sqrt(r2 + eps2);
+                const double t = r2*toTable;
+                const unsigned int e = (unsigned int)t;
+                const double f = t - e;
+                const double smooth = forceUnit*((1 - f)*splitForce[e] + f*splitForce[e + 1]);
+                const double longRange = potentialUnit*((1 - f)*splitPotential[e] + f*splitPotential[e + 1]);
+                const double s = G*mi*bm[j]*(sinv*sinv*sinv - smooth);
+                Fx += s*dx;
+                Fy += s*dy;
+                U -= 0.5*G*mi*bm[j]*(sinv - longRange);
+            }
+        }
+    }
+}
+
+void ParticleMesh::accumulateForces(double* fx, double* fy, double eps2, ThreadPool* pool, double& potential,
+                                    unsigned long& interactions, const unsigned char* active) const {
+    // Abstract: Add the force from the last build() to every body, or, given an active mask, only to the bodies whose
+    //      flag is set. Each worker takes a contiguous range of bodies and writes only their entries. Without the
+    //      short-range correction eps2 is not used: the mesh already softens forces over a cell.
+    // Postcondition: fx/fy hold the added forces, potential the total potential energy (each body's interaction with
+    //      its own deposited mass taken out), and interactions the number of mesh samples and corrected pairs.
+    const unsigned int n = numBodies;
+    potential = 0;
+    interactions = 0;
+    if (n == 0) return;
+    const unsigned int workers = pool ? pool->size() : 1;
+    const double accelScale = G/(cellSize*cellSize);
+    const double potentialScale = -G/cellSize;
+    std::vector<double> partialU(workers, 0);
+    std::vector<unsigned long> partialCount(workers, 0);
+    auto part = [&](unsigned int w) {
+        double U = 0;
+        unsigned long count = 0;
+        for (unsigned int b = (unsigned long)n*w/workers; b < (unsigned long)n*(w + 1)/workers; b++) {
+            if (active && !active[b]) continue;
+            const double u = (bx[b] - originX)/cellSize;
+            const double v = (by[b] - originY)/cellSize;
+            const unsigned int i = (unsigned int)u;
+            const unsigned int j = (unsigned int)v;
+            const double wx = u - i;
+            const double wy = v - j;
+            const double w00 = (1 - wx)*(1 - wy), w10 = wx*(1 - wy), w01 = (1 - wx)*wy, w11 = wx*wy;
+            const std::size_t k = (std::size_t)j*cells + i;
+            const double ax = w00*accelX[k] + w10*accelX[k + 1] + w01*accelX[k + cells] + w11*accelX[k + cells + 1];
+            const double ay = w00*accelY[k] + w10*accelY[k + 1] + w01*accelY[k + cells] + w11*accelY[k + cells + 1];
+            const double phi = w00*potentialGrid[k] + w10*potentialGrid[k + 1] + w01*potentialGrid[k + cells]
+                               + w11*potentialGrid[k + cells + 1];
+            const double sx[2] = {(1 - wx)*(1 - wx) + wx*wx, 2*wx*(1 - wx)};
+            const double sy[2] = {(1 - wy)*(1 - wy) + wy*wy, 2*wy*(1 - wy)};
+            double self = 0;
+            for (unsigned int di = 0; di < 2; di++) {
+                for (unsigned int dj = 0; dj < 2; dj++) {
+                    self += sx[di]*sy[dj]*selfKernel[di][dj];
+                }
+            }
+            double Fx = bm[b]*accelScale*ax;
+            double Fy = bm[b]*accelScale*ay;
+            U += 0.5*potentialScale*bm[b]*(phi - bm[b]*self);
+            count++;
+            if (shortRange) this->shortRangeForce(b, eps2, Fx, Fy, U, count);
+            fx[b] += Fx;
+            fy[b] += Fy;
+        }
+        partialU[w] = U;
+        partialCount[w] = count;
+    };
+    if (pool) pool->runOnAll(part);
+    else part(0);
+    for (unsigned int w = 0; w < workers; w++) {
+        potential += partialU[w];
+        interactions += partialCount[w];
+    }
+}
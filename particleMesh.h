@@ -0,0 +1,74 @@
+#pragma once
+#include <vector>
+#include <complex>
+#include "threadPool.h"
+
+// ==========================================================================================
+// Particle-mesh force solver on a square 2D grid of cells x cells nodes, laid over the bodies' bounding box each step.
+// Masses are deposited onto the nodes with cloud-in-cell (CIC) weights, the potential at every node is found by
+// convolving the node masses with the -G/r kernel of Frame's force law through a zero-padded FFT (the padding makes the
+// convolution isolated rather than periodic, so distant images exert no force), accelerations are taken from the
+// potential by centred differences, and each body picks up the acceleration at its position with the same CIC
+// weights. Using one set of weights both ways makes the mesh force exactly antisymmetric, so momentum is conserved and
+// no body feels its own mass. The cost is O(N + cells^2 log cells) whatever the clustering.
+//
+// On its own the mesh resolves nothing smaller than about two cells; forces between closer bodies are smoothed. With
+// the short-range correction (P3M, Hockney & Eastwood 1988) the kernel is split at a scale rs of a little over a cell:
+// the mesh carries only the smooth long-range part, -G*erf(r/2rs)/r, and the remainder of every pair's force out to a
+// few rs is added by direct summation over neighbours found through a chaining mesh. Close encounters are then as exact
+// as in direct summation (including any Plummer softening), at the price of a pair loop whose length grows with the
+// number of bodies per cell.
+class ParticleMesh {
+public:
+    // Constructor
+    ParticleMesh() : cells(256), shortRange(false), kernelCells(0), kernelShortRange(false), cellSize(1),
+                     originX(0), originY(0), numBodies(0), bx(NULL), by(NULL), bm(NULL), chainCells(1), chainSide(0) {}
+
+    // Getters
+    unsigned int numCells() const { return cells; }
+    bool usesShortRangeCorrection() const { return shortRange; }
+
+    // Setters
+    void setResolution(unsigned int _cells, bool _shortRange);
+
+    // Member functions
+    void build(const double* x, const double* y, const double* m, unsigned int n, ThreadPool* pool);
+    void accumulateForces(double* fx, double* fy, double eps2, ThreadPool* pool, double& potential,
+                          unsigned long& interactions, const unsigned char* active = NULL) const;
+
+private:
+    void prepareKernel();
+    void fft(std::complex<double>* a, bool inverse) const;
+    void transformRows(unsigned int rowBegin, unsigned int rowEnd, bool inverse, ThreadPool* pool);
+    void transformColumns(bool inverse, ThreadPool* pool);
+    void shortRangeForce(unsigned int i, double eps2, double& Fx, double& Fy, double& U, unsigned long& count) const;
+
+    unsigned int cells;                 // nodes per side of the mesh, a power of two
+    bool shortRange;                    // whether the P3M short-range correction is applied
+
+    // Kernel for the current resolution, in units of one cell: the FFT of the -1/r kernel on the padded grid (scaled
+    // for the inverse transform), and selfKernel[|di|][|dj|], the kernel the mesh effectively applies between nodes
+    // di, dj apart, from which each body's interaction with its own deposited mass is found.
+    unsigned int kernelCells;
+    bool kernelShortRange;
+    std::vector<double> kernelHat;
+    double selfKernel[2][2];
+    std::vector<double> splitForce, splitPotential;  // long-range pair terms of the split (see prepareKernel)
+    std::vector<std::complex<double>> twiddles;     // e^{-2 pi i k/P} for the padded size P
+    std::vector<unsigned int> bitReverse;
+
+    // The mesh for the current positions
+    double cellSize, originX, originY;      // in meters; node (i, j) is at originX + i*cellSize, originY + j*cellSize
+    unsigned int numBodies;
+    const double *bx, *by, *bm;             // the arrays of the last build() call
+    std::vector<std::complex<double>> grid; // padded (2 cells)^2 work grid, row j = y
+    std::vector<std::vector<double>> workerMass;    // per-worker deposits, reduced in worker order
+    std::vector<std::vector<std::complex<double>>> workerColumn; // per-worker scratch column for the FFT
+    std::vector<double> potentialGrid, accelX, accelY;  // cells^2 each, in units of G*kg/cell and G*kg/cell^2
+
+    // Chaining mesh for the short-range correction: bodies sorted by chain cell, chain cells of at least the cutoff.
+    unsigned int chainCells, chainSide;
+    std::vector<unsigned int> chainStart;   // bodies of chain cell c are chained[chainStart[c]..chainStart[c+1])
+    std::vector<unsigned int> chained;      // body indices grouped by chain cell
+    std::vector<unsigned int> chainOf;      // chain cell of each body
+};
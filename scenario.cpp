@@ -0,0 +1,499 @@
+#include "scenario.h"
+#include "checkpoint.h"
+#include <charconv>
+#include <random>
+#include <thread>
+
+bool Scenario::populate(Frame& frame) {
+    // Abstract: Apply the settings to frame, which should have been constructed with this scenario's dt and history
+    //      policy, and move the bodies and tracers into it in bulk. Streaming and metrics are started last, so they
+    //      begin with the complete initial state.
+    // Postcondition: bodies and tracers are empty. Returns false if an output file could not be opened.
+    assert (frame.getDt() == dt);
+    frame.setIntegrator(integrator);
+    frame.setForceBackend(backend);
+    frame.setOpeningAngle(theta);
+    frame.setMeshResolution(meshCells, meshShortRange);
+    frame.setNumThreads(numThreads ? numThreads : std::max(1u, std::thread::hardware_concurrency()));
+    if (collisionResponse != COLLISIONS_IGNORED) frame.setCollisionResponse(collisionResponse, softening);
+    frame.addParticles(std::move(bodies));
+    frame.addTracers(tracers);
+    tracers.clear();
+    bool ok = true;
+    if (!streamFile.empty()) ok = frame.streamTrajectory(streamFile, streamStride) && ok;
+    if (!metricsFile.empty()) ok = frame.enableMetrics(metricsFile, metricsStride) && ok;
+    return ok;
+}
+
+// ==========================================================================================
+// Text scenarios
+
+namespace {
+
+const unsigned int MAX_TOKENS = 10;
+
+struct Token {
+    const char* begin;
+    const char* end;
+};
+
+unsigned int splitLine(const char* pos, const char* end, Token* tokens) {
+    // Postcondition: tokens[0..count) are the blank-separated words of [pos, end) before any '#'. Returns
+    //      MAX_TOKENS + 1 if the line has more words than fit.
+    unsigned int count = 0;
+    while (true) {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r')) pos++;
+        if (pos == end || *pos == '#') return count;
+        if (count == MAX_TOKENS) return MAX_TOKENS + 1;
+        tokens[count].begin = pos;
+        while (pos < end && *pos != ' ' && *pos != '\t' && *pos != '\r' && *pos != '#') pos++;
+        tokens[count].end = pos;
+        count++;
+    }
+}
+
+bool toNumber(const Token& t, double& out) {
+    std::from_chars_result res = std::from_chars(t.begin, t.end, out);
+    return res.ec == std::errc() && res.ptr == t.end && std::isfinite(out);
+}
+
+bool toCount(const Token& t, unsigned long& out) {
+    std::from_chars_result res = std::from_chars(t.begin, t.end, out);
+    return res.ec == std::errc() && res.ptr == t.end;
+}
+
+bool toUnsigned(const Token& t, unsigned int& out) {
+    unsigned long value;
+    if (!toCount(t, value) || value > std::numeric_limits<unsigned int>::max()) return false;
+    out = value;
+    return true;
+}
+
+bool is(const Token& t, const char* word) {
+    const std::size_t length = std::strlen(word);
+    return (std::size_t)(t.end - t.begin) == length && std::memcmp(t.begin, word, length) == 0;
+}
+
+bool toIntegrator(const Token& t, Integrator& out) {
+    const char* names[5] = {"LEFT_BOX_EULER", "VELOCITY_VERLET", "YOSHIDA_4", "RUNGE_KUTTA_4", "WISDOM_HOLMAN"};
+    const Integrator values[5] = {LEFT_BOX_EULER, VELOCITY_VERLET, YOSHIDA_4, RUNGE_KUTTA_4, WISDOM_HOLMAN};
+    for (unsigned int k = 0; k < 5; k++) {
+        if (is(t, names[k])) {
+            out = values[k];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parses numeric arguments tokens[first..count) into values, all of which must convert. Returns false otherwise.
+bool toNumbers(const Token* tokens, unsigned int first, unsigned int count, double* values) {
+    for (unsigned int k = first; k < count; k++) {
+        if (!toNumber(tokens[k], values[k - first])) return false;
+    }
+    return true;
+}
+
+bool fail(std::string& why, const std::string& message) {
+    why = message;
+    return false;
+}
+
+bool parseLine(const Token* t, unsigned int count, Scenario& scenario, unsigned int* generated, std::string& why) {
+    // Postcondition: scenario reflects the directive in t[0..count). On failure, why describes the problem.
+    double v[MAX_TOKENS];
+    unsigned long n;
+    unsigned long seed = 0;
+    if (is(t[0], "dt")) {
+        if (count != 2 || !toNumber(t[1], scenario.dt) || !(scenario.dt > 0)) return fail(why, "expected 'dt <seconds>'");
+    } else if (is(t[0], "steps")) {
+        if (count != 2 || !toCount(t[1], scenario.numSteps)) return fail(why, "expected 'steps <count>'");
+    } else if (is(t[0], "integrator")) {
+        if (count != 2 || !toIntegrator(t[1], scenario.integrator)) return fail(why, "unknown integrator");
+    } else if (is(t[0], "backend")) {
+        if (count == 2 && is(t[1], "DIRECT_SUMMATION")) {
+            scenario.backend = DIRECT_SUMMATION;
+        } else if ((count == 2 || count == 3) && is(t[1], "BARNES_HUT")) {
+            scenario.backend = BARNES_HUT;
+            if (count == 3 && (!toNumber(t[2], scenario.theta) || scenario.theta < 0)) return fail(why, "bad opening angle");
+        } else if (count >= 2 && count <= 4 && is(t[1], "PARTICLE_MESH")) {
+            scenario.backend = PARTICLE_MESH;
+            scenario.meshShortRange = is(t[count - 1], "P3M");
+            const unsigned int cellTokens = count - 2 - (scenario.meshShortRange ? 1 : 0);
+            if (cellTokens == 1 && (!toUnsigned(t[2], scenario.meshCells) || scenario.meshCells < 16
+                                    || (scenario.meshCells & (scenario.meshCells - 1)))) {
+                return fail(why, "mesh cells must be a power of two, at least 16");
+            }
+            if (cellTokens > 1) return fail(why, "expected 'backend PARTICLE_MESH [cells] [P3M]'");
+        } else {
+            return fail(why, "expected 'backend DIRECT_SUMMATION', 'backend BARNES_HUT [theta]' or "
+                             "'backend PARTICLE_MESH [cells] [P3M]'");
+        }
+    } else if (is(t[0], "threads")) {
+        if (count != 2 || !toUnsigned(t[1], scenario.numThreads)) return fail(why, "expected 'threads <count>'");
+    } else if (is(t[0], "collisions")) {
+        if (count == 2 && is(t[1], "MERGE")) {
+            scenario.collisionResponse = COLLISION_MERGE;
+        } else if (count == 2 && is(t[1], "BOUNCE")) {
+            scenario.collisionResponse = COLLISION_BOUNCE;
+        } else {
+            return fail(why, "expected 'collisions MERGE' or 'collisions BOUNCE'");
+        }
+    } else if (is(t[0], "softening")) {
+        if (count != 2 || !toNumber(t[1], scenario.softening) || !(scenario.softening > 0)) {
+            return fail(why, "expected 'softening <meters>'");
+        }
+        scenario.collisionResponse = COLLISION_SOFTEN;
+    } else if (is(t[0], "history")) {
+        unsigned int stride, capacity = 0;
+        if (count == 2 && is(t[1], "all")) {
+            scenario.history = HistoryPolicy::keepAll();
+        } else if (count == 2 && is(t[1], "current")) {
+            scenario.history = HistoryPolicy::currentOnly();
+        } else if ((count == 3 || count == 4) && is(t[1], "every") && toUnsigned(t[2], stride) && stride > 0
+                   && (count == 3 || toUnsigned(t[3], capacity))) {
+            scenario.history = HistoryPolicy::everyNthStep(stride, capacity);
+        } else {
+            return fail(why, "expected 'history all', 'history current' or 'history every <N> [capacity]'");
+        }
+    } else if (is(t[0], "stream") || is(t[0], "metrics")) {
+        unsigned int stride;
+        if (count != 3 || !toUnsigned(t[2], stride) || stride == 0) return fail(why, "expected '<file> <every N steps>'");
+        const bool stream = is(t[0], "stream");
+        (stream ? scenario.streamFile : scenario.metricsFile).assign(t[1].begin, t[1].end);
+        (stream ? scenario.streamStride : scenario.metricsStride) = stride;
+    } else if (is(t[0], "body")) {
+        v[5] = 0;
+        if ((count != 7 && count != 8) || !toNumbers(t, 2, count, v) || !(v[0] > 0) || v[5] < 0) {
+            return fail(why, "expected 'body <ID> <mass> <x> <y> <vx> <vy> [radius]'");
+        }
+        scenario.bodies.push_back(Particle(std::string(t[1].begin, t[1].end), v[0], std::make_pair(v[1], v[2]),
+                                           std::make_pair(v[3], v[4]), v[5]));
+    } else if (is(t[0], "tracer")) {
+        if (count != 6 || !toNumbers(t, 2, count, v)) return fail(why, "expected 'tracer <ID> <x> <y> <vx> <vy>'");
+        scenario.tracers.push_back(Particle(std::string(t[1].begin, t[1].end), 0, std::make_pair(v[0], v[1]),
+                                            std::make_pair(v[2], v[3])));
+    } else if (is(t[0], "plummer")) {
+        if ((count != 4 && count != 5) || !toCount(t[1], n) || !toNumbers(t, 2, 4, v) || (count == 5 && !toCount(t[4], seed))
+                || n == 0 || !(v[0] > 0) || !(v[1] > 0)) {
+            return fail(why, "expected 'plummer <N> <mass> <a> [seed]'");
+        }
+        generatePlummerSphere(scenario.bodies, n, v[0], v[1], seed, "plummer", generated[0]);
+        generated[0] += n;
+    } else if (is(t[0], "disk")) {
+        if ((count != 6 && count != 7) || !toCount(t[1], n) || !toNumbers(t, 2, 6, v) || (count == 7 && !toCount(t[6], seed))
+                || n == 0 || v[0] < 0 || v[1] < 0 || !(v[2] > 0) || !(v[3] > v[2])) {
+            return fail(why, "expected 'disk <N> <M_c> <M_disk> <r_in> <r_out> [seed]' with 0 < r_in < r_out");
+        }
+        generateKeplerianDisk(scenario.bodies, n, v[0], v[1], v[2], v[3], seed, "disk", generated[1]);
+        generated[1] += n;
+    } else if (is(t[0], "belt")) {
+        if ((count != 7 && count != 8) || !toCount(t[1], n) || !toNumbers(t, 2, 7, v) || (count == 8 && !toCount(t[7], seed))
+                || n == 0 || !(v[0] > 0) || !(v[1] > 0) || !(v[2] >= v[1]) || v[3] < 0 || !(v[3] < 1) || v[4] < 0) {
+            return fail(why, "expected 'belt <N> <M_c> <r_in> <r_out> <e_max> <m> [seed]' with e_max < 1");
+        }
+        generateAsteroidBelt((v[4] == 0) ? scenario.tracers : scenario.bodies, n, v[0], v[1], v[2], v[3], v[4], seed,
+                             "belt", generated[2]);
+        generated[2] += n;
+    } else {
+        return fail(why, "unknown directive '" + std::string(t[0].begin, t[0].end) + "'");
+    }
+    return true;
+}
+
+bool parseTextScenario(const char* text, std::size_t length, Scenario& scenario, std::string& error) {
+    // One pass over the mapped file, a line at a time. Generated bodies are appended as their directive is reached,
+    // so slot order follows the file.
+    const char* cursor = text;
+    const char* end = text + length;
+    unsigned int lineNumber = 0;
+    unsigned int generated[3] = {0, 0, 0};  // bodies made so far by plummer, disk and belt, numbering their IDs
+    Token tokens[MAX_TOKENS];
+    std::string why;
+    while (cursor < end) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(cursor, '\n', end - cursor));
+        if (!lineEnd) lineEnd = end;
+        lineNumber++;
+        const unsigned int count = splitLine(cursor, lineEnd, tokens);
+        cursor = lineEnd + 1;
+        if (count == 0) continue;
+        if (count > MAX_TOKENS) why = "too many fields";
+        if (count > MAX_TOKENS || !parseLine(tokens, count, scenario, generated, why)) {
+            error = "line " + std::to_string(lineNumber) + ": " + why;
+            return false;
+        }
+    }
+    if (!(scenario.dt > 0)) {
+        error = "no 'dt' directive";
+        return false;
+    }
+    return true;
+}
+
+// ==========================================================================================
+// Binary scenarios
+
+bool readBinaryScenario(const char* bytes, std::size_t size, Scenario& scenario, std::string& error) {
+    ScenarioHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+    const unsigned int n = header.numBodies;
+    const unsigned int M = header.numTracers;
+    if (header.version != SCENARIO_FORMAT_VERSION) {
+        error = "unsupported scenario version " + std::to_string(header.version);
+        return false;
+    }
+    if (size < sizeof(header) + (6*(std::size_t)n + 4*(std::size_t)M)*sizeof(double) || !(header.dt > 0)
+            || header.historyStride == 0 || header.integrator > WISDOM_HOLMAN || header.backend > PARTICLE_MESH
+            || header.collisionResponse > COLLISION_SOFTEN || header.meshCells < 16
+            || (header.meshCells & (header.meshCells - 1))
+            || (header.collisionResponse == COLLISION_SOFTEN && !(header.softening > 0))) {
+        error = "corrupt scenario header";
+        return false;
+    }
+
+    // State 1 (strings read): IDs[0..n) name the bodies, IDs[n..n+M) the tracers, followed by the two file names.
+    const char* arrays = bytes + sizeof(header);
+    const char* tracerArrays = arrays + 6*(std::size_t)n*sizeof(double);
+    const char* cursor = tracerArrays + 4*(std::size_t)M*sizeof(double);
+    const char* end = bytes + size;
+    std::vector<std::string> strings(n + M + 2);
+    for (unsigned int i = 0; i < n + M + 2; i++) {
+        std::uint32_t length;
+        if ((std::size_t)(end - cursor) < sizeof(length)) return fail(error, "truncated scenario");
+        std::memcpy(&length, cursor, sizeof(length));
+        cursor += sizeof(length);
+        if ((std::size_t)(end - cursor) < length) return fail(error, "truncated scenario");
+        strings[i].assign(cursor, length);
+        cursor += length;
+    }
+    if ((!strings[n + M].empty() && header.streamStride == 0)
+            || (!strings[n + M + 1].empty() && header.metricsStride == 0)) {
+        return fail(error, "corrupt scenario header");
+    }
+
+    // State 2 (scenario filled): Settings and Particles match the file.
+    scenario.dt = header.dt;
+    scenario.numSteps = header.numSteps;
+    scenario.integrator = (Integrator)header.integrator;
+    scenario.backend = (ForceBackend)header.backend;
+    scenario.theta = header.theta;
+    scenario.meshCells = header.meshCells;
+    scenario.meshShortRange = header.meshShortRange != 0;
+    scenario.numThreads = header.numThreads;
+    scenario.collisionResponse = (CollisionResponse)header.collisionResponse;
+    scenario.softening = header.softening;
+    scenario.history = HistoryPolicy(header.historyStride, header.historyCapacity);
+    scenario.streamFile = std::move(strings[n + M]);
+    scenario.streamStride = header.streamStride;
+    scenario.metricsFile = std::move(strings[n + M + 1]);
+    scenario.metricsStride = header.metricsStride;
+    const double* column[6];
+    for (unsigned int a = 0; a < 6; a++) {
+        column[a] = reinterpret_cast<const double*>(arrays + a*(std::size_t)n*sizeof(double));
+    }
+    scenario.bodies.clear();
+    scenario.bodies.reserve(n);
+    for (unsigned int i = 0; i < n; i++) {
+        scenario.bodies.push_back(Particle(std::move(strings[i]), column[0][i], std::make_pair(column[1][i], column[2][i]),
+                                           std::make_pair(column[3][i], column[4][i]), column[5][i]));
+    }
+    for (unsigned int a = 0; a < 4; a++) {
+        column[a] = reinterpret_cast<const double*>(tracerArrays + a*(std::size_t)M*sizeof(double));
+    }
+    scenario.tracers.clear();
+    scenario.tracers.reserve(M);
+    for (unsigned int k = 0; k < M; k++) {
+        scenario.tracers.push_back(Particle(std::move(strings[n + k]), 0, std::make_pair(column[0][k], column[1][k]),
+                                            std::make_pair(column[2][k], column[3][k])));
+    }
+    return true;
+}
+
+}
+
+bool loadScenario(const std::string& filename, Scenario& scenario, std::string& error) {
+    MappedFile file(filename);
+    if (!file.isOpen()) {
+        error = "cannot open " + filename;
+        return false;
+    }
+    scenario = Scenario();
+    if (file.size() >= sizeof(ScenarioHeader) && !std::memcmp(file.bytes(), SCENARIO_MAGIC, sizeof(SCENARIO_MAGIC))) {
+        return readBinaryScenario(file.bytes(), file.size(), scenario, error);
+    }
+    return parseTextScenario(file.bytes(), file.size(), scenario, error);
+}
+
+bool saveScenarioBinary(const std::string& filename, const Scenario& scenario) {
+    const unsigned int n = scenario.bodies.size();
+    const unsigned int M = scenario.tracers.size();
+    ScenarioHeader header;
+    std::memcpy(header.magic, SCENARIO_MAGIC, sizeof(header.magic));
+    header.version = SCENARIO_FORMAT_VERSION;
+    header.numBodies = n;
+    header.numTracers = M;
+    header.integrator = scenario.integrator;
+    header.backend = scenario.backend;
+    header.numThreads = scenario.numThreads;
+    header.dt = scenario.dt;
+    header.numSteps = scenario.numSteps;
+    header.theta = scenario.theta;
+    header.softening = scenario.softening;
+    header.collisionResponse = scenario.collisionResponse;
+    header.historyStride = scenario.history.stride;
+    header.historyCapacity = scenario.history.capacity;
+    header.streamStride = scenario.streamStride;
+    header.metricsStride = scenario.metricsStride;
+    header.meshCells = scenario.meshCells;
+    header.meshShortRange = scenario.meshShortRange;
+    header.reserved = 0;
+
+    std::size_t stringBytes = 2*sizeof(std::uint32_t) + scenario.streamFile.size() + scenario.metricsFile.size();
+    for (unsigned int i = 0; i < n + M; i++) {
+        stringBytes += sizeof(std::uint32_t) + ((i < n) ? scenario.bodies[i] : scenario.tracers[i - n]).getID().size();
+    }
+    std::vector<char> image(sizeof(header) + (6*(std::size_t)n + 4*(std::size_t)M)*sizeof(double) + stringBytes);
+    char* out = image.data();
+    std::memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    double* columns = reinterpret_cast<double*>(out);  // image.data() is suitably aligned and the header is a multiple of 8 bytes
+    for (unsigned int i = 0; i < n; i++) {
+        const Particle& p = scenario.bodies[i];
+        columns[i] = p.getMass();
+        columns[n + i] = p.getCurrentPos().first;
+        columns[2*n + i] = p.getCurrentPos().second;
+        columns[3*n + i] = p.getCurrentVel().first;
+        columns[4*n + i] = p.getCurrentVel().second;
+        columns[5*n + i] = p.getRadius();
+    }
+    columns += 6*(std::size_t)n;
+    for (unsigned int k = 0; k < M; k++) {
+        const Particle& p = scenario.tracers[k];
+        columns[k] = p.getCurrentPos().first;
+        columns[M + k] = p.getCurrentPos().second;
+        columns[2*M + k] = p.getCurrentVel().first;
+        columns[3*M + k] = p.getCurrentVel().second;
+    }
+    out += (6*(std::size_t)n + 4*(std::size_t)M)*sizeof(double);
+    for (unsigned int i = 0; i < n + M + 2; i++) {
+        const std::string& s = (i < n) ? scenario.bodies[i].getID()
+                             : (i < n + M) ? scenario.tracers[i - n].getID()
+                             : (i == n + M) ? scenario.streamFile : scenario.metricsFile;
+        std::uint32_t length = s.size();
+        std::memcpy(out, &length, sizeof(length));
+        std::memcpy(out + sizeof(length), s.data(), length);
+        out += sizeof(length) + length;
+    }
+    return writeFileAtomically(filename, image);
+}
+
+// ==========================================================================================
+// Initial-condition generators
+
+static std::string generatedID(const std::string& prefix, unsigned int index) {
+    return prefix + std::to_string(index);
+}
+
+static void isotropicProjection(std::mt19937_64& rng, double length, double& x, double& y) {
+    // Postcondition: (x, y) is the projection onto the plane of a vector of the given length pointing in a random
+    //      direction in three dimensions.
+    std::uniform_real_distribution<double> unit(0, 1);
+    const double cosTheta = 2*unit(rng) - 1;
+    const double phi = 2*M_PI*unit(rng);
+    const double planar = length*std::sqrt(1 - cosTheta*cosTheta);
+    x = planar*std::cos(phi);
+    y = planar*std::sin(phi);
+}
+
+void generatePlummerSphere(std::vector<Particle>& out, unsigned int n, double totalMass, double a, unsigned long seed,
+                           const std::string& prefix, unsigned int firstIndex) {
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> unit(0, 1);
+    const double m = totalMass/n;
+    const std::size_t first = out.size();
+    out.reserve(first + n);
+
+    // State 1 (sampled): Radii follow the inverted cumulative mass, and speeds q*v_escape with q drawn by rejection
+    //      from g(q) = q^2 (1 - q^2)^3.5, whose maximum is below 0.1.
+    double px = 0, py = 0, pvx = 0, pvy = 0;
+    for (unsigned int k = 0; k < n; k++) {
+        double r;
+        do {
+            r = a/std::sqrt(std::pow(unit(rng), -2.0/3.0) - 1);
+        } while (!(r <= 20*a));
+        double q, g;
+        do {
+            q = unit(rng);
+            g = 0.1*unit(rng);
+        } while (g > q*q*std::pow(1 - q*q, 3.5));
+        const double v = q*std::sqrt(2*G*totalMass)*std::pow(r*r + a*a, -0.25);
+        double x, y, vx, vy;
+        isotropicProjection(rng, r, x, y);
+        isotropicProjection(rng, v, vx, vy);
+        px += x; py += y; pvx += vx; pvy += vy;
+        out.push_back(Particle(generatedID(prefix, firstIndex + k), m, std::make_pair(x, y), std::make_pair(vx, vy)));
+    }
+
+    // State 2 (centred): The equal-mass centre of mass and its velocity are subtracted from every body.
+    px /= n; py /= n; pvx /= n; pvy /= n;
+    for (std::size_t k = first; k < out.size(); k++) {
+        std::pair<double, double> pos = out[k].getCurrentPos();
+        std::pair<double, double> vel = out[k].getCurrentVel();
+        out[k] = Particle(out[k].getID(), m, std::make_pair(pos.first - px, pos.second - py),
+                          std::make_pair(vel.first - pvx, vel.second - pvy));
+    }
+}
+
+void generateKeplerianDisk(std::vector<Particle>& out, unsigned int n, double centralMass, double diskMass,
+                           double rInner, double rOuter, unsigned long seed, const std::string& prefix,
+                           unsigned int firstIndex) {
+    // A 1/r surface density puts equal mass in equal widths of radius, so radii are uniform and the enclosed disk mass
+    // grows linearly from rInner. Orbits are counter-clockwise.
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> radius(rInner, rOuter);
+    std::uniform_real_distribution<double> angle(0, 2*M_PI);
+    const double m = diskMass/n;
+    out.reserve(out.size() + n);
+    for (unsigned int k = 0; k < n; k++) {
+        const double r = radius(rng);
+        const double phi = angle(rng);
+        const double enclosed = centralMass + diskMass*(r - rInner)/(rOuter - rInner);
+        const double v = std::sqrt(G*enclosed/r);
+        const double c = std::cos(phi), s = std::sin(phi);
+        out.push_back(Particle(generatedID(prefix, firstIndex + k), m, std::make_pair(r*c, r*s),
+                               std::make_pair(-v*s, v*c)));
+    }
+}
+
+void generateAsteroidBelt(std::vector<Particle>& out, unsigned int n, double centralMass, double rInner, double rOuter,
+                          double maxEccentricity, double bodyMass, unsigned long seed, const std::string& prefix,
+                          unsigned int firstIndex) {
+    // Each orbit is placed in its perifocal frame from the eccentric anomaly, found from Kepler's equation
+    // M = E - e sin E by Newton's method, then rotated by the argument of periapsis. Orbits are counter-clockwise.
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> axis(rInner, rOuter);
+    std::uniform_real_distribution<double> eccentricity(0, maxEccentricity);
+    std::uniform_real_distribution<double> angle(0, 2*M_PI);
+    const double mu = G*centralMass;
+    out.reserve(out.size() + n);
+    for (unsigned int k = 0; k < n; k++) {
+        const double a = axis(rng);
+        const double e = eccentricity(rng);
+        const double omega = angle(rng);
+        const double meanAnomaly = angle(rng);
+        double E = (e < 0.8) ? meanAnomaly : M_PI;
+        for (unsigned int iter = 0; iter < 50; iter++) {
+            const double delta = (E - e*std::sin(E) - meanAnomaly)/(1 - e*std::cos(E));
+            E -= delta;
+            if (std::fabs(delta) < 1e-15) break;
+        }
+        const double cosE = std::cos(E), sinE = std::sin(E);
+        const double root = std::sqrt(1 - e*e);
+        const double speed = std::sqrt(mu/a)/(1 - e*cosE);
+        const double x = a*(cosE - e), y = a*root*sinE;
+        const double vx = -speed*sinE, vy = speed*root*cosE;
+        const double c = std::cos(omega), s = std::sin(omega);
+        out.push_back(Particle(generatedID(prefix, firstIndex + k), bodyMass, std::make_pair(c*x - s*y, s*x + c*y),
+                               std::make_pair(c*vx - s*vy, s*vx + c*vy)));
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include "modelClasses.h"
+
+// ==========================================================================================
+// Scenario files: everything needed to set up and run a Frame, so a run can be changed without recompiling. Two
+// encodings are read by loadScenario(), which tells them apart by the binary magic. Both are memory mapped.
+//
+// Text: one directive per line, tokens separated by blanks, '#' starts a comment. IDs are single tokens.
+//      dt 3600                         seconds per step (required)
+//      steps 8760                      number of steps main.cpp's -scenario runs (default 0)
+//      integrator VELOCITY_VERLET      any Integrator name (default LEFT_BOX_EULER)
+//      backend BARNES_HUT 0.5          DIRECT_SUMMATION, or BARNES_HUT with an optional opening angle
+//      backend PARTICLE_MESH 512 P3M   PARTICLE_MESH with optional mesh cells and short-range correction (default 256)
+//      threads 0                       worker count; 0 means one per hardware thread (default 1)
+//      collisions MERGE                MERGE or BOUNCE (see Frame::setCollisionResponse)
+//      softening 1e6                   COLLISION_SOFTEN with this softening length, in meters
+//      history current                 all, current, or every N [capacity] (see HistoryPolicy; default all)
+//      stream out.traj 100             stream every 100th step to out.traj (see Frame::streamTrajectory)
+//      metrics out.txt 10              log metrics every 10th step to out.txt (see Frame::enableMetrics)
+//      body ID mass x y vx vy [radius] one Particle, in SI units; massless bodies are tracers
+//      tracer ID x y vx vy             one massless tracer (see Frame::addTracer)
+//      plummer N mass a [seed]         generators, see below. Generated IDs are the generator name followed by a
+//      disk N M_c M_disk r_in r_out [seed]             running number, e.g. disk0, disk1, ...
+//      belt N M_c r_in r_out e_max m [seed]         seeds default to 0; a belt with m = 0 is added as tracers
+//
+// Binary: a ScenarioHeader, then six arrays of numBodies doubles (m, x, y, vx, vy, radius), four arrays of
+//      numTracers doubles (x, y, vx, vy), then the numBodies + numTracers IDs and finally the stream and metrics file
+//      names, each as a uint32 length and its bytes. Written by saveScenarioBinary(); a million-body scenario converted
+//      once loads in about 60% of the time of its text form.
+
+const std::uint32_t SCENARIO_FORMAT_VERSION = 2;
+const char SCENARIO_MAGIC[8] = {'A', 'D', 'S', 'C', 'E', 'N', 0, 0};
+
+struct ScenarioHeader {
+    char magic[8];                  // SCENARIO_MAGIC
+    std::uint32_t version;          // SCENARIO_FORMAT_VERSION
+    std::uint32_t numBodies;
+    std::uint32_t numTracers;
+    std::uint32_t integrator;       // Integrator enum value
+    std::uint32_t backend;          // ForceBackend enum value
+    std::uint32_t numThreads;
+    double dt;
+    std::uint64_t numSteps;
+    double theta;
+    double softening;
+    std::uint32_t collisionResponse;    // CollisionResponse enum value
+    std::uint32_t historyStride;
+    std::uint32_t historyCapacity;
+    std::uint32_t streamStride;
+    std::uint32_t metricsStride;
+    std::uint32_t meshCells;            // particle-mesh resolution (this and the next added in version 2)
+    std::uint32_t meshShortRange;       // nonzero for the short-range correction
+    std::uint32_t reserved;             // zero; keeps the header a multiple of 8 bytes
+};
+static_assert(sizeof(ScenarioHeader) == 96, "scenario header layout must not depend on padding");
+
+struct Scenario {
+    // Constructor
+    Scenario() : dt(0), numSteps(0), integrator(LEFT_BOX_EULER), backend(DIRECT_SUMMATION), theta(0.5), meshCells(256),
+                 meshShortRange(false), numThreads(1), collisionResponse(COLLISIONS_IGNORED), softening(0),
+                 streamStride(1), metricsStride(1) {}
+
+    // Member functions
+    bool populate(Frame& frame);
+
+    double dt;
+    unsigned long numSteps;
+    Integrator integrator;
+    ForceBackend backend;
+    double theta;
+    unsigned int meshCells;
+    bool meshShortRange;
+    unsigned int numThreads;        // 0 means std::thread::hardware_concurrency()
+    CollisionResponse collisionResponse;
+    double softening;
+    HistoryPolicy history;
+    std::string streamFile;         // empty for no streaming
+    unsigned int streamStride;
+    std::string metricsFile;        // empty for no metrics
+    unsigned int metricsStride;
+    std::vector<Particle> bodies;
+    std::vector<Particle> tracers;
+};
+
+// Abstract: Read a text or binary scenario file.
+// Postcondition: Returns whether filename was a valid scenario. On failure, error says why (with the line number for
+//      text files) and scenario is left in an unspecified state.
+bool loadScenario(const std::string& filename, Scenario& scenario, std::string& error);
+
+// Abstract: Write scenario in the binary encoding, atomically (see writeFileAtomically).
+// Postcondition: Returns whether filename now holds it.
+bool saveScenarioBinary(const std::string& filename, const Scenario& scenario);
+
+// ==========================================================================================
+// Initial-condition generators. Each appends n Particles with IDs prefix + (firstIndex + k), drawn from a
+// std::mt19937_64 seeded with seed, so a scenario generates the same bodies every time it is loaded. All are centred on
+// the origin; the disk and the belt orbit a central mass there, which they do not add themselves.
+
+// Plummer sphere of total mass totalMass and scale radius a (Aarseth, Henon & Wielen 1974), truncated at 20a and
+// projected onto the plane. The projection is not an exact equilibrium of the planar model, but starts close to one.
+// Positions and velocities are shifted so the centre of mass is at rest at the origin.
+void generatePlummerSphere(std::vector<Particle>& out, unsigned int n, double totalMass, double a, unsigned long seed,
+                           const std::string& prefix, unsigned int firstIndex = 0);
+
+// Disk of n equal masses totalling diskMass, with surface density falling as 1/r between rInner and rOuter, on
+// circular orbits in the field of centralMass plus the disk mass inside each radius.
+void generateKeplerianDisk(std::vector<Particle>& out, unsigned int n, double centralMass, double diskMass,
+                           double rInner, double rOuter, unsigned long seed, const std::string& prefix,
+                           unsigned int firstIndex = 0);
+
+// Asteroid belt of n bodies of mass bodyMass on Kepler orbits about centralMass, with semi-major axes uniform in
+// [rInner, rOuter], eccentricities uniform in [0, maxEccentricity], and random orientations and phases.
+void generateAsteroidBelt(std::vector<Particle>& out, unsigned int n, double centralMass, double rInner, double rOuter,
+                          double maxEccentricity, double bodyMass, unsigned long seed, const std::string& prefix,
+                          unsigned int firstIndex = 0);
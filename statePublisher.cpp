@@ -0,0 +1,78 @@
+#include "statePublisher.h"
+#include <cassert>
+
+void StateSnapshot::clear() {
+    // Postcondition: The snapshot is empty but keeps its storage.
+    time = 0;
+    step = 0;
+    m.clear();
+    x.clear();
+    y.clear();
+    vx.clear();
+    vy.clear();
+    IDs.reset();
+}
+
+StatePublisher::StatePublisher(unsigned int maxReaders) : published(0) {
+    assert (maxReaders > 0);
+    for (unsigned int c = 0; c < maxReaders; c++) {
+        channels.emplace_back(new Channel());
+    }
+}
+
+void StatePublisher::publish(double time, unsigned long step, unsigned int n, const double* m, const double* x,
+                             const double* y, const double* vx, const double* vy,
+                             const std::shared_ptr<const std::vector<std::string>>& IDs) {
+    // Abstract: Hand a copy of the given state to every attached reader. Only the step loop's thread may call this.
+    //      Nothing here waits on a reader; once a channel's buffers have grown to n bodies nothing allocates either.
+    // Postcondition: Each attached reader's next poll() returns this snapshot (unless a newer one replaces it first).
+    for (unsigned int c = 0; c < channels.size(); c++) {
+        Channel& channel = *channels[c];
+        if (!channel.attached.load(std::memory_order_acquire)) continue;
+        StateSnapshot& back = channel.buffers[channel.back];
+        back.time = time;
+        back.step = step;
+        back.m.assign(m, m + n);
+        back.x.assign(x, x + n);
+        back.y.assign(y, y + n);
+        back.vx.assign(vx, vx + n);
+        back.vy.assign(vy, vy + n);
+        back.IDs = IDs;
+        channel.back = channel.middle.exchange(channel.back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+    }
+    published.fetch_add(1, std::memory_order_relaxed);
+}
+
+StateReader::StateReader(const std::shared_ptr<StatePublisher>& _publisher) : publisher(_publisher), channel(NULL) {
+    // Claim the first free channel. A previous reader may have left snapshots in it, so any fresh one is taken and
+    // discarded along with what it last saw: a new reader sees nothing until the next snapshot is published.
+    for (unsigned int c = 0; c < publisher->channels.size(); c++) {
+        bool expected = false;
+        if (publisher->channels[c]->attached.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+            channel = publisher->channels[c].get();
+            this->poll();
+            channel->buffers[channel->front].clear();
+            return;
+        }
+    }
+}
+
+StateReader::~StateReader() {
+    if (channel) channel->attached.store(false, std::memory_order_release);
+}
+
+const StateSnapshot& StateReader::snapshot() const {
+    // Postcondition: Returns the snapshot taken by the last successful poll(), or an empty one if there was none.
+    //      It stays unchanged until the next poll() by this reader.
+    assert (channel);
+    return channel->buffers[channel->front];
+}
+
+bool StateReader::poll() {
+    // Abstract: Take the newest published snapshot, if one has been published since the last poll().
+    // Postcondition: Returns whether snapshot() now shows a newer state. Never blocks.
+    assert (channel);
+    if (!(channel->middle.load(std::memory_order_relaxed) & StatePublisher::FRESH)) return false;
+    channel->front = channel->middle.exchange(channel->front, std::memory_order_acq_rel) & ~StatePublisher::FRESH;
+    return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+
+// ==========================================================================================
+// Live state publishing (see Frame::publishState). Every few steps the step loop copies the current state of the
+// bodies into a StateSnapshot, and any number of reader threads (up to a fixed maximum) pick up the newest one without
+// ever taking a lock or making the step loop wait.
+//
+// Each attached reader owns a channel of three snapshot buffers (a triple buffer): the publisher fills its back
+// buffer and swaps it with the middle one in a single atomic exchange, and the reader swaps the middle one with the
+// buffer it is reading from whenever a fresher one is there. A reader therefore always holds a complete, immutable
+// snapshot, and a slow reader simply skips the snapshots published while it was busy. Publishing costs one copy of
+// the state per attached reader; steps that do not publish cost a single comparison. Tracers are not published.
+
+struct StateSnapshot {
+    // Constructor
+    StateSnapshot() : time(0), step(0) {}
+
+    // Member functions
+    unsigned int size() const { return x.size(); }
+    void clear();
+
+    double time;                    // Frame time of the snapshot, in seconds
+    unsigned long step;             // Frame step count of the snapshot
+    std::vector<double> m, x, y, vx, vy;                // per slot, in SI units
+    std::shared_ptr<const std::vector<std::string>> IDs;    // ID of each slot, shared until the bodies change
+};
+
+class StatePublisher {
+public:
+    // Constructor
+    explicit StatePublisher(unsigned int maxReaders = 4);
+    StatePublisher(const StatePublisher&) = delete;
+    StatePublisher& operator= (const StatePublisher&) = delete;
+
+    // Getters
+    unsigned int maxReaders() const { return channels.size(); }
+    unsigned long snapshotsPublished() const { return published.load(std::memory_order_relaxed); }
+
+    // Member functions
+    void publish(double time, unsigned long step, unsigned int n, const double* m, const double* x, const double* y,
+                 const double* vx, const double* vy, const std::shared_ptr<const std::vector<std::string>>& IDs);
+
+private:
+    friend class StateReader;
+
+    // The buffer indices are a permutation of 0..2: back belongs to the publisher, front to the reader, and middle is
+    // exchanged between them. FRESH is set in middle when it holds a snapshot the reader has not taken yet.
+    static const unsigned int FRESH = 4;
+    struct Channel {
+        Channel() : attached(false), middle(1), back(2), front(0) {}
+        alignas(64) std::atomic<bool> attached;
+        alignas(64) std::atomic<unsigned int> middle;
+        unsigned int back;
+        alignas(64) unsigned int front;
+        StateSnapshot buffers[3];
+    };
+
+    std::vector<std::unique_ptr<Channel>> channels;
+    std::atomic<unsigned long> published;
+};
+
+// A reader thread's view of a StatePublisher. Attaching claims one of the publisher's channels, and the reader sees
+// the snapshots published from then on. The reader keeps the publisher alive, so it may outlive the Frame.
+class StateReader {
+public:
+    // Constructor
+    // Check isAttached(): attaching fails when every channel is already taken.
+    explicit StateReader(const std::shared_ptr<StatePublisher>& publisher);
+    ~StateReader();
+    StateReader(const StateReader&) = delete;
+    StateReader& operator= (const StateReader&) = delete;
+
+    // Getters
+    bool isAttached() const { return channel != NULL; }
+    const StateSnapshot& snapshot() const;
+
+    // Member functions
+    bool poll();
+
+private:
+    std::shared_ptr<StatePublisher> publisher;
+    StatePublisher::Channel* channel;
+};
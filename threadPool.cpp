@@ -0,0 +1,60 @@
+#include "threadPool.h"
+#include <cassert>
+
+ThreadPool::ThreadPool(unsigned int _numWorkers) : numWorkers(_numWorkers), currentJob(NULL), generation(0), pending(0),
+                                                   stopping(false) {
+    assert (numWorkers > 0);
+    for (unsigned int w = 1; w < numWorkers; w++) {
+        threads.push_back(std::thread(&ThreadPool::workerLoop, this, w));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (unsigned int t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+}
+
+void ThreadPool::runOnAll(const std::function<void(unsigned int)>& job) {
+    // Postcondition: job(w) has been run to completion exactly once for every w in [0, numWorkers).
+    if (numWorkers == 1) {
+        job(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        currentJob = &job;
+        pending = numWorkers - 1;
+        generation++;
+    }
+    jobReady.notify_all();
+    job(0);
+    std::unique_lock<std::mutex> guard(lock);
+    jobDone.wait(guard, [this] { return pending == 0; });
+    currentJob = NULL;
+}
+
+void ThreadPool::workerLoop(unsigned int worker) {
+    unsigned long seen = 0;
+    while (true) {
+        const std::function<void(unsigned int)>* job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            jobReady.wait(guard, [this, seen] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            job = currentJob;
+        }
+        (*job)(worker);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            pending--;
+        }
+        jobDone.notify_one();
+    }
+}
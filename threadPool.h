@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// ==========================================================================================
+// Fixed-size pool of worker threads. A job is a function of the worker index; runOnAll() hands the same job to
+// every worker (the calling thread acts as worker 0) and returns once all of them have finished. Work is split by
+// the caller using the worker index, so which piece of work lands on which worker is fixed for a given pool size,
+// which is what lets callers reduce per-worker results in a reproducible order.
+class ThreadPool {
+public:
+    // Constructor
+    // A pool of size 1 spawns no threads and simply runs jobs inline.
+    explicit ThreadPool(unsigned int _numWorkers);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator= (const ThreadPool&) = delete;
+
+    // Getters
+    unsigned int size() const { return numWorkers; }
+
+    // Member functions
+    void runOnAll(const std::function<void(unsigned int)>& job);
+
+private:
+    void workerLoop(unsigned int worker);
+
+    unsigned int numWorkers;
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    const std::function<void(unsigned int)>* currentJob;
+    unsigned long generation;   // incremented once per job so sleeping workers can tell a new job has arrived
+    unsigned int pending;       // background workers that have not yet finished the current job
+    bool stopping;
+};
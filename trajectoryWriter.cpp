@@ -0,0 +1,130 @@
+#include "trajectoryWriter.h"
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <chrono>
+
+static const char TRAJECTORY_MAGIC[8] = {'A', 'D', 'T', 'R', 'A', 'J', 0, 0};
+
+TrajectoryWriter::TrajectoryWriter(const std::string& filename, double dt, const std::vector<std::string>& IDs,
+                                   const std::vector<double>& masses, unsigned int queueCapacity)
+    : file(NULL), n(IDs.size()), head(0), tail(0), written(0), closing(false) {
+    file = std::fopen(filename.c_str(), "wb");
+    if (!file) return;
+    std::setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+    // Header
+    std::uint32_t version = TRAJECTORY_FORMAT_VERSION;
+    std::uint32_t numBodies = n;
+    std::fwrite(TRAJECTORY_MAGIC, 1, sizeof(TRAJECTORY_MAGIC), file);
+    std::fwrite(&version, sizeof(version), 1, file);
+    std::fwrite(&numBodies, sizeof(numBodies), 1, file);
+    std::fwrite(&dt, sizeof(dt), 1, file);
+    for (unsigned int i = 0; i < n; i++) {
+        std::uint32_t length = IDs[i].size();
+        std::fwrite(&length, sizeof(length), 1, file);
+        std::fwrite(IDs[i].data(), 1, length, file);
+    }
+    std::fwrite(masses.data(), sizeof(double), n, file);
+
+    slots.assign(queueCapacity, std::vector<double>(1 + 4*n));
+    writer = std::thread(&TrajectoryWriter::writerLoop, this);
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+    this->close();
+}
+
+void TrajectoryWriter::push(double time, const double* x, const double* y, const double* vx, const double* vy) {
+    // Abstract: Queue one record. Only the step loop's thread may call this. If the writer has fallen a whole ring
+    //      behind, wait for it to free a slot rather than dropping samples.
+    // Postcondition: The record has been copied, so the caller may overwrite its arrays immediately.
+    if (!file || closing.load(std::memory_order_relaxed)) return;
+    unsigned long h = head.load(std::memory_order_relaxed);
+    while (h - tail.load(std::memory_order_acquire) == slots.size()) {
+        std::this_thread::yield();
+    }
+    double* slot = slots[h % slots.size()].data();
+    slot[0] = time;
+    std::memcpy(slot + 1, x, n*sizeof(double));
+    std::memcpy(slot + 1 + n, y, n*sizeof(double));
+    std::memcpy(slot + 1 + 2*n, vx, n*sizeof(double));
+    std::memcpy(slot + 1 + 3*n, vy, n*sizeof(double));
+    head.store(h + 1, std::memory_order_release);
+}
+
+void TrajectoryWriter::writerLoop() {
+    // Drain the ring in order. When it is empty, back off briefly instead of spinning a core the step loop may need.
+    while (true) {
+        unsigned long t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            if (closing.load(std::memory_order_acquire) && t == head.load(std::memory_order_acquire)) break;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        const std::vector<double>& slot = slots[t % slots.size()];
+        std::fwrite(slot.data(), sizeof(double), slot.size(), file);
+        tail.store(t + 1, std::memory_order_release);
+        written.fetch_add(1, std::memory_order_release);
+    }
+}
+
+void TrajectoryWriter::close() {
+    // Postcondition: Every pushed record is on disk and the file is closed. Safe to call more than once.
+    if (!file) return;
+    closing.store(true, std::memory_order_release);
+    writer.join();
+    std::fclose(file);
+    file = NULL;
+}
+
+bool convertTrajectoryToTextFiles(const std::string& filename) {
+    std::FILE* in = std::fopen(filename.c_str(), "rb");
+    if (!in) return false;
+
+    // State 1 (header read): IDs and record geometry are known.
+    char magic[8];
+    std::uint32_t version = 0, numBodies = 0;
+    double dt;
+    bool ok = std::fread(magic, 1, sizeof(magic), in) == sizeof(magic) && !std::memcmp(magic, TRAJECTORY_MAGIC, 8)
+              && std::fread(&version, sizeof(version), 1, in) == 1 && version == TRAJECTORY_FORMAT_VERSION
+              && std::fread(&numBodies, sizeof(numBodies), 1, in) == 1
+              && std::fread(&dt, sizeof(dt), 1, in) == 1;
+    std::vector<std::string> IDs;
+    for (unsigned int i = 0; ok && i < numBodies; i++) {
+        std::uint32_t length;
+        ok = std::fread(&length, sizeof(length), 1, in) == 1;
+        std::string ID(ok ? length : 0, ' ');
+        ok = ok && std::fread(&ID[0], 1, length, in) == length;
+        IDs.push_back(ID);
+    }
+    std::vector<double> masses(numBodies);
+    ok = ok && std::fread(masses.data(), sizeof(double), numBodies, in) == numBodies;
+    if (!ok) {
+        std::fclose(in);
+        return false;
+    }
+    long dataStart = std::ftell(in);
+
+    // State 2 (text written): Bodies are converted in batches so we never hold too many files open at once,
+    // re-reading the records once per batch.
+    const unsigned int batchSize = 256;
+    std::vector<double> record(1 + 4*numBodies);
+    for (unsigned int first = 0; first < numBodies; first += batchSize) {
+        unsigned int last = std::min(numBodies, first + batchSize);
+        std::vector<std::ofstream> out(last - first);
+        for (unsigned int i = first; i < last; i++) {
+            out[i - first].open(IDs[i] + ".txt");
+            out[i - first] << "Time;Pos_X;Pos_Y;Vel_X;Vel_Y\n";
+        }
+        std::fseek(in, dataStart, SEEK_SET);
+        while (std::fread(record.data(), sizeof(double), record.size(), in) == record.size()) {
+            for (unsigned int i = first; i < last; i++) {
+                out[i - first] << record[0] << ";" << record[1 + i] << ";" << record[1 + numBodies + i] << ";"
+                               << record[1 + 2*numBodies + i] << ";" << record[1 + 3*numBodies + i] << "\n";
+            }
+        }
+    }
+    std::fclose(in);
+    return true;
+}
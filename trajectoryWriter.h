@@ -0,0 +1,63 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+
+// ==========================================================================================
+// Streaming binary trajectory output. The step loop copies each sample into a slot of a fixed-size single-producer
+// single-consumer ring, and a dedicated writer thread drains the ring to disk, so output overlaps with compute and
+// no trajectory has to be held in memory.
+//
+// File layout (host byte order, all doubles IEEE-754 binary64):
+//      char     magic[8]           "ADTRAJ\0\0"
+//      uint32   version            TRAJECTORY_FORMAT_VERSION
+//      uint32   numBodies          n
+//      double   dt                 Frame time step, in seconds
+//      n x { uint32 length; char ID[length]; }
+//      double   mass[n]            in kg
+// followed by any number of records, each 1 + 4n doubles laid out column by column:
+//      double   time; double x[n]; double y[n]; double vx[n]; double vy[n];
+// The columns are fixed by the header. A body removed from the Frame while streaming (e.g. absorbed in a merger)
+// keeps its column, which holds NaN from then on.
+
+const std::uint32_t TRAJECTORY_FORMAT_VERSION = 1;
+
+class TrajectoryWriter {
+public:
+    // Constructor
+    // Opens filename and writes the header. Check isOpen() before pushing records.
+    TrajectoryWriter(const std::string& filename, double dt, const std::vector<std::string>& IDs,
+                     const std::vector<double>& masses, unsigned int queueCapacity = 64);
+    ~TrajectoryWriter();
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator= (const TrajectoryWriter&) = delete;
+
+    // Getters
+    bool isOpen() const { return file != NULL; }
+    unsigned int numBodies() const { return n; }
+    unsigned long recordsWritten() const { return written.load(std::memory_order_acquire); }
+
+    // Member functions
+    void push(double time, const double* x, const double* y, const double* vx, const double* vy);
+    void close();
+
+private:
+    void writerLoop();
+
+    std::FILE* file;
+    unsigned int n;
+    std::vector<std::vector<double>> slots;     // ring of preallocated records
+    std::atomic<unsigned long> head;            // next slot the producer fills
+    std::atomic<unsigned long> tail;            // next slot the writer drains
+    std::atomic<unsigned long> written;
+    std::atomic<bool> closing;
+    std::thread writer;
+};
+
+// Abstract: Convert a binary trajectory file into the semicolon-separated [ID].txt files written by
+//      Frame::saveAllParticleDataToTextFiles(), for use with the MATLAB plotting scripts.
+// Postcondition: One text file per body has been written. Returns false if filename is not a readable trajectory.
+bool convertTrajectoryToTextFiles(const std::string& filename);